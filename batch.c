@@ -0,0 +1,387 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Batch mode: Run many operations with one initialized programmer and probed
+ * chip. Commands come from a script or from the clients of a local socket,
+ * one per line:
+ *
+ *   probe                        check that the chip still answers
+ *   layout <file>                read another layout file
+ *   layout fmap|ifd              take the layout from the flash map or the Intel
+ *                                flash descriptor in the chip
+ *   read <file>                  save the chip contents to <file>
+ *   hash                         print the digests of the chip contents
+ *   write <file> [<region>...]   write <file> (or only its regions) and verify
+ *   verify <file> [<region>...]  verify the chip against <file>
+ *   erase                        erase the chip
+ *   quit                         leave batch mode
+ *
+ * The chip contents are remembered after every operation which leaves them
+ * known, so read and hash touch the chip only after a failed operation, a
+ * partial write without known contents, or probe.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "flash.h"
+#include "programmer.h"
+
+#define BATCH_LINE_MAX 4096
+#define BATCH_MAX_ARGS 64
+
+struct batch {
+	struct flashctx *flash;
+	int force;
+	unsigned long size;
+	uint8_t *contents;	/* Last known chip contents */
+	bool contents_valid;
+	uint8_t *image;		/* Image file of write and verify */
+	/* Reply of the last successful command for socket clients */
+	char result[SHA256_DIGEST_SIZE * 2 + 16];
+};
+
+/* Make sure b->contents holds the chip contents. Returns 1 on error, 0 if the
+ * chip was read and -1 if the contents were known already. */
+static int batch_load_contents(struct batch *b)
+{
+	if (b->contents_valid)
+		return -1;
+	if (doit_buffer(b->flash, b->force, b->contents, 1, 0, 0, 0))
+		return 1;
+	b->contents_valid = true;
+	return 0;
+}
+
+/* Include only the given regions of the layout in the next operation. */
+static int batch_include_regions(char **regions, int count)
+{
+	char *name;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		name = strdup(regions[i]);
+		if (!name) {
+			msg_gerr("Out of memory!\n");
+			exit(1);
+		}
+		if (register_include_arg(name)) {
+			free(name);
+			return 1;
+		}
+	}
+	return process_include_args();
+}
+
+static int batch_hash(struct batch *b)
+{
+	struct flash_digest digest;
+	int i, ret;
+
+	ret = batch_load_contents(b);
+	if (ret > 0)
+		return 1;
+	digest_init(&digest, b->flash, NULL);
+	digest_update(&digest, b->contents, b->size);
+	digest_finish(&digest);
+	/* Reading the chip printed the digests already. */
+	if (ret < 0)
+		digest_print(&digest);
+	for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+		sprintf(b->result + i * 2, "%02x", digest.result[i]);
+	sprintf(b->result + i * 2, " %08x", digest.crc32);
+	return 0;
+}
+
+/* Write or verify the image file, or the given regions of it. */
+static int batch_write_verify(struct batch *b, const char *filename, char **regions, int count,
+			      bool write_it)
+{
+	int ret;
+
+	if (read_buf_from_file(b->image, b->size, filename))
+		return 1;
+	if (batch_include_regions(regions, count)) {
+		clear_include_args();
+		return 1;
+	}
+	ret = doit_buffer(b->flash, b->force, b->image, 0, write_it, 0, 1);
+	if (ret || (write_it && !chip_fully_accessible())) {
+		/* A failed write leaves the chip in an unknown state, and a
+		 * failed verify shows that the known contents are stale.
+		 * Locked or unreadable ranges keep contents which differ from
+		 * the image. */
+		b->contents_valid = false;
+	} else if (!count && chip_fully_accessible()) {
+		/* Nothing was left out of the write or verify. */
+		memcpy(b->contents, b->image, b->size);
+		b->contents_valid = true;
+	} else if (write_it && b->contents_valid) {
+		/* The regions were written, the rest of the chip is unchanged. */
+		build_new_image(b->flash, b->contents, b->image, 0, b->size);
+		memcpy(b->contents, b->image, b->size);
+	}
+	clear_include_args();
+	return ret;
+}
+
+/* A layout file, or the layout stored in the chip itself. */
+static int batch_layout(struct batch *b, const char *arg)
+{
+	bool fmap = !strcmp(arg, "fmap");
+
+	layout_cleanup();
+	if (!fmap && strcmp(arg, "ifd"))
+		return read_romlayout((char *)arg) ? 1 : 0;
+	if (batch_load_contents(b) > 0)
+		return 1;
+	if (fmap ? layout_from_fmap(b->contents, b->size) : layout_from_ifd(b->contents, b->size)) {
+		layout_cleanup();
+		return 1;
+	}
+	return 0;
+}
+
+static int batch_probe(struct batch *b)
+{
+	b->contents_valid = false;
+	if (!b->flash->chip->probe || b->flash->chip->probe(b->flash) != 1) {
+		msg_cerr("The %s flash chip did not answer.\n", b->flash->chip->name);
+		return 1;
+	}
+	msg_cinfo("Found the %s flash chip again.\n", b->flash->chip->name);
+	return 0;
+}
+
+static int batch_command(struct batch *b, int argc, char **argv)
+{
+	const char *cmd = argv[0];
+	int ret;
+
+	b->result[0] = '\0';
+	if (!strcmp(cmd, "probe") && argc == 1)
+		return batch_probe(b);
+	if (!strcmp(cmd, "layout") && argc == 2)
+		return batch_layout(b, argv[1]);
+	if (!strcmp(cmd, "read") && argc == 2) {
+		if (batch_load_contents(b) > 0)
+			return 1;
+		return write_buf_to_file(b->contents, b->size, argv[1]);
+	}
+	if (!strcmp(cmd, "hash") && argc == 1)
+		return batch_hash(b);
+	if (!strcmp(cmd, "write") && argc >= 2)
+		return batch_write_verify(b, argv[1], argv + 2, argc - 2, true);
+	if (!strcmp(cmd, "verify") && argc >= 2)
+		return batch_write_verify(b, argv[1], argv + 2, argc - 2, false);
+	if (!strcmp(cmd, "erase") && argc == 1) {
+		ret = doit_buffer(b->flash, b->force, NULL, 0, 0, 1, 0);
+		memset(b->contents, 0xff, b->size);
+		b->contents_valid = !ret && chip_fully_accessible();
+		return ret;
+	}
+	msg_gerr("Error: Invalid batch command \"%s\" with %i arguments.\n", cmd, argc - 1);
+	return 1;
+}
+
+/* Returned by batch_run() after the quit command. */
+#define BATCH_QUIT	2
+
+/*
+ * Run the commands from in. Without reply, the first failed command ends the
+ * batch and 1 is returned. Otherwise every command is answered with a line of
+ * "ok", optionally followed by a result, or "error". Returns BATCH_QUIT after
+ * the quit command.
+ */
+static int batch_run(struct batch *b, FILE *in, FILE *reply)
+{
+	char line[BATCH_LINE_MAX];
+	char *argv[BATCH_MAX_ARGS];
+	char *tok, *comment;
+	int argc, lineno = 0, ret;
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+		argc = 0;
+		for (tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+			if (argc == BATCH_MAX_ARGS)
+				break;
+			argv[argc++] = tok;
+		}
+		if (!argc)
+			continue;
+		if (!strcmp(argv[0], "quit") && argc == 1) {
+			if (reply)
+				fprintf(reply, "ok\n");
+			return BATCH_QUIT;
+		}
+		if (tok) {
+			msg_gerr("Error: Too many arguments in batch line %i.\n", lineno);
+			ret = 1;
+		} else {
+			msg_ginfo("Batch command: %s\n", argv[0]);
+			ret = batch_command(b, argc, argv);
+		}
+		if (!reply) {
+			if (ret) {
+				msg_gerr("Batch command in line %i failed.\n", lineno);
+				return 1;
+			}
+			continue;
+		}
+		if (ret)
+			fprintf(reply, "error\n");
+		else if (b->result[0])
+			fprintf(reply, "ok %s\n", b->result);
+		else
+			fprintf(reply, "ok\n");
+		fflush(reply);
+	}
+	return 0;
+}
+
+static void batch_init(struct batch *b, struct flashctx *flash, int force)
+{
+	memset(b, 0, sizeof(*b));
+	b->flash = flash;
+	b->force = force;
+	b->size = flash->chip->total_size * 1024;
+	b->contents = malloc(b->size);
+	b->image = malloc(b->size);
+	if (!b->contents || !b->image) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+}
+
+static void batch_free(struct batch *b)
+{
+	free(b->contents);
+	free(b->image);
+}
+
+/* Run the commands in the file script, or stdin if script is "-". */
+int batch_flash(struct flashctx *flash, int force, const char *script)
+{
+	struct batch b;
+	FILE *in = stdin;
+	int ret;
+
+	if (strcmp(script, "-")) {
+		in = fopen(script, "r");
+		if (!in) {
+			msg_gerr("Error: opening batch script \"%s\" failed: %s\n", script,
+				 strerror(errno));
+			return 1;
+		}
+	}
+	batch_init(&b, flash, force);
+	ret = batch_run(&b, in, NULL);
+	batch_free(&b);
+	if (in != stdin)
+		fclose(in);
+	return ret == BATCH_QUIT ? 0 : ret;
+}
+
+#if !defined(_WIN32) && !defined(__DJGPP__) && !defined(__LIBPAYLOAD__)
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Serve the clients of the local socket path, one after the other, until one
+ * of them sends quit. */
+int batch_listen(struct flashctx *flash, int force, const char *path)
+{
+	struct sockaddr_un addr;
+	struct batch b;
+	struct stat st;
+	FILE *in, *out;
+	int fd, conn, ret = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		msg_gerr("Error: Socket path \"%s\" is too long.\n", path);
+		return 1;
+	}
+	/* A socket left over by an earlier run is replaced, anything else is
+	 * not ours to remove. */
+	if (!lstat(path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			msg_gerr("Error: \"%s\" exists and is not a socket.\n", path);
+			return 1;
+		}
+		unlink(path);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1)) {
+		msg_gerr("Error: listening on \"%s\" failed: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+	/* A client going away must not kill us. */
+	signal(SIGPIPE, SIG_IGN);
+
+	batch_init(&b, flash, force);
+	msg_ginfo("Waiting for batch commands on %s.\n", path);
+	while (ret != BATCH_QUIT) {
+		conn = accept(fd, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR)
+				continue;
+			msg_gerr("Error: accepting a connection failed: %s\n", strerror(errno));
+			ret = 1;
+			break;
+		}
+		in = fdopen(conn, "r");
+		out = in ? fdopen(dup(conn), "w") : NULL;
+		if (!in || !out) {
+			msg_gerr("Error: setting up a connection failed: %s\n", strerror(errno));
+			if (in)
+				fclose(in);
+			else
+				close(conn);
+			continue;
+		}
+		ret = batch_run(&b, in, out);
+		fclose(out);
+		fclose(in);
+	}
+	batch_free(&b);
+	close(fd);
+	unlink(path);
+	return ret == BATCH_QUIT ? 0 : ret;
+}
+
+#else
+
+int batch_listen(struct flashctx *flash, int force, const char *path)
+{
+	msg_gerr("Error: Local sockets are not supported on this platform.\n");
+	return 1;
+}
+
+#endif
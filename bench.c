@@ -0,0 +1,309 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Programmer benchmark: Measure read throughput for different SPI read chunk
+ * sizes and the latency of batched multicommands on a probed chip. The best
+ * read chunk size can be saved in a profile which later runs with the same
+ * programmer parameters and chip pick up automatically.
+ *
+ * The benchmark only reads, it never erases or writes the chip.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "flash.h"
+#include "chipdrivers.h"
+#include "programmer.h"
+#include "spi.h"
+
+/* At most this much of the chip is read for every chunk size... */
+#define BENCH_REGION_MAX	(256 * 1024)
+/* ...unless it takes longer than this. */
+#define BENCH_TIME_US		(1000 * 1000)
+#define BENCH_MIN_CHUNK		16
+#define BENCH_MAX_BATCH		32
+/* Status register reads for every batch size. */
+#define BENCH_BATCH_COMMANDS	256
+#define PROFILE_LINE_MAX	1024
+
+struct bench_result {
+	unsigned int size;
+	unsigned long long bytes;
+	unsigned long long us;
+	uint32_t p50, p90, p99;
+	int failed;
+};
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void percentiles(struct bench_result *res, uint32_t *lat, unsigned int n)
+{
+	if (!n)
+		return;
+	qsort(lat, n, sizeof(*lat), compare_u32);
+	res->p50 = lat[(n - 1) * 50 / 100];
+	res->p90 = lat[(n - 1) * 90 / 100];
+	res->p99 = lat[(n - 1) * 99 / 100];
+}
+
+static double kb_per_s(unsigned long long bytes, unsigned long long us)
+{
+	return us ? bytes * 1000000.0 / 1024 / us : 0;
+}
+
+/* Can the read chunk size be tuned with preferred_data_read? */
+static int read_chunk_tunable(const struct flashctx *flash)
+{
+	return flash->chip->read == spi_chip_read && flash->pgm->spi.read == default_spi_read &&
+	       flash->pgm->spi.max_data_read != MAX_DATA_UNSPECIFIED;
+}
+
+/* Read region bytes in transactions of chunk bytes and compare with ref. */
+static void bench_read_chunk(struct flashctx *flash, uint8_t *buf, const uint8_t *ref,
+			     unsigned int region, struct bench_result *res)
+{
+	unsigned int chunk = res->size, addr, n = 0;
+	uint64_t start, t;
+	uint32_t *lat;
+
+	lat = malloc(region / chunk * sizeof(*lat));
+	if (!lat) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	start = time_us();
+	for (addr = 0; addr + chunk <= region; addr += chunk) {
+		t = time_us();
+		if (spi_read_chunked(flash, buf + addr, addr, chunk, chunk)) {
+			res->failed = 1;
+			break;
+		}
+		lat[n++] = time_us() - t;
+		if (time_us() - start > BENCH_TIME_US)
+			break;
+	}
+	res->us = time_us() - start;
+	res->bytes = (unsigned long long)n * chunk;
+	/* A chunk size which corrupts data must never be picked. */
+	if (memcmp(buf, ref, res->bytes))
+		res->failed = 1;
+	percentiles(res, lat, n);
+	free(lat);
+}
+
+/* Send BENCH_BATCH_COMMANDS status register reads in multicommands of batch
+ * commands each. Latencies are per multicommand. */
+static void bench_batch(struct flashctx *flash, struct bench_result *res)
+{
+	static const unsigned char cmd[JEDEC_RDSR_OUTSIZE] = { JEDEC_RDSR };
+	unsigned char readarr[BENCH_MAX_BATCH][2];
+	struct spi_command cmds[BENCH_MAX_BATCH + 1];
+	uint32_t lat[BENCH_BATCH_COMMANDS];
+	unsigned int i, n = 0, batch = res->size;
+	uint64_t start, t;
+
+	for (i = 0; i < batch; i++)
+		cmds[i] = (struct spi_command) {
+			.writecnt	= JEDEC_RDSR_OUTSIZE,
+			.writearr	= cmd,
+			.readcnt	= sizeof(readarr[i]),
+			.readarr	= readarr[i],
+		};
+	cmds[batch] = (struct spi_command) { .writecnt = 0 };
+	start = time_us();
+	for (i = 0; i < BENCH_BATCH_COMMANDS / batch; i++) {
+		t = time_us();
+		if (spi_send_multicommand(flash, cmds)) {
+			res->failed = 1;
+			break;
+		}
+		lat[n++] = time_us() - t;
+	}
+	res->us = time_us() - start;
+	res->bytes = (unsigned long long)n * batch;
+	percentiles(res, lat, n);
+}
+
+/*
+ * Benchmark the programmer of flash. If profile is not NULL, the fastest read
+ * chunk size is saved there for the programmer and chip identified by key.
+ */
+int benchmark_flash(struct flashctx *flash, const char *profile, const char *key)
+{
+	struct bench_result res, best = { .size = 0 };
+	unsigned int size = flash->chip->total_size * 1024;
+	unsigned int region = min(size, BENCH_REGION_MAX);
+	unsigned int max_chunk, chunk, batch;
+	uint8_t *buf, *ref;
+	uint64_t t;
+	int ret = 0;
+
+	if (!flash->chip->read) {
+		msg_cerr("No read function available for this flash chip.\n");
+		return 1;
+	}
+	buf = malloc(region);
+	ref = malloc(region);
+	if (!buf || !ref) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	msg_cinfo("Benchmarking reads of %u kB.\n", region / 1024);
+	t = time_us();
+	if (flash->chip->read(flash, ref, 0, region)) {
+		msg_cerr("Read operation failed!\n");
+		ret = 1;
+		goto out;
+	}
+	t = time_us() - t;
+	msg_cinfo("Current settings: %.1f kB/s\n", kb_per_s(region, t));
+
+	if (!read_chunk_tunable(flash)) {
+		msg_cinfo("The read chunk size of this programmer and chip cannot be tuned.\n");
+	} else {
+		max_chunk = min(flash->pgm->spi.max_data_read, region);
+		msg_cinfo("Read chunk   Throughput      p50      p90      p99 (us per transaction)\n");
+		/* Powers of two and max_chunk itself. */
+		for (chunk = min(BENCH_MIN_CHUNK, max_chunk); ; chunk = min(chunk * 2, max_chunk)) {
+			memset(&res, 0, sizeof(res));
+			res.size = chunk;
+			bench_read_chunk(flash, buf, ref, region, &res);
+			if (res.failed) {
+				msg_cinfo("%8u B   FAILED\n", chunk);
+			} else {
+				msg_cinfo("%8u B %7.1f kB/s %8u %8u %8u\n", chunk,
+					  kb_per_s(res.bytes, res.us), res.p50, res.p90, res.p99);
+				if (!best.size ||
+				    kb_per_s(res.bytes, res.us) > kb_per_s(best.bytes, best.us))
+					best = res;
+			}
+			if (chunk == max_chunk)
+				break;
+		}
+		if (best.size)
+			msg_cinfo("Best read chunk size: %u bytes (%.1f kB/s).\n", best.size,
+				  kb_per_s(best.bytes, best.us));
+	}
+
+	if (flash->chip->bustype & BUS_SPI) {
+		msg_cinfo("Batch        Commands/s      p50      p90      p99 (us per multicommand)\n");
+		for (batch = 1; batch <= BENCH_MAX_BATCH; batch *= 2) {
+			memset(&res, 0, sizeof(res));
+			res.size = batch;
+			bench_batch(flash, &res);
+			if (res.failed) {
+				msg_cinfo("%8u     FAILED\n", batch);
+				continue;
+			}
+			msg_cinfo("%8u %12.0f %8u %8u %8u\n", batch,
+				  res.us ? res.bytes * 1000000.0 / res.us : 0, res.p50, res.p90, res.p99);
+		}
+	}
+
+	if (profile && !best.size) {
+		msg_cerr("Nothing to save in the profile.\n");
+		ret = 1;
+	} else if (profile) {
+		ret = save_profile(profile, key, best.size);
+	}
+out:
+	free(buf);
+	free(ref);
+	return ret;
+}
+
+/* Does line start with key followed by a tab? */
+static int profile_line_matches(const char *line, const char *key)
+{
+	size_t len = strlen(key);
+
+	return !strncmp(line, key, len) && line[len] == '\t';
+}
+
+/*
+ * Profile lines look like "<key>\tread_chunk=<bytes>\n", where the key names
+ * programmer, parameters and chip. Other lines are kept as they are.
+ */
+int save_profile(const char *profile, const char *key, unsigned int read_chunk)
+{
+	char line[PROFILE_LINE_MAX];
+	char *tmpname;
+	FILE *in, *out;
+	int ret = 0;
+
+	tmpname = malloc(strlen(profile) + 5);
+	if (!tmpname) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	sprintf(tmpname, "%s.new", profile);
+	out = fopen(tmpname, "w");
+	if (!out) {
+		msg_gerr("Error: creating profile \"%s\" failed: %s\n", tmpname, strerror(errno));
+		free(tmpname);
+		return 1;
+	}
+	in = fopen(profile, "r");
+	if (in) {
+		while (fgets(line, sizeof(line), in))
+			if (!profile_line_matches(line, key))
+				fputs(line, out);
+		fclose(in);
+	}
+	fprintf(out, "%s\tread_chunk=%u\n", key, read_chunk);
+	if (fclose(out) || rename(tmpname, profile)) {
+		msg_gerr("Error: writing profile \"%s\" failed: %s\n", profile, strerror(errno));
+		ret = 1;
+	} else {
+		msg_cinfo("Saved read chunk size %u to profile \"%s\".\n", read_chunk, profile);
+	}
+	free(tmpname);
+	return ret;
+}
+
+/* Apply the settings saved for key, if there are any. A missing profile is
+ * not an error. */
+void load_profile(struct flashctx *flash, const char *profile, const char *key)
+{
+	char line[PROFILE_LINE_MAX];
+	unsigned int read_chunk = 0;
+	FILE *f;
+
+	f = fopen(profile, "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+		if (profile_line_matches(line, key))
+			sscanf(line + strlen(key) + 1, "read_chunk=%u", &read_chunk);
+	fclose(f);
+	if (!read_chunk)
+		return;
+	if (!read_chunk_tunable(flash) || read_chunk > flash->pgm->spi.max_data_read) {
+		msg_cdbg("Ignoring read chunk size %u from profile \"%s\".\n", read_chunk, profile);
+		return;
+	}
+	msg_cinfo("Using read chunk size %u from profile \"%s\".\n", read_chunk, profile);
+	flash->pgm->spi.preferred_data_read = read_chunk;
+}
@@ -63,6 +63,9 @@ static int bitbang_spi_send_command(struct flashctx *flash,
 				    const unsigned char *writearr,
 				    unsigned char *readarr);
 
+static int bitbang_spi_wait_miso_ready(struct flashctx *flash,
+				       unsigned int timeout_us);
+
 static const struct spi_programmer spi_programmer_bitbang = {
 	.type		= SPI_CONTROLLER_BITBANG,
 	.max_data_read	= MAX_DATA_READ_UNLIMITED,
@@ -72,6 +75,7 @@ static const struct spi_programmer spi_programmer_bitbang = {
 	.read		= default_spi_read,
 	.write_256	= default_spi_write_256,
 	.write_aai	= default_spi_write_aai,
+	.wait_miso_ready = bitbang_spi_wait_miso_ready,
 };
 
 #if 0 // until it is needed
@@ -158,3 +162,28 @@ static int bitbang_spi_send_command(struct flashctx *flash,
 
 	return 0;
 }
+
+/* Select the chip without clocking and wait until it drives MISO high. */
+static int bitbang_spi_wait_miso_ready(struct flashctx *flash,
+				       unsigned int timeout_us)
+{
+	const struct bitbang_spi_master *master = flash->pgm->spi.data;
+	uint64_t start = time_us();
+	int ret = 0;
+
+	bitbang_spi_request_bus(master);
+	bitbang_spi_set_cs(master, 0);
+	while (!bitbang_spi_get_miso(master)) {
+		if (time_us() - start > timeout_us) {
+			msg_cerr("%s: timeout after %u us\n", __func__, timeout_us);
+			ret = TIMEOUT_ERROR;
+			break;
+		}
+		programmer_delay(master->half_period);
+	}
+	bitbang_spi_set_cs(master, 1);
+	programmer_delay(master->half_period);
+	bitbang_spi_release_bus(master);
+
+	return ret;
+}
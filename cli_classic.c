@@ -41,13 +41,19 @@ static void cli_classic_usage(const char *name)
 	       "-z|"
 #endif
 	       "-p <programmername>[:<parameters>] [-c <chipname>]\n"
-	       "[-E|(-r|-w|-v) <file>] [-l <layoutfile> [-i <imagename>]...] [-n] [-f]]\n"
+	       "[-E|--digest|(-r|-w|-v) <file>] [(-l <layoutfile>|--ifd|--fmap) [-i <imagename>]...]\n"
+	       "[-n] [-f] [--skip-locked]]\n"
+	       "[--manifest <file>] [--perf-report <file>] [--trace <file>] [--journal <file>]\n"
+	       "[--replay <file>|--trace-diff <file1> <file2>|--benchmark [--save-profile]|\n"
+	       "--stress <patterns>|--batch <file>|--listen <socket>]\n"
+	       "[--gang <programmer>[:<parameters>]]...\n"
+	       "[--profile <file>] "
 	       "[-V[V[V]]] [-o <logfile>]\n\n", name);
 
 	printf(" -h | --help                        print this help text\n"
 	       " -R | --version                     print version (release)\n"
-	       " -r | --read <file>                 read flash and save to <file>\n"
-	       " -w | --write <file>                write <file> to flash\n"
+	       " -r | --read <file>                 read flash and save to <file> (- for stdout)\n"
+	       " -w | --write <file>                write <file> (- for stdin) to flash\n"
 	       " -v | --verify <file>               verify flash against <file>\n"
 	       " -E | --erase                       erase flash memory\n"
 	       " -V | --verbose                     more verbose output\n"
@@ -56,7 +62,27 @@ static void cli_classic_usage(const char *name)
 	       " -n | --noverify                    don't auto-verify\n"
 	       " -l | --layout <layoutfile>         read ROM layout from <layoutfile>\n"
 	       " -i | --image <name>                only flash image <name> from flash layout\n"
+	       "      --ifd                         read layout from the Intel flash descriptor of\n"
+	       "                                    the image file\n"
+	       "      --fmap                        read layout from the flash map of the image file\n"
+	       "      --skip-locked                 leave out ranges locked by the programmer\n"
+	       "      --journal <file>              record written blocks in <file> to resume an\n"
+	       "                                    interrupted write\n"
 	       " -o | --output <logfile>            log output to <logfile>\n"
+	       "      --digest                      print digests of the flash contents\n"
+	       "      --manifest <file>             save digests of all erase blocks to <file>\n"
+	       "      --perf-report <file>          save performance counters as JSON to <file>\n"
+	       "      --trace <file>                record all SPI transactions to <file>\n"
+	       "      --replay <file>               replay a recorded SPI trace (dummy only)\n"
+	       "      --trace-diff <file1> <file2>  compare two SPI traces\n"
+	       "      --benchmark                   measure programmer throughput and latency\n"
+	       "      --stress <patterns>|all       write and verify test patterns (e.g. 0,8-11)\n"
+	       "      --batch <file>                run the operations in <file> (- for stdin)\n"
+	       "      --listen <socket>             run the operations sent to a local socket\n"
+	       "      --gang <programmer>           run the operation on this programmer as well\n"
+	       "                                    (repeat for each programmer, instead of -p)\n"
+	       "      --save-profile                save the tuned settings from --benchmark\n"
+	       "      --profile <file>              use <file> instead of ~/.flashrom_profile\n"
 	       " -L | --list-supported              print supported devices\n"
 #if CONFIG_PRINT_WIKI == 1
 	       " -z | --list-supported-wiki         print supported devices in wiki syntax\n"
@@ -67,7 +93,7 @@ static void cli_classic_usage(const char *name)
 #if CONFIG_PRINT_WIKI == 1
 	         "-z, "
 #endif
-	         "-E, -r, -w, -v or no operation.\n"
+	         "-E, -r, -w, -v, --digest or no operation.\n"
 	       "If no operation is specified, flashrom will only probe for flash chips.\n");
 }
 
@@ -84,11 +110,107 @@ static int check_filename(char *filename, char *type)
 		return 1;
 	}
 	/* Not an error, but maybe the user intended to specify a CLI option instead of a file name. */
-	if (filename[0] == '-')
+	if (filename[0] == '-' && filename[1] != '\0')
 		fprintf(stderr, "Warning: Supplied %s file name starts with -\n", type);
 	return 0;
 }
 
+/* Find the programmer of spec, which looks like "name[:parameters]". The
+ * parameters are stored in *pparam (NULL if there are none). */
+static enum programmer parse_programmer(const char *spec, char **pparam)
+{
+	enum programmer prog;
+	const char *name;
+	int namelen;
+
+	*pparam = NULL;
+	for (prog = 0; prog < PROGRAMMER_INVALID; prog++) {
+		name = programmer_table[prog].name;
+		namelen = strlen(name);
+		if (strncmp(spec, name, namelen) == 0) {
+			switch (spec[namelen]) {
+			case ':':
+				*pparam = strdup(spec + namelen + 1);
+				if (!strlen(*pparam)) {
+					free(*pparam);
+					*pparam = NULL;
+				}
+				break;
+			case '\0':
+				break;
+			default:
+				/* The continue refers to the for loop. It is
+				 * here to be able to differentiate between foo
+				 * and foobar.
+				 */
+				continue;
+			}
+			break;
+		}
+	}
+	return prog;
+}
+
+/* Find the long option name (or an abbreviation of it) of length len. */
+static const struct option *find_long_option(const struct option *long_options, const char *name,
+					     size_t len)
+{
+	const struct option *o, *found = NULL;
+
+	for (o = long_options; o->name; o++) {
+		if (strncmp(o->name, name, len))
+			continue;
+		if (strlen(o->name) == len)
+			return o;
+		if (!found)
+			found = o;
+	}
+	return found;
+}
+
+/* Check if the image is to be read to stdout. This has to be known before the
+ * first message is printed, i.e. before the options are parsed, so the
+ * arguments are walked like getopt_long() does, including clustered short
+ * options like -Vr-. */
+static int image_to_stdout(int argc, char *argv[], const char *optstring,
+			   const struct option *long_options)
+{
+	const struct option *o;
+	const char *arg, *val, *eq, *c, *p;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!strcmp(arg, "--"))
+			break;
+		if (!strncmp(arg, "--", 2)) {
+			eq = strchr(arg, '=');
+			o = find_long_option(long_options, arg + 2,
+					     eq ? eq - arg - 2 : strlen(arg + 2));
+			if (!o || !o->has_arg)
+				continue;
+			val = eq ? eq + 1 : (i + 1 < argc ? argv[++i] : NULL);
+			if (o->val == 'r' && val && !strcmp(val, "-"))
+				return 1;
+			continue;
+		}
+		if (arg[0] != '-' || !arg[1])
+			continue;
+		for (c = arg + 1; *c; c++) {
+			p = *c != ':' ? strchr(optstring, *c) : NULL;
+			if (!p || p[1] != ':')
+				continue;
+			/* The rest of the argument or the next one is the
+			 * option argument. */
+			val = c[1] ? c + 1 : (i + 1 < argc ? argv[++i] : NULL);
+			if (*c == 'r' && val && !strcmp(val, "-"))
+				return 1;
+			break;
+		}
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	unsigned long size;
@@ -96,17 +218,36 @@ int main(int argc, char *argv[])
 	const struct flashchip *chip = NULL;
 	struct flashctx flashes[3] = {{0}};
 	struct flashctx *fill_flash;
-	const char *name;
-	int namelen, opt, i, j;
+	int opt, i, j;
 	int startchip = -1, chipcount = 0, option_index = 0, force = 0;
 #if CONFIG_PRINT_WIKI == 1
 	int list_supported_wiki = 0;
 #endif
-	int read_it = 0, write_it = 0, erase_it = 0, verify_it = 0;
+	int read_it = 0, write_it = 0, erase_it = 0, verify_it = 0, digest_it = 0;
 	int dont_verify_it = 0, list_supported = 0, operation_specified = 0;
 	enum programmer prog = PROGRAMMER_INVALID;
 	int ret = 0;
 
+	/* Values for options without a short form, outside the char range. */
+	enum {
+		OPTION_DIGEST = 0x100,
+		OPTION_MANIFEST,
+		OPTION_PERF_REPORT,
+		OPTION_TRACE,
+		OPTION_REPLAY,
+		OPTION_TRACE_DIFF,
+		OPTION_BENCHMARK,
+		OPTION_PROFILE,
+		OPTION_SAVE_PROFILE,
+		OPTION_STRESS,
+		OPTION_GANG,
+		OPTION_BATCH,
+		OPTION_LISTEN,
+		OPTION_IFD,
+		OPTION_FMAP,
+		OPTION_SKIP_LOCKED,
+		OPTION_JOURNAL,
+	};
 	static const char optstring[] = "r:Rw:v:nVEfc:l:i:p:Lzho:";
 	static const struct option long_options[] = {
 		{"read",		1, NULL, 'r'},
@@ -125,6 +266,23 @@ int main(int argc, char *argv[])
 		{"help",		0, NULL, 'h'},
 		{"version",		0, NULL, 'R'},
 		{"output",		1, NULL, 'o'},
+		{"digest",		0, NULL, OPTION_DIGEST},
+		{"manifest",		1, NULL, OPTION_MANIFEST},
+		{"perf-report",		1, NULL, OPTION_PERF_REPORT},
+		{"trace",		1, NULL, OPTION_TRACE},
+		{"replay",		1, NULL, OPTION_REPLAY},
+		{"trace-diff",		1, NULL, OPTION_TRACE_DIFF},
+		{"benchmark",		0, NULL, OPTION_BENCHMARK},
+		{"profile",		1, NULL, OPTION_PROFILE},
+		{"save-profile",	0, NULL, OPTION_SAVE_PROFILE},
+		{"stress",		1, NULL, OPTION_STRESS},
+		{"gang",		1, NULL, OPTION_GANG},
+		{"batch",		1, NULL, OPTION_BATCH},
+		{"listen",		1, NULL, OPTION_LISTEN},
+		{"ifd",			0, NULL, OPTION_IFD},
+		{"fmap",		0, NULL, OPTION_FMAP},
+		{"skip-locked",		0, NULL, OPTION_SKIP_LOCKED},
+		{"journal",		1, NULL, OPTION_JOURNAL},
 		{NULL,			0, NULL, 0},
 	};
 
@@ -135,6 +293,23 @@ int main(int argc, char *argv[])
 #endif /* !STANDALONE */
 	char *tempstr = NULL;
 	char *pparam = NULL;
+	char *perf_report_file = NULL;
+	char *trace_file = NULL, *replay_file = NULL;
+	char *trace_diff[2] = { NULL, NULL };
+	char *profile = NULL, *profile_key = NULL;
+	int benchmark_it = 0, save_profile_it = 0;
+	char *stress_patterns = NULL;
+	char *batch_script = NULL, *batch_socket = NULL;
+	int regions_included = 0;
+	int ifd_it = 0, fmap_it = 0;
+	char **gang_specs = NULL;
+	int gang_count = 0, device;
+
+	flashrom_set_log_callback(&flashrom_print_cb, NULL);
+
+	/* "-" as image file for -r writes the image to stdout. */
+	if (image_to_stdout(argc, argv, optstring, long_options))
+		print_to_stderr_only();
 
 	print_version();
 	print_banner();
@@ -158,6 +333,122 @@ int main(int argc, char *argv[])
 			filename = strdup(optarg);
 			read_it = 1;
 			break;
+		case OPTION_DIGEST:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			/* A read without image file only computes digests. */
+			read_it = 1;
+			digest_it = 1;
+			break;
+		case OPTION_MANIFEST:
+			if (digest_manifest) {
+				fprintf(stderr, "Error: --manifest specified "
+					"more than once. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			digest_manifest = strdup(optarg);
+			break;
+		case OPTION_PERF_REPORT:
+			if (perf_report_file) {
+				fprintf(stderr, "Error: --perf-report specified "
+					"more than once. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			perf_report_file = strdup(optarg);
+			break;
+		case OPTION_TRACE:
+			if (trace_file) {
+				fprintf(stderr, "Error: --trace specified "
+					"more than once. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			trace_file = strdup(optarg);
+			break;
+		case OPTION_REPLAY:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			replay_file = strdup(optarg);
+			break;
+		case OPTION_TRACE_DIFF:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			/* The second trace is the next argument. */
+			if (optind >= argc) {
+				fprintf(stderr, "Error: --trace-diff needs two traces.\n");
+				cli_classic_abort_usage();
+			}
+			trace_diff[0] = strdup(optarg);
+			trace_diff[1] = strdup(argv[optind++]);
+			break;
+		case OPTION_BENCHMARK:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			benchmark_it = 1;
+			break;
+		case OPTION_PROFILE:
+			if (profile) {
+				fprintf(stderr, "Error: --profile specified "
+					"more than once. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			profile = strdup(optarg);
+			break;
+		case OPTION_SAVE_PROFILE:
+			save_profile_it = 1;
+			break;
+		case OPTION_STRESS:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			stress_patterns = strdup(optarg);
+			break;
+		case OPTION_BATCH:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			batch_script = strdup(optarg);
+			break;
+		case OPTION_LISTEN:
+			if (++operation_specified > 1) {
+				fprintf(stderr, "More than one operation "
+					"specified. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			batch_socket = strdup(optarg);
+			break;
+		case OPTION_GANG:
+			if (parse_programmer(optarg, &tempstr) == PROGRAMMER_INVALID) {
+				fprintf(stderr, "Error: Unknown programmer \"%s\". Valid choices are:\n",
+					optarg);
+				list_programmers_linebreak(0, 80, 0);
+				msg_ginfo(".\n");
+				cli_classic_abort_usage();
+			}
+			free(tempstr);
+			tempstr = NULL;
+			gang_specs = realloc(gang_specs, (gang_count + 1) * sizeof(*gang_specs));
+			if (!gang_specs) {
+				fprintf(stderr, "Out of memory!\n");
+				exit(1);
+			}
+			gang_specs[gang_count++] = strdup(optarg);
+			break;
 		case 'w':
 			if (++operation_specified > 1) {
 				fprintf(stderr, "More than one operation "
@@ -215,12 +506,30 @@ int main(int argc, char *argv[])
 			}
 			layoutfile = strdup(optarg);
 			break;
+		case OPTION_IFD:
+			ifd_it = 1;
+			break;
+		case OPTION_FMAP:
+			fmap_it = 1;
+			break;
+		case OPTION_SKIP_LOCKED:
+			skip_locked = true;
+			break;
+		case OPTION_JOURNAL:
+			if (journal_file) {
+				fprintf(stderr, "Error: --journal specified "
+					"more than once. Aborting.\n");
+				cli_classic_abort_usage();
+			}
+			journal_file = strdup(optarg);
+			break;
 		case 'i':
 			tempstr = strdup(optarg);
 			if (register_include_arg(tempstr)) {
 				free(tempstr);
 				cli_classic_abort_usage();
 			}
+			regions_included = 1;
 			break;
 		case 'L':
 			if (++operation_specified > 1) {
@@ -253,31 +562,7 @@ int main(int argc, char *argv[])
 					"for details.\n");
 				cli_classic_abort_usage();
 			}
-			for (prog = 0; prog < PROGRAMMER_INVALID; prog++) {
-				name = programmer_table[prog].name;
-				namelen = strlen(name);
-				if (strncmp(optarg, name, namelen) == 0) {
-					switch (optarg[namelen]) {
-					case ':':
-						pparam = strdup(optarg + namelen + 1);
-						if (!strlen(pparam)) {
-							free(pparam);
-							pparam = NULL;
-						}
-						break;
-					case '\0':
-						break;
-					default:
-						/* The continue refers to the
-						 * for loop. It is here to be
-						 * able to differentiate between
-						 * foo and foobar.
-						 */
-						continue;
-					}
-					break;
-				}
-			}
+			prog = parse_programmer(optarg, &pparam);
 			if (prog == PROGRAMMER_INVALID) {
 				fprintf(stderr, "Error: Unknown programmer \"%s\". Valid choices are:\n",
 					optarg);
@@ -327,12 +612,93 @@ int main(int argc, char *argv[])
 		cli_classic_abort_usage();
 	}
 
-	if ((read_it | write_it | verify_it) && check_filename(filename, "image")) {
+	if ((read_it | write_it | verify_it) && !digest_it && check_filename(filename, "image")) {
+		cli_classic_abort_usage();
+	}
+	if (digest_manifest && check_filename((char *)digest_manifest, "manifest")) {
+		cli_classic_abort_usage();
+	}
+	if (perf_report_file && check_filename(perf_report_file, "performance report")) {
+		cli_classic_abort_usage();
+	}
+	if (trace_file && check_filename(trace_file, "trace")) {
+		cli_classic_abort_usage();
+	}
+	if (replay_file && check_filename(replay_file, "trace")) {
+		cli_classic_abort_usage();
+	}
+	if (batch_script && check_filename(batch_script, "batch")) {
+		cli_classic_abort_usage();
+	}
+	if (batch_socket && check_filename(batch_socket, "socket")) {
+		cli_classic_abort_usage();
+	}
+	if ((batch_script || batch_socket) && regions_included) {
+		fprintf(stderr, "Error: Regions are selected in the batch commands, not with -i.\n");
+		cli_classic_abort_usage();
+	}
+	if (profile && check_filename(profile, "profile")) {
+		cli_classic_abort_usage();
+	}
+	if (save_profile_it && !benchmark_it) {
+		fprintf(stderr, "Error: --save-profile needs --benchmark.\n");
+		cli_classic_abort_usage();
+	}
+	/* Settings tuned with --benchmark are kept in the home directory by default. */
+	if (!profile && getenv("HOME")) {
+		profile = malloc(strlen(getenv("HOME")) + sizeof("/.flashrom_profile"));
+		if (!profile) {
+			fprintf(stderr, "Out of memory!\n");
+			exit(1);
+		}
+		sprintf(profile, "%s/.flashrom_profile", getenv("HOME"));
+	}
+	if (trace_diff[0] && (check_filename(trace_diff[0], "trace") ||
+			      check_filename(trace_diff[1], "trace"))) {
+		cli_classic_abort_usage();
+	}
+	if (digest_manifest && !(read_it | verify_it | (write_it && !dont_verify_it))) {
+		fprintf(stderr, "Error: --manifest needs an operation reading the whole chip.\n");
 		cli_classic_abort_usage();
 	}
 	if (layoutfile && check_filename(layoutfile, "layout")) {
 		cli_classic_abort_usage();
 	}
+	if (journal_file && check_filename((char *)journal_file, "journal")) {
+		cli_classic_abort_usage();
+	}
+	/* Every ganged device would need a journal of its own. */
+	if (journal_file && (!write_it || !strcmp(filename, "-") || gang_count)) {
+		fprintf(stderr, "Error: --journal needs --write with an image file and no --gang.\n");
+		cli_classic_abort_usage();
+	}
+	if ((layoutfile != NULL) + ifd_it + fmap_it > 1) {
+		fprintf(stderr, "Error: Only one of --layout, --ifd and --fmap can be used.\n");
+		cli_classic_abort_usage();
+	}
+	/* The layout is taken from the image before the chip is touched. */
+	if ((ifd_it || fmap_it) && (!write_it || !strcmp(filename, "-"))) {
+		fprintf(stderr, "Error: --ifd and --fmap need an image file to write.\n");
+		cli_classic_abort_usage();
+	}
+	if (gang_count && prog != PROGRAMMER_INVALID) {
+		fprintf(stderr, "Error: --gang and --programmer can not be used together.\n");
+		cli_classic_abort_usage();
+	}
+	/* All devices get the same image, and every output file would be
+	 * written by all of them. */
+	if (gang_count && (!(write_it | verify_it | erase_it) || perf_report_file || trace_file ||
+			   digest_manifest)) {
+		fprintf(stderr, "Error: --gang only works with --write, --verify or --erase and\n"
+			"without --perf-report, --trace and --manifest.\n");
+		cli_classic_abort_usage();
+	}
+#ifndef STANDALONE
+	if (gang_count && logfile) {
+		fprintf(stderr, "Error: --gang can not be used with --output.\n");
+		cli_classic_abort_usage();
+	}
+#endif /* !STANDALONE */
 
 #ifndef STANDALONE
 	if (logfile && check_filename(logfile, "log"))
@@ -366,11 +732,20 @@ int main(int argc, char *argv[])
 	}
 	msg_gdbg("\n");
 
+	if (trace_diff[0]) {
+		ret = spi_trace_diff(trace_diff[0], trace_diff[1]);
+		goto out;
+	}
+
 	if (layoutfile && read_romlayout(layoutfile)) {
 		ret = 1;
 		goto out;
 	}
-	if (layoutfile != NULL && !write_it) {
+	if ((ifd_it || fmap_it) && read_image_layout(filename, fmap_it)) {
+		ret = 1;
+		goto out;
+	}
+	if (layoutfile != NULL && !write_it && !stress_patterns && !batch_script && !batch_socket) {
 		msg_gerr("Layout files are currently supported for write operations only.\n");
 		ret = 1;
 		goto out;
@@ -394,7 +769,16 @@ int main(int argc, char *argv[])
 		/* Keep chip around for later usage in case a forced read is requested. */
 	}
 
-	if (prog == PROGRAMMER_INVALID) {
+#if CONFIG_DUMMY == 1
+	/* Without a programmer, the stress test runs on an emulated chip, e.g. in CI. */
+	if (prog == PROGRAMMER_INVALID && stress_patterns) {
+		prog = PROGRAMMER_DUMMY;
+		pparam = strdup("emulate=SST25VF032B");
+		msg_pinfo("Running the stress test on an emulated chip.\n");
+	}
+#endif
+
+	if (prog == PROGRAMMER_INVALID && !gang_count) {
 		if (CONFIG_DEFAULT_PROGRAMMER != PROGRAMMER_INVALID) {
 			prog = CONFIG_DEFAULT_PROGRAMMER;
 			msg_pinfo("Using default programmer \"%s\".\n",
@@ -416,6 +800,36 @@ int main(int argc, char *argv[])
 	/* FIXME: Delay calibration should happen in programmer code. */
 	myusec_calibrate_delay();
 
+	/* Gang workers continue from here with their own programmer, sharing
+	 * the calibration and the image. */
+	if (gang_count) {
+		if ((write_it | verify_it) && preload_image_file(filename)) {
+			ret = 1;
+			goto out;
+		}
+		device = gang_fork(gang_specs, gang_count, &ret);
+		if (device < 0)
+			goto out;
+		prog = parse_programmer(gang_specs[device], &pparam);
+	}
+
+	if (trace_file && spi_trace_open(trace_file)) {
+		ret = 1;
+		goto out;
+	}
+
+	/* Profiles are specific to the programmer with its parameters and the
+	 * chip. programmer_init() consumes the parameters, so keep them here. */
+	if (profile) {
+		profile_key = malloc(strlen(programmer_table[prog].name) +
+				     (pparam ? strlen(pparam) : 0) + 2);
+		if (!profile_key) {
+			msg_gerr("Out of memory!\n");
+			exit(1);
+		}
+		sprintf(profile_key, "%s:%s", programmer_table[prog].name, pparam ? pparam : "");
+	}
+
 	if (programmer_init(prog, pparam)) {
 		msg_perr("Error: Programmer initialization failed.\n");
 		ret = 1;
@@ -425,6 +839,7 @@ int main(int argc, char *argv[])
 	msg_pdbg("The following protocols are supported: %s.\n", tempstr);
 	free(tempstr);
 
+	perf_phase(PERF_PROBE);
 	for (j = 0; j < registered_programmer_count; j++) {
 		startchip = 0;
 		while (chipcount < ARRAY_SIZE(flashes)) {
@@ -435,6 +850,7 @@ int main(int argc, char *argv[])
 			startchip++;
 		}
 	}
+	perf_phase(PERF_OTHER);
 
 	if (chipcount > 1) {
 		msg_cinfo("Multiple flash chip definitions match the detected chip(s): \"%s\"",
@@ -507,6 +923,51 @@ int main(int argc, char *argv[])
 		goto out_shutdown;
 	}
 
+	if (profile) {
+		tempstr = realloc(profile_key, strlen(profile_key) + strlen(fill_flash->chip->name) + 2);
+		if (!tempstr) {
+			msg_gerr("Out of memory!\n");
+			exit(1);
+		}
+		profile_key = tempstr;
+		tempstr = NULL;
+		strcat(profile_key, "\t");
+		strcat(profile_key, fill_flash->chip->name);
+		load_profile(fill_flash, profile, profile_key);
+	}
+
+	if (stress_patterns) {
+		ret = stress_flash(fill_flash, force, stress_patterns);
+		goto out_shutdown;
+	}
+
+	if (benchmark_it) {
+		ret = benchmark_flash(fill_flash, save_profile_it ? profile : NULL, profile_key);
+		goto out_shutdown;
+	}
+
+	if (replay_file) {
+#if CONFIG_DUMMY == 1
+		if (prog == PROGRAMMER_DUMMY) {
+			ret = spi_trace_replay(fill_flash, replay_file);
+			goto out_shutdown;
+		}
+#endif
+		msg_cerr("Error: SPI traces can only be replayed to the dummy programmer.\n");
+		ret = 1;
+		goto out_shutdown;
+	}
+
+	/* The programmer and the chip stay as they are for all commands. */
+	if (batch_script) {
+		ret = batch_flash(fill_flash, force, batch_script);
+		goto out_shutdown;
+	}
+	if (batch_socket) {
+		ret = batch_listen(fill_flash, force, batch_socket);
+		goto out_shutdown;
+	}
+
 	if (!(read_it | write_it | verify_it | erase_it)) {
 		msg_ginfo("No operations were specified.\n");
 		goto out_shutdown;
@@ -528,6 +989,11 @@ int main(int argc, char *argv[])
 out_shutdown:
 	programmer_shutdown();
 out:
+	ret |= spi_trace_close();
+	if (perf_report_file)
+		ret |= perf_report(perf_report_file,
+				   prog < PROGRAMMER_INVALID ? programmer_table[prog].name : NULL,
+				   chipcount ? flashes[0].chip->name : NULL);
 	for (i = 0; i < chipcount; i++)
 		free(flashes[i].chip);
 
@@ -535,9 +1001,26 @@ out:
 	free(filename);
 	free(layoutfile);
 	free(pparam);
+	free(perf_report_file);
+	free(trace_file);
+	free(replay_file);
+	free(trace_diff[0]);
+	free(trace_diff[1]);
+	free(profile);
+	free(profile_key);
+	free(stress_patterns);
+	free(batch_script);
+	free(batch_socket);
+	for (i = 0; i < gang_count; i++)
+		free(gang_specs[i]);
+	free(gang_specs);
 	/* clean up global variables */
 	free((char *)chip_to_probe); /* Silence! Freeing is not modifying contents. */
 	chip_to_probe = NULL;
+	free((char *)digest_manifest);
+	digest_manifest = NULL;
+	free((char *)journal_file);
+	journal_file = NULL;
 #ifndef STANDALONE
 	ret |= close_logfile();
 #endif /* !STANDALONE */
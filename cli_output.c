@@ -67,31 +67,40 @@ void start_logging(void)
 }
 #endif /* !STANDALONE */
 
-/* Please note that level is the verbosity, not the importance of the message. */
-int print(enum msglevel level, const char *fmt, ...)
+/* Set if stdout carries image data. All messages go to stderr then. */
+static int stdout_is_image = 0;
+
+void print_to_stderr_only(void)
+{
+	stdout_is_image = 1;
+}
+
+/* Log callback of the command line interface, which prints to the screen and
+ * the log file according to their verbosity. */
+int flashrom_print_cb(void *data, enum flashrom_log_level level, const char *fmt, va_list ap)
 {
-	va_list ap;
+	va_list aq;
 	int ret = 0;
 	FILE *output_type = stdout;
 
-	if (level < MSG_INFO)
+	if (level < FLASHROM_MSG_INFO || stdout_is_image)
 		output_type = stderr;
 
 	if (level <= verbose_screen) {
-		va_start(ap, fmt);
-		ret = vfprintf(output_type, fmt, ap);
-		va_end(ap);
+		va_copy(aq, ap);
+		ret = vfprintf(output_type, fmt, aq);
+		va_end(aq);
 		/* msg_*spew often happens inside chip accessors in possibly
 		 * time-critical operations. Don't slow them down by flushing. */
-		if (level != MSG_SPEW)
+		if (level != FLASHROM_MSG_SPEW)
 			fflush(output_type);
 	}
 #ifndef STANDALONE
 	if ((level <= verbose_logfile) && logfile) {
-		va_start(ap, fmt);
-		ret = vfprintf(logfile, fmt, ap);
-		va_end(ap);
-		if (level != MSG_SPEW)
+		va_copy(aq, ap);
+		ret = vfprintf(logfile, fmt, aq);
+		va_end(aq);
+		if (level != FLASHROM_MSG_SPEW)
 			fflush(logfile);
 	}
 #endif /* !STANDALONE */
@@ -0,0 +1,275 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Digests of the flash contents, computed while the chip is read: SHA-256 and
+ * CRC32 of the whole chip and optionally a manifest with the SHA-256 of every
+ * erase block.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "flash.h"
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(struct sha256_ctx *ctx, const uint8_t *block)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+		       (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	for (i = 16; i < 64; i++)
+		w[i] = (ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+		       (ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	e = ctx->state[4];
+	f = ctx->state[5];
+	g = ctx->state[6];
+	h = ctx->state[7];
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) +
+		     sha256_k[i] + w[i];
+		t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+	ctx->state[5] += f;
+	ctx->state[6] += g;
+	ctx->state[7] += h;
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(ctx->state, init, sizeof(ctx->state));
+	ctx->count = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const uint8_t *data, size_t len)
+{
+	unsigned int fill = ctx->count % 64;
+
+	ctx->count += len;
+	if (fill) {
+		unsigned int n = min(64 - fill, len);
+		memcpy(ctx->buf + fill, data, n);
+		data += n;
+		len -= n;
+		if (fill + n < 64)
+			return;
+		sha256_transform(ctx, ctx->buf);
+	}
+	for (; len >= 64; data += 64, len -= 64)
+		sha256_transform(ctx, data);
+	memcpy(ctx->buf, data, len);
+}
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t bits = ctx->count * 8;
+	uint8_t pad[72] = { 0x80 };
+	unsigned int padlen = 64 - (ctx->count + 8) % 64;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		pad[padlen + i] = bits >> (56 - i * 8);
+	sha256_update(ctx, pad, padlen + 8);
+	for (i = 0; i < 32; i++)
+		digest[i] = ctx->state[i / 4] >> (24 - (i % 4) * 8);
+}
+
+/* CRC-32 as used by zlib and Ethernet (reflected polynomial 0xedb88320). */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+	static uint32_t table[256];
+	uint32_t c;
+	int i, j;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void sprint_digest(char *str, const uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	int i;
+
+	for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+		sprintf(str + i * 2, "%02x", digest[i]);
+}
+
+/* Advance to the next erase block. Without a usable eraser the whole chip is
+ * one block. */
+static void digest_next_block(struct flash_digest *d)
+{
+	const struct block_eraser *eraser = d->eraser;
+
+	d->block_start += d->block_len;
+	if (!eraser) {
+		d->block_len = d->size - d->block_start;
+		return;
+	}
+	while (d->region < NUM_ERASEREGIONS && d->block >= eraser->eraseblocks[d->region].count) {
+		d->region++;
+		d->block = 0;
+	}
+	d->block_len = (d->region < NUM_ERASEREGIONS) ? eraser->eraseblocks[d->region].size : 0;
+	d->block++;
+}
+
+/*
+ * Prepare the digests for reading the chip from start to end. If manifest is
+ * not NULL, the SHA-256 of every block of the first usable erase function is
+ * written to that file.
+ */
+int digest_init(struct flash_digest *d, const struct flashctx *flash, const char *manifest)
+{
+	int k;
+
+	memset(d, 0, sizeof(*d));
+	d->size = flash->chip->total_size * 1024;
+	sha256_init(&d->sha256);
+	if (!manifest)
+		return 0;
+
+	if ((d->manifest = fopen(manifest, "w")) == NULL) {
+		msg_gerr("Error: opening manifest \"%s\" failed: %s\n", manifest, strerror(errno));
+		return 1;
+	}
+	d->manifest_name = manifest;
+	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
+		const struct block_eraser *eraser = &flash->chip->block_erasers[k];
+		if (eraser->block_erase && eraser->eraseblocks[0].count) {
+			d->eraser = eraser;
+			break;
+		}
+	}
+	fprintf(d->manifest, "# %s %s, %u bytes\n", flash->chip->vendor, flash->chip->name, d->size);
+	sha256_init(&d->block_sha256);
+	digest_next_block(d);
+	return 0;
+}
+
+/* Feed the next len bytes of the chip contents. */
+void digest_update(struct flash_digest *d, const uint8_t *buf, unsigned int len)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char str[SHA256_DIGEST_SIZE * 2 + 1];
+	unsigned int pos = d->pos, n;
+
+	sha256_update(&d->sha256, buf, len);
+	d->crc32 = crc32_update(d->crc32, buf, len);
+	d->pos += len;
+	if (!d->manifest)
+		return;
+
+	while (len && d->block_len) {
+		n = min(d->block_start + d->block_len - pos, len);
+		sha256_update(&d->block_sha256, buf, n);
+		buf += n;
+		len -= n;
+		pos += n;
+		if (pos < d->block_start + d->block_len)
+			break;
+		sha256_final(&d->block_sha256, digest);
+		sprint_digest(str, digest);
+		fprintf(d->manifest, "0x%08x-0x%08x %s\n", d->block_start,
+			d->block_start + d->block_len - 1, str);
+		sha256_init(&d->block_sha256);
+		digest_next_block(d);
+	}
+}
+
+/* Finalize the digests of the whole chip and close the manifest. */
+int digest_finish(struct flash_digest *d)
+{
+	char str[SHA256_DIGEST_SIZE * 2 + 1];
+	int ret = 0;
+
+	sha256_final(&d->sha256, d->result);
+	if (!d->manifest)
+		return 0;
+	sprint_digest(str, d->result);
+	fprintf(d->manifest, "sha256 %s\ncrc32 %08x\n", str, d->crc32);
+	if (fclose(d->manifest)) {
+		msg_gerr("Error: closing manifest \"%s\" failed: %s\n", d->manifest_name,
+			 strerror(errno));
+		ret = 1;
+	}
+	d->manifest = NULL;
+	return ret;
+}
+
+void digest_print(const struct flash_digest *d)
+{
+	char str[SHA256_DIGEST_SIZE * 2 + 1];
+
+	sprint_digest(str, d->result);
+	msg_ginfo("SHA-256: %s\n", str);
+	msg_ginfo("CRC32: %08x\n", d->crc32);
+}
+
+/* Close the manifest after an error. Incomplete digests are not printed. */
+void digest_abort(struct flash_digest *d)
+{
+	if (d->manifest)
+		fclose(d->manifest);
+	d->manifest = NULL;
+}
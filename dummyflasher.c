@@ -39,6 +39,14 @@
 #include <sys/stat.h>
 #endif
 
+/* Persistent images are mapped into memory where mmap() is available. */
+#if EMULATE_CHIP && !defined(__DJGPP__) && !defined(__LIBPAYLOAD__) && !defined(_WIN32)
+#define EMULATE_MMAP_IMAGE 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #if EMULATE_CHIP
 static uint8_t *flashchip_contents = NULL;
 enum emu_chip {
@@ -47,23 +55,63 @@ enum emu_chip {
 	EMULATE_SST_SST25VF040_REMS,
 	EMULATE_SST_SST25VF032B,
 	EMULATE_MACRONIX_MX25L6436,
+	EMULATE_SPI_FLASHCHIP,
 };
 static enum emu_chip emu_chip = EMULATE_NONE;
 static char *emu_persistent_image = NULL;
+/* Changes are not written back to the persistent image. */
+static int emu_image_readonly = 0;
+/* flashchip_contents is a mapping of the persistent image. */
+static int emu_image_mapped = 0;
 static unsigned int emu_chip_size = 0;
 #if EMULATE_SPI_CHIP
 static unsigned int emu_max_byteprogram_size = 0;
 static unsigned int emu_max_aai_size = 0;
-static unsigned int emu_jedec_se_size = 0;
-static unsigned int emu_jedec_be_52_size = 0;
-static unsigned int emu_jedec_be_d8_size = 0;
-static unsigned int emu_jedec_ce_60_size = 0;
-static unsigned int emu_jedec_ce_c7_size = 0;
+/* Erase blocks of every supported erase opcode, indexed by opcode. Chip erase
+ * opcodes have a single block of emu_chip_size bytes. */
+static struct eraseblock emu_eraseblocks[256][NUM_ERASEREGIONS];
+/* RDID and REMS responses of a chip emulated from flashchips[]. */
+static unsigned char emu_rdid[4];
+static unsigned char emu_rems[2];
 unsigned char spi_blacklist[256];
 unsigned char spi_ignorelist[256];
 int spi_blacklist_size = 0;
 int spi_ignorelist_size = 0;
 static uint8_t emu_status = 0;
+/* SO signals the AAI busy status (EBSY). */
+static int emu_aai_ebsy = 0;
+
+/*
+ * Busy times of the emulated chip and costs of the emulated link in
+ * microseconds. While the chip is busy, WIP is set and every command except
+ * RDSR is ignored. All zero (the default) means everything finishes instantly.
+ */
+struct emu_timing {
+	unsigned int program;	/* One page, byte or AAI word */
+	unsigned int se;	/* 0x20 */
+	unsigned int be_52;
+	unsigned int be_d8;
+	unsigned int ce;	/* 0x60 and 0xc7 */
+	unsigned int wrsr;
+	unsigned int latency;	/* Per transaction */
+	unsigned int bandwidth;	/* Bytes per second, 0 means unlimited */
+};
+static struct emu_timing emu_timing;
+/* Typical values from the datasheet of the emulated chip. */
+static struct emu_timing emu_typical_timing;
+/* Advance a virtual clock instead of sleeping. */
+static int emu_virtual_time = 0;
+static uint64_t emu_clock_us = 0;
+static uint64_t emu_busy_until = 0;
+
+/* Ranges locked like by a chipset, e.g. the ME region on Intel boards. */
+struct emu_lock {
+	unsigned int start;
+	unsigned int end;
+	int read;
+	int set;
+};
+static struct emu_lock emu_locks[2];
 
 /* A legit complete SFDP table based on the MX25L6436E (rev. 1.8) datasheet. */
 static const uint8_t sfdp_table[] = {
@@ -102,6 +150,8 @@ static int dummy_spi_send_command(struct flashctx *flash, unsigned int writecnt,
 				  unsigned char *readarr);
 static int dummy_spi_write_256(struct flashctx *flash, uint8_t *buf,
 			       unsigned int start, unsigned int len);
+static int dummy_spi_wait_miso_ready(struct flashctx *flash,
+				     unsigned int timeout_us);
 static void dummy_chip_writeb(const struct flashctx *flash, uint8_t val,
 			      chipaddr addr);
 static void dummy_chip_writew(const struct flashctx *flash, uint16_t val,
@@ -128,6 +178,7 @@ static const struct spi_programmer spi_programmer_dummyflasher = {
 	.read		= default_spi_read,
 	.write_256	= dummy_spi_write_256,
 	.write_aai	= default_spi_write_aai,
+	.wait_miso_ready = dummy_spi_wait_miso_ready,
 };
 
 static const struct par_programmer par_programmer_dummy = {
@@ -143,23 +194,453 @@ static const struct par_programmer par_programmer_dummy = {
 
 enum chipbustype dummy_buses_supported = BUS_NONE;
 
+#if EMULATE_SPI_CHIP
+static uint64_t emu_now(void)
+{
+	return emu_virtual_time ? emu_clock_us : time_us();
+}
+
+/* Let usecs pass for the emulated chip and link. */
+static void emu_wait(unsigned int usecs)
+{
+	if (!usecs)
+		return;
+	if (emu_virtual_time)
+		emu_clock_us += usecs;
+	else
+		internal_delay(usecs);
+}
+
+/* The chip is busy for usecs from now on. */
+static void emu_set_busy(unsigned int usecs)
+{
+	if (!usecs)
+		return;
+	emu_busy_until = emu_now() + usecs;
+	emu_status |= SPI_SR_WIP;
+}
+
+/* Clear WIP if the current operation is done and return whether the chip is
+ * still busy. A WIP bit set with spi_status stays set. */
+static int emu_busy(void)
+{
+	if (emu_busy_until && emu_now() >= emu_busy_until) {
+		emu_busy_until = 0;
+		emu_status &= ~SPI_SR_WIP;
+	}
+	return emu_status & SPI_SR_WIP;
+}
+
+/* Erase blocks of size bytes with opcode, covering the whole chip. */
+static void emu_set_eraser(uint8_t opcode, unsigned int size)
+{
+	memset(emu_eraseblocks[opcode], 0, sizeof(emu_eraseblocks[opcode]));
+	emu_eraseblocks[opcode][0].size = size;
+	emu_eraseblocks[opcode][0].count = emu_chip_size / size;
+}
+
+/* Busy time of an erase with opcode of a block of len bytes. Opcodes without
+ * a setting of their own use the one for blocks of similar size. */
+static unsigned int emu_erase_time(uint8_t opcode, unsigned int len)
+{
+	switch (opcode) {
+	case JEDEC_SE:
+		return emu_timing.se;
+	case JEDEC_BE_52:
+		return emu_timing.be_52;
+	case JEDEC_BE_D8:
+		return emu_timing.be_d8;
+	}
+	if (len == emu_chip_size)
+		return emu_timing.ce;
+	if (len <= 4 * 1024)
+		return emu_timing.se;
+	if (len <= 32 * 1024)
+		return emu_timing.be_52;
+	return emu_timing.be_d8;
+}
+
+/* Does the access to [offs, offs + len) hit a lock? */
+static int emu_locked(unsigned int offs, unsigned int len, int write)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(emu_locks); i++) {
+		if (!emu_locks[i].set || (!write && emu_locks[i].read))
+			continue;
+		if (offs <= emu_locks[i].end && offs + len > emu_locks[i].start) {
+			msg_pdbg("%s of 0x%x-0x%x refused, it is locked.\n", write ? "Write" : "Read",
+				 offs, offs + len - 1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Erase the block of opcode which contains addr. */
+static int emu_erase(uint8_t opcode, unsigned int addr)
+{
+	const struct eraseblock *eb = emu_eraseblocks[opcode];
+	unsigned int i, start = 0, offs;
+
+	for (i = 0; i < NUM_ERASEREGIONS && eb[i].size; i++) {
+		if (addr >= start + eb[i].size * eb[i].count) {
+			start += eb[i].size * eb[i].count;
+			continue;
+		}
+		offs = start + (addr - start) / eb[i].size * eb[i].size;
+		if (offs != addr)
+			msg_pdbg("Unaligned ERASE 0x%02x: 0x%x\n", opcode, addr);
+		if (emu_locked(offs, eb[i].size, 1))
+			return 1;
+		memset(flashchip_contents + offs, 0xff, eb[i].size);
+		emu_set_busy(emu_erase_time(opcode, eb[i].size));
+		return 0;
+	}
+	msg_pdbg("ERASE 0x%02x at 0x%x is outside of its erase blocks.\n", opcode, addr);
+	return 0;
+}
+
+/* Set the unsigned programmer parameter name in *value if it is given. */
+static int dummy_get_uint_param(const char *name, unsigned int *value)
+{
+	char *tmp = extract_programmer_param(name);
+	char *endptr;
+	unsigned long val;
+
+	if (!tmp)
+		return 0;
+	errno = 0;
+	val = strtoul(tmp, &endptr, 0);
+	if (errno || endptr == tmp || *endptr || val != (unsigned int)val) {
+		msg_perr("Error: Invalid value \"%s\" for %s.\n", tmp, name);
+		free(tmp);
+		return 1;
+	}
+	free(tmp);
+	*value = val;
+	return 0;
+}
+
+/* Parse a lock "start-end" with hexadecimal addresses from the parameter name. */
+static int dummy_parse_lock(const char *name, struct emu_lock *lock, int read)
+{
+	char *tmp = extract_programmer_param(name);
+	char *endptr;
+
+	if (!tmp)
+		return 0;
+	/* strtoul() would accept a sign and wrap negative numbers, so both
+	 * addresses have to start with a digit. */
+	if (!isxdigit((unsigned char)tmp[0]))
+		goto invalid;
+	lock->start = strtoul(tmp, &endptr, 16);
+	if (*endptr != '-' || !isxdigit((unsigned char)endptr[1]))
+		goto invalid;
+	lock->end = strtoul(endptr + 1, &endptr, 16);
+	if (*endptr || lock->end < lock->start)
+		goto invalid;
+	free(tmp);
+	lock->read = read;
+	lock->set = 1;
+	msg_pdbg("Emulated lock of 0x%x-0x%x, %s.\n", lock->start, lock->end,
+		 read ? "read-only" : "no access");
+	/* Tell the core, like chipset drivers do. */
+	return register_access_restriction(lock->start, lock->end, read, 0);
+invalid:
+	msg_perr("Error: Invalid %s range \"%s\", use <start>-<end>.\n", name, tmp);
+	free(tmp);
+	return 1;
+}
+
+static int dummy_parse_timing(void)
+{
+	static const struct {
+		const char *name;
+		unsigned int *value;
+	} params[] = {
+		{"program_us",	&emu_timing.program},
+		{"se_us",	&emu_timing.se},
+		{"be52_us",	&emu_timing.be_52},
+		{"bed8_us",	&emu_timing.be_d8},
+		{"ce_us",	&emu_timing.ce},
+		{"wrsr_us",	&emu_timing.wrsr},
+		{"latency_us",	&emu_timing.latency},
+		{"bandwidth",	&emu_timing.bandwidth},
+	};
+	char *tmp;
+	int i;
+
+	tmp = extract_programmer_param("timing");
+	if (tmp) {
+		if (!strcmp(tmp, "typical")) {
+			emu_timing = emu_typical_timing;
+		} else if (strcmp(tmp, "none")) {
+			msg_perr("Error: Invalid timing \"%s\", use typical or none.\n", tmp);
+			free(tmp);
+			return 1;
+		}
+		free(tmp);
+	}
+	/* Single values override the typical ones. */
+	for (i = 0; i < ARRAY_SIZE(params); i++)
+		if (dummy_get_uint_param(params[i].name, params[i].value))
+			return 1;
+
+	tmp = extract_programmer_param("virtual_time");
+	if (tmp) {
+		if (!strcmp(tmp, "yes")) {
+			emu_virtual_time = 1;
+		} else if (strcmp(tmp, "no")) {
+			msg_perr("Error: Invalid virtual_time \"%s\", use yes or no.\n", tmp);
+			free(tmp);
+			return 1;
+		}
+		free(tmp);
+	}
+	msg_pdbg("Emulated busy times: program %u us, erase 0x20 %u us, 0x52 %u us, 0xd8 %u us, "
+		 "chip %u us, WRSR %u us\n", emu_timing.program, emu_timing.se, emu_timing.be_52,
+		 emu_timing.be_d8, emu_timing.ce, emu_timing.wrsr);
+	msg_pdbg("Emulated link: latency %u us, bandwidth %u B/s, %s time\n", emu_timing.latency,
+		 emu_timing.bandwidth, emu_virtual_time ? "virtual" : "real");
+	return 0;
+}
+
+/* Set up the emulation of the SPI chip called name in flashchips[]. Returns 1
+ * if there is no such chip and -1 if it can not be emulated. */
+static int dummy_emulate_flashchip(const char *name)
+{
+	const struct flashchip *chip;
+	unsigned int *typical;
+	uint8_t opcode;
+	int i;
+
+	for (chip = flashchips; chip->name; chip++)
+		if (!strcmp(chip->name, name))
+			break;
+	if (!chip->name)
+		return 1;
+	if (!(chip->bustype & BUS_SPI) || chip->read != spi_chip_read) {
+		msg_perr("%s is no SPI chip which can be emulated.\n", chip->name);
+		return -1;
+	}
+	/* Emulated commands only have 3-byte addresses. */
+	if (chip->total_size > 16 * 1024) {
+		msg_perr("%s is too large to be emulated.\n", chip->name);
+		return -1;
+	}
+
+	if (chip->probe == probe_spi_rdid || chip->probe == probe_spi_rdid4) {
+		if ((chip->manufacture_id >> 8) == 0x7f) {
+			/* Continuation vendor ID, see probe_spi_rdid_generic(). */
+			emu_rdid[0] = 0x7f;
+			emu_rdid[1] = chip->manufacture_id & 0xff;
+			if (chip->probe == probe_spi_rdid4) {
+				emu_rdid[2] = chip->model_id >> 8;
+				emu_rdid[3] = chip->model_id & 0xff;
+			} else {
+				emu_rdid[2] = chip->model_id & 0xff;
+				emu_rdid[3] = 0xff;
+			}
+		} else {
+			emu_rdid[0] = chip->manufacture_id;
+			emu_rdid[1] = chip->model_id >> 8;
+			emu_rdid[2] = chip->model_id & 0xff;
+			emu_rdid[3] = 0xff;
+		}
+	} else if (chip->probe == probe_spi_rems) {
+		memset(emu_rdid, 0xff, sizeof(emu_rdid));
+		emu_rems[0] = chip->manufacture_id;
+		emu_rems[1] = chip->model_id;
+	} else {
+		msg_perr("%s is probed in a way which can not be emulated.\n", chip->name);
+		return -1;
+	}
+
+	if (chip->write == spi_chip_write_256) {
+		emu_max_byteprogram_size = chip->page_size;
+		emu_max_aai_size = 0;
+	} else if (chip->write == spi_chip_write_1) {
+		emu_max_byteprogram_size = 1;
+		emu_max_aai_size = 0;
+	} else if (chip->write == spi_aai_write) {
+		emu_max_byteprogram_size = 1;
+		emu_max_aai_size = 2;
+	} else {
+		msg_perr("%s is written in a way which can not be emulated.\n", chip->name);
+		return -1;
+	}
+
+	emu_chip = EMULATE_SPI_FLASHCHIP;
+	emu_chip_size = chip->total_size * 1024;
+	memset(&emu_typical_timing, 0, sizeof(emu_typical_timing));
+	emu_typical_timing.program = chip->timing.page_program ? chip->timing.page_program :
+							       chip->timing.byte_program;
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++) {
+		opcode = spi_get_opcode_from_erasefn(chip->block_erasers[i].block_erase);
+		if (!opcode)
+			continue;
+		memcpy(emu_eraseblocks[opcode], chip->block_erasers[i].eraseblocks,
+		       sizeof(emu_eraseblocks[opcode]));
+		switch (opcode) {
+		case JEDEC_SE:
+			typical = &emu_typical_timing.se;
+			break;
+		case JEDEC_BE_52:
+			typical = &emu_typical_timing.be_52;
+			break;
+		case JEDEC_BE_D8:
+			typical = &emu_typical_timing.be_d8;
+			break;
+		case JEDEC_CE_60:
+		case JEDEC_CE_62:
+		case JEDEC_CE_C7:
+			typical = &emu_typical_timing.ce;
+			break;
+		default:
+			typical = NULL;
+			break;
+		}
+		if (typical && chip->timing.erase[i])
+			*typical = chip->timing.erase[i];
+	}
+	msg_pdbg("Emulating %s %s SPI flash chip from the flash chip database\n", chip->vendor,
+		 chip->name);
+	return 0;
+}
+#endif
+
+#if EMULATE_MMAP_IMAGE
+/*
+ * Map the persistent image as flashchip_contents. Writes go to the page cache
+ * directly, so neither startup nor shutdown has to copy the whole image. A
+ * read-only image is mapped privately: Changes are lost at exit, and any
+ * number of flashrom instances can use the same image at the same time.
+ */
+static int dummy_map_image(const char *filename)
+{
+	struct stat image_stat;
+	void *map;
+	int fd, fill = 0;
+
+	fd = open(filename, emu_image_readonly ? O_RDONLY : O_RDWR | O_CREAT, 0666);
+	if (fd < 0) {
+		msg_perr("Error: opening persistent image %s failed: %s\n", filename,
+			 strerror(errno));
+		return 1;
+	}
+	if (fstat(fd, &image_stat)) {
+		msg_perr("Error: getting the size of %s failed: %s\n", filename, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	msg_pdbg("Found persistent image %s, size %li ", filename, (long)image_stat.st_size);
+	if (image_stat.st_size == emu_chip_size) {
+		msg_pdbg("matches.\n");
+	} else {
+		msg_pdbg("doesn't match.\n");
+		if (emu_image_readonly) {
+			msg_perr("Error: read-only persistent image %s has the wrong size.\n",
+				 filename);
+			close(fd);
+			return 1;
+		}
+		/* Start over with an erased chip, like without an image. */
+		if (ftruncate(fd, 0) || ftruncate(fd, emu_chip_size)) {
+			msg_perr("Error: resizing %s failed: %s\n", filename, strerror(errno));
+			close(fd);
+			return 1;
+		}
+		fill = 1;
+	}
+	map = mmap(NULL, emu_chip_size, PROT_READ | PROT_WRITE,
+		   emu_image_readonly ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		msg_perr("Error: mapping %s failed: %s\n", filename, strerror(errno));
+		return 1;
+	}
+	flashchip_contents = map;
+	emu_image_mapped = 1;
+	if (fill) {
+		msg_pdbg("Filling fake flash chip with 0xff, size %i\n", emu_chip_size);
+		memset(flashchip_contents, 0xff, emu_chip_size);
+	}
+	return 0;
+}
+#endif
+
+#if EMULATE_CHIP
+static void dummy_free_contents(void)
+{
+#if EMULATE_MMAP_IMAGE
+	if (emu_image_mapped) {
+		/* The kernel writes back only the pages which were changed. */
+		munmap(flashchip_contents, emu_chip_size);
+		emu_image_mapped = 0;
+		flashchip_contents = NULL;
+		return;
+	}
+#endif
+	free(flashchip_contents);
+	flashchip_contents = NULL;
+}
+#endif
+
 static int dummy_shutdown(void *data)
 {
 	msg_pspew("%s\n", __func__);
+#if EMULATE_SPI_CHIP
+	if (emu_virtual_time)
+		msg_pinfo("Emulated time: %llu us\n", (unsigned long long)emu_clock_us);
+#endif
 #if EMULATE_CHIP
 	if (emu_chip != EMULATE_NONE) {
 		if (emu_persistent_image) {
-			msg_pdbg("Writing %s\n", emu_persistent_image);
-			write_buf_to_file(flashchip_contents, emu_chip_size, emu_persistent_image);
+			if (!emu_image_mapped && !emu_image_readonly) {
+				msg_pdbg("Writing %s\n", emu_persistent_image);
+				write_buf_to_file(flashchip_contents, emu_chip_size,
+						  emu_persistent_image);
+			}
 			free(emu_persistent_image);
 			emu_persistent_image = NULL;
 		}
-		free(flashchip_contents);
+		dummy_free_contents();
 	}
 #endif
 	return 0;
 }
 
+/* Forget everything about the previous emulated chip, so the programmer can be
+ * initialized again in the same process. */
+static void dummy_reset_state(void)
+{
+	spi_write_256_chunksize = 256;
+#if EMULATE_CHIP
+	emu_chip = EMULATE_NONE;
+	emu_chip_size = 0;
+	emu_image_readonly = 0;
+	emu_image_mapped = 0;
+#endif
+#if EMULATE_SPI_CHIP
+	emu_max_byteprogram_size = 0;
+	emu_max_aai_size = 0;
+	memset(emu_eraseblocks, 0, sizeof(emu_eraseblocks));
+	memset(emu_rdid, 0, sizeof(emu_rdid));
+	memset(emu_rems, 0, sizeof(emu_rems));
+	spi_blacklist_size = 0;
+	spi_ignorelist_size = 0;
+	emu_status = 0;
+	emu_aai_ebsy = 0;
+	memset(&emu_timing, 0, sizeof(emu_timing));
+	memset(&emu_typical_timing, 0, sizeof(emu_typical_timing));
+	emu_virtual_time = 0;
+	emu_clock_us = 0;
+	emu_busy_until = 0;
+	memset(emu_locks, 0, sizeof(emu_locks));
+#endif
+}
+
 int dummy_init(void)
 {
 	char *bustext = NULL;
@@ -173,6 +654,7 @@ int dummy_init(void)
 #endif
 
 	msg_pspew("%s\n", __func__);
+	dummy_reset_state();
 
 	bustext = extract_programmer_param("bus");
 	msg_pdbg("Requested buses are: %s\n", bustext ? bustext : "default");
@@ -297,11 +779,11 @@ int dummy_init(void)
 		emu_chip_size = 128 * 1024;
 		emu_max_byteprogram_size = 128;
 		emu_max_aai_size = 0;
-		emu_jedec_se_size = 0;
-		emu_jedec_be_52_size = 0;
-		emu_jedec_be_d8_size = 32 * 1024;
-		emu_jedec_ce_60_size = 0;
-		emu_jedec_ce_c7_size = emu_chip_size;
+		emu_set_eraser(JEDEC_BE_D8, 32 * 1024);
+		emu_set_eraser(JEDEC_CE_C7, emu_chip_size);
+		emu_typical_timing = (struct emu_timing) {
+			.program = 1400, .be_d8 = 650000, .ce = 1000000, .wrsr = 5000,
+		};
 		msg_pdbg("Emulating ST M25P10.RES SPI flash chip (RES, page "
 			 "write)\n");
 	}
@@ -310,11 +792,12 @@ int dummy_init(void)
 		emu_chip_size = 512 * 1024;
 		emu_max_byteprogram_size = 1;
 		emu_max_aai_size = 0;
-		emu_jedec_se_size = 4 * 1024;
-		emu_jedec_be_52_size = 32 * 1024;
-		emu_jedec_be_d8_size = 0;
-		emu_jedec_ce_60_size = emu_chip_size;
-		emu_jedec_ce_c7_size = 0;
+		emu_set_eraser(JEDEC_SE, 4 * 1024);
+		emu_set_eraser(JEDEC_BE_52, 32 * 1024);
+		emu_set_eraser(JEDEC_CE_60, emu_chip_size);
+		emu_typical_timing = (struct emu_timing) {
+			.program = 20, .se = 18000, .be_52 = 18000, .ce = 70000, .wrsr = 10,
+		};
 		msg_pdbg("Emulating SST SST25VF040.REMS SPI flash chip (REMS, "
 			 "byte write)\n");
 	}
@@ -323,11 +806,15 @@ int dummy_init(void)
 		emu_chip_size = 4 * 1024 * 1024;
 		emu_max_byteprogram_size = 1;
 		emu_max_aai_size = 2;
-		emu_jedec_se_size = 4 * 1024;
-		emu_jedec_be_52_size = 32 * 1024;
-		emu_jedec_be_d8_size = 64 * 1024;
-		emu_jedec_ce_60_size = emu_chip_size;
-		emu_jedec_ce_c7_size = emu_chip_size;
+		emu_set_eraser(JEDEC_SE, 4 * 1024);
+		emu_set_eraser(JEDEC_BE_52, 32 * 1024);
+		emu_set_eraser(JEDEC_BE_D8, 64 * 1024);
+		emu_set_eraser(JEDEC_CE_60, emu_chip_size);
+		emu_set_eraser(JEDEC_CE_C7, emu_chip_size);
+		emu_typical_timing = (struct emu_timing) {
+			.program = 7, .se = 18000, .be_52 = 18000, .be_d8 = 18000, .ce = 35000,
+			.wrsr = 10,
+		};
 		msg_pdbg("Emulating SST SST25VF032B SPI flash chip (RDID, AAI "
 			 "write)\n");
 	}
@@ -336,14 +823,22 @@ int dummy_init(void)
 		emu_chip_size = 8 * 1024 * 1024;
 		emu_max_byteprogram_size = 256;
 		emu_max_aai_size = 0;
-		emu_jedec_se_size = 4 * 1024;
-		emu_jedec_be_52_size = 32 * 1024;
-		emu_jedec_be_d8_size = 64 * 1024;
-		emu_jedec_ce_60_size = emu_chip_size;
-		emu_jedec_ce_c7_size = emu_chip_size;
+		emu_set_eraser(JEDEC_SE, 4 * 1024);
+		emu_set_eraser(JEDEC_BE_52, 32 * 1024);
+		emu_set_eraser(JEDEC_BE_D8, 64 * 1024);
+		emu_set_eraser(JEDEC_CE_60, emu_chip_size);
+		emu_set_eraser(JEDEC_CE_C7, emu_chip_size);
+		emu_typical_timing = (struct emu_timing) {
+			.program = 1400, .se = 60000, .be_52 = 500000, .be_d8 = 700000,
+			.ce = 50000000, .wrsr = 40000,
+		};
 		msg_pdbg("Emulating Macronix MX25L6436 SPI flash chip (RDID, "
 			 "SFDP)\n");
 	}
+	if (emu_chip == EMULATE_NONE && dummy_emulate_flashchip(tmp) < 0) {
+		free(tmp);
+		return 1;
+	}
 #endif
 	if (emu_chip == EMULATE_NONE) {
 		msg_perr("Invalid chip specified for emulation: %s\n", tmp);
@@ -351,11 +846,6 @@ int dummy_init(void)
 		return 1;
 	}
 	free(tmp);
-	flashchip_contents = malloc(emu_chip_size);
-	if (!flashchip_contents) {
-		msg_perr("Out of memory!\n");
-		return 1;
-	}
 
 #ifdef EMULATE_SPI_CHIP
 	status = extract_programmer_param("spi_status");
@@ -372,12 +862,44 @@ int dummy_init(void)
 		msg_pdbg("Initial status register is set to 0x%02x.\n",
 			 emu_status);
 	}
+	if (dummy_parse_timing())
+		return 1;
+	if (dummy_parse_lock("locked", &emu_locks[0], 0) ||
+	    dummy_parse_lock("readonly", &emu_locks[1], 1))
+		return 1;
+#endif
+
+	tmp = extract_programmer_param("image_readonly");
+	if (tmp) {
+		if (!strcmp(tmp, "yes")) {
+			emu_image_readonly = 1;
+		} else if (strcmp(tmp, "no")) {
+			msg_perr("Error: Invalid image_readonly \"%s\", use yes or no.\n", tmp);
+			free(tmp);
+			return 1;
+		}
+		free(tmp);
+	}
+	emu_persistent_image = extract_programmer_param("image");
+#if EMULATE_MMAP_IMAGE
+	if (emu_persistent_image) {
+		if (dummy_map_image(emu_persistent_image)) {
+			free(emu_persistent_image);
+			emu_persistent_image = NULL;
+			return 1;
+		}
+		goto dummy_init_out;
+	}
 #endif
 
+	flashchip_contents = malloc(emu_chip_size);
+	if (!flashchip_contents) {
+		msg_perr("Out of memory!\n");
+		return 1;
+	}
 	msg_pdbg("Filling fake flash chip with 0xff, size %i\n", emu_chip_size);
 	memset(flashchip_contents, 0xff, emu_chip_size);
 
-	emu_persistent_image = extract_programmer_param("image");
 	if (!emu_persistent_image) {
 		/* Nothing else to do. */
 		goto dummy_init_out;
@@ -398,7 +920,7 @@ int dummy_init(void)
 
 dummy_init_out:
 	if (register_shutdown(dummy_shutdown, NULL)) {
-		free(flashchip_contents);
+		dummy_free_contents();
 		return 1;
 	}
 	if (dummy_buses_supported & (BUS_PARALLEL | BUS_LPC | BUS_FWH))
@@ -412,6 +934,18 @@ dummy_init_out:
 	return 0;
 }
 
+/* Delays only advance the clock if the emulated chip runs on virtual time. */
+void dummy_delay(int usecs)
+{
+#if EMULATE_SPI_CHIP
+	if (emu_virtual_time) {
+		emu_clock_us += usecs;
+		return;
+	}
+#endif
+	internal_delay(usecs);
+}
+
 void *dummy_map(const char *descr, uintptr_t phys_addr, size_t len)
 {
 	msg_pspew("%s: Mapping %s, 0x%zx bytes at 0x%*" PRIxPTR "\n",
@@ -518,6 +1052,12 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 		}
 	}
 
+	if (emu_busy() && writearr[0] != JEDEC_RDSR) {
+		msg_perr("Command 0x%02x sent while the chip is busy!\n",
+			 writearr[0]);
+		return 0;
+	}
+
 	if (emu_max_aai_size && (emu_status & SPI_SR_AAI)) {
 		if (writearr[0] != JEDEC_AAI_WORD_PROGRAM &&
 		    writearr[0] != JEDEC_WRDI &&
@@ -575,6 +1115,12 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			for (i = 0; i < readcnt; i++)
 				readarr[i] = mx25l6436_rems_response[(offs + i) % 2];
 			break;
+		case EMULATE_SPI_FLASHCHIP:
+			if (emu_rdid[0] != 0xff)
+				break;
+			for (i = 0; i < readcnt; i++)
+				readarr[i] = emu_rems[(offs + i) % 2];
+			break;
 		default: /* ignore */
 			break;
 		}
@@ -597,6 +1143,9 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			if (readcnt > 2)
 				readarr[2] = 0x17;
 			break;
+		case EMULATE_SPI_FLASHCHIP:
+			memcpy(readarr, emu_rdid, min(readcnt, sizeof(emu_rdid)));
+			break;
 		default: /* ignore */
 			break;
 		}
@@ -606,6 +1155,14 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 		break;
 	/* FIXME: this should be chip-specific. */
 	case JEDEC_EWSR:
+		/* Atmel AT26DF chips use 0x50 for block erase instead. */
+		if (emu_eraseblocks[JEDEC_BE_50][0].size && writecnt == JEDEC_BE_50_OUTSIZE) {
+			offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
+			if (emu_erase(JEDEC_BE_50, offs % emu_chip_size))
+				return SPI_INVALID_ADDRESS;
+			break;
+		}
+		/* Fall through. */
 	case JEDEC_WREN:
 		emu_status |= SPI_SR_WEL;
 		break;
@@ -614,14 +1171,16 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("WRSR attempted, but WEL is 0!\n");
 			break;
 		}
-		/* FIXME: add some reasonable simulation of the busy flag */
 		emu_status = writearr[1] & ~SPI_SR_WIP;
 		msg_pdbg2("WRSR wrote 0x%02x.\n", emu_status);
+		emu_set_busy(emu_timing.wrsr);
 		break;
 	case JEDEC_READ:
 		offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
 		/* Truncate to emu_chip_size. */
 		offs %= emu_chip_size;
+		if (emu_locked(offs, readcnt, 0))
+			return SPI_INVALID_ADDRESS;
 		if (readcnt > 0)
 			memcpy(readarr, flashchip_contents + offs, readcnt);
 		break;
@@ -637,7 +1196,10 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Max BYTE PROGRAM size exceeded!\n");
 			return 1;
 		}
+		if (emu_locked(offs, writecnt - 4, 1))
+			return SPI_INVALID_ADDRESS;
 		memcpy(flashchip_contents + offs, writearr + 4, writecnt - 4);
+		emu_set_busy(emu_timing.program);
 		break;
 	case JEDEC_AAI_WORD_PROGRAM:
 		if (!emu_max_aai_size)
@@ -658,8 +1220,11 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 				   writearr[3];
 			/* Truncate to emu_chip_size. */
 			aai_offs %= emu_chip_size;
+			if (emu_locked(aai_offs, 2, 1))
+				return SPI_INVALID_ADDRESS;
 			memcpy(flashchip_contents + aai_offs, writearr + 4, 2);
 			aai_offs += 2;
+			emu_set_busy(emu_timing.program);
 		} else {
 			if (writecnt < JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE) {
 				msg_perr("Continuation AAI WORD PROGRAM size "
@@ -671,94 +1236,64 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 					 "too long!\n");
 				return 1;
 			}
+			if (emu_locked(aai_offs, 2, 1))
+				return SPI_INVALID_ADDRESS;
 			memcpy(flashchip_contents + aai_offs, writearr + 1, 2);
 			aai_offs += 2;
+			emu_set_busy(emu_timing.program);
 		}
 		break;
 	case JEDEC_WRDI:
 		if (emu_max_aai_size)
 			emu_status &= ~SPI_SR_AAI;
 		break;
-	case JEDEC_SE:
-		if (!emu_jedec_se_size)
-			break;
-		if (writecnt != JEDEC_SE_OUTSIZE) {
-			msg_perr("SECTOR ERASE 0x20 outsize invalid!\n");
-			return 1;
-		}
-		if (readcnt != JEDEC_SE_INSIZE) {
-			msg_perr("SECTOR ERASE 0x20 insize invalid!\n");
-			return 1;
-		}
-		offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
-		if (offs & (emu_jedec_se_size - 1))
-			msg_pdbg("Unaligned SECTOR ERASE 0x20: 0x%x\n", offs);
-		offs &= ~(emu_jedec_se_size - 1);
-		memset(flashchip_contents + offs, 0xff, emu_jedec_se_size);
+	case JEDEC_EBSY:
+		if (emu_max_aai_size)
+			emu_aai_ebsy = 1;
 		break;
-	case JEDEC_BE_52:
-		if (!emu_jedec_be_52_size)
-			break;
-		if (writecnt != JEDEC_BE_52_OUTSIZE) {
-			msg_perr("BLOCK ERASE 0x52 outsize invalid!\n");
-			return 1;
-		}
-		if (readcnt != JEDEC_BE_52_INSIZE) {
-			msg_perr("BLOCK ERASE 0x52 insize invalid!\n");
-			return 1;
-		}
-		offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
-		if (offs & (emu_jedec_be_52_size - 1))
-			msg_pdbg("Unaligned BLOCK ERASE 0x52: 0x%x\n", offs);
-		offs &= ~(emu_jedec_be_52_size - 1);
-		memset(flashchip_contents + offs, 0xff, emu_jedec_be_52_size);
+	case JEDEC_DBSY:
+		if (emu_max_aai_size)
+			emu_aai_ebsy = 0;
 		break;
+	case JEDEC_SE:
+	case JEDEC_BE_52:
+	case JEDEC_BE_81:
+	case JEDEC_BE_C4:
+	case JEDEC_BE_D7:
 	case JEDEC_BE_D8:
-		if (!emu_jedec_be_d8_size)
+	case JEDEC_PE:
+		if (!emu_eraseblocks[writearr[0]][0].size)
 			break;
-		if (writecnt != JEDEC_BE_D8_OUTSIZE) {
-			msg_perr("BLOCK ERASE 0xd8 outsize invalid!\n");
+		if (writecnt != JEDEC_SE_OUTSIZE) {
+			msg_perr("BLOCK ERASE 0x%02x outsize invalid!\n", writearr[0]);
 			return 1;
 		}
-		if (readcnt != JEDEC_BE_D8_INSIZE) {
-			msg_perr("BLOCK ERASE 0xd8 insize invalid!\n");
+		if (readcnt != JEDEC_SE_INSIZE) {
+			msg_perr("BLOCK ERASE 0x%02x insize invalid!\n", writearr[0]);
 			return 1;
 		}
 		offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
-		if (offs & (emu_jedec_be_d8_size - 1))
-			msg_pdbg("Unaligned BLOCK ERASE 0xd8: 0x%x\n", offs);
-		offs &= ~(emu_jedec_be_d8_size - 1);
-		memset(flashchip_contents + offs, 0xff, emu_jedec_be_d8_size);
+		/* Truncate to emu_chip_size. */
+		offs %= emu_chip_size;
+		if (emu_erase(writearr[0], offs))
+			return SPI_INVALID_ADDRESS;
 		break;
 	case JEDEC_CE_60:
-		if (!emu_jedec_ce_60_size)
+	case JEDEC_CE_62:
+	case JEDEC_CE_C7:
+		if (!emu_eraseblocks[writearr[0]][0].size)
 			break;
 		if (writecnt != JEDEC_CE_60_OUTSIZE) {
-			msg_perr("CHIP ERASE 0x60 outsize invalid!\n");
+			msg_perr("CHIP ERASE 0x%02x outsize invalid!\n", writearr[0]);
 			return 1;
 		}
 		if (readcnt != JEDEC_CE_60_INSIZE) {
-			msg_perr("CHIP ERASE 0x60 insize invalid!\n");
-			return 1;
-		}
-		/* JEDEC_CE_60_OUTSIZE is 1 (no address) -> no offset. */
-		/* emu_jedec_ce_60_size is emu_chip_size. */
-		memset(flashchip_contents, 0xff, emu_jedec_ce_60_size);
-		break;
-	case JEDEC_CE_C7:
-		if (!emu_jedec_ce_c7_size)
-			break;
-		if (writecnt != JEDEC_CE_C7_OUTSIZE) {
-			msg_perr("CHIP ERASE 0xc7 outsize invalid!\n");
-			return 1;
-		}
-		if (readcnt != JEDEC_CE_C7_INSIZE) {
-			msg_perr("CHIP ERASE 0xc7 insize invalid!\n");
+			msg_perr("CHIP ERASE 0x%02x insize invalid!\n", writearr[0]);
 			return 1;
 		}
-		/* JEDEC_CE_C7_OUTSIZE is 1 (no address) -> no offset. */
-		/* emu_jedec_ce_c7_size is emu_chip_size. */
-		memset(flashchip_contents, 0xff, emu_jedec_ce_c7_size);
+		/* No address, the only block starts at 0. */
+		if (emu_erase(writearr[0], 0))
+			return SPI_INVALID_ADDRESS;
 		break;
 	case JEDEC_SFDP:
 		if (emu_chip != EMULATE_MACRONIX_MX25L6436)
@@ -821,11 +1356,14 @@ static int dummy_spi_send_command(struct flashctx *flash, unsigned int writecnt,
 	/* Response for unknown commands and missing chip is 0xff. */
 	memset(readarr, 0xff, readcnt);
 #if EMULATE_SPI_CHIP
+	emu_wait(emu_timing.latency + (emu_timing.bandwidth ?
+		 (uint64_t)(writecnt + readcnt) * 1000000 / emu_timing.bandwidth : 0));
 	switch (emu_chip) {
 	case EMULATE_ST_M25P10_RES:
 	case EMULATE_SST_SST25VF040_REMS:
 	case EMULATE_SST_SST25VF032B:
 	case EMULATE_MACRONIX_MX25L6436:
+	case EMULATE_SPI_FLASHCHIP:
 		if (emulate_spi_chip_response(writecnt, readcnt, writearr,
 					      readarr)) {
 			msg_pdbg("Invalid command sent to flash chip!\n");
@@ -849,3 +1387,35 @@ static int dummy_spi_write_256(struct flashctx *flash, uint8_t *buf,
 	return spi_write_chunked(flash, buf, start, len,
 				 spi_write_256_chunksize);
 }
+
+/* Wait until the emulated chip is done. Without an emulated chip, MISO reads
+ * as 1 anyway. */
+static int dummy_spi_wait_miso_ready(struct flashctx *flash,
+				     unsigned int timeout_us)
+{
+#if EMULATE_SPI_CHIP
+	uint64_t now;
+
+	if (emu_chip != EMULATE_NONE && !emu_aai_ebsy) {
+		msg_perr("%s: SO does not signal the busy status (no EBSY)!\n",
+			 __func__);
+		return SPI_GENERIC_ERROR;
+	}
+	if (emu_busy()) {
+		now = emu_now();
+		if (!emu_busy_until ||
+		    (now < emu_busy_until && emu_busy_until - now > timeout_us)) {
+			emu_wait(timeout_us);
+			msg_perr("%s: Timeout while waiting for SO.\n", __func__);
+			return SPI_GENERIC_ERROR;
+		}
+		/* A delay may end early, SO is ready only after the operation. */
+		while (emu_busy()) {
+			now = emu_now();
+			if (now < emu_busy_until)
+				emu_wait(emu_busy_until - now);
+		}
+	}
+#endif
+	return 0;
+}
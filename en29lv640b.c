@@ -45,7 +45,8 @@ int write_en29lv640b(struct flashctx *flash, uint8_t *src, unsigned int start,
 
 		/* Transfer data from source to destination. */
 		chip_writew(flash, (*src) | ((*(src + 1)) << 8 ), dst);
-		toggle_ready_jedec(flash, dst);
+		if (toggle_ready_jedec(flash, dst))
+			return 1;
 #if 0
 		/* We only want to print something in the error case. */
 		msg_cerr("Value in the flash at address 0x%lx = %#x, want %#x\n",
@@ -55,7 +56,7 @@ int write_en29lv640b(struct flashctx *flash, uint8_t *src, unsigned int start,
 		src += 2;
 	}
 
-	/* FIXME: Ignore errors for now. */
+	/* FIXME: Ignore verify errors for now. */
 	return 0;
 }
 
@@ -100,10 +101,9 @@ int erase_en29lv640b(struct flashctx *flash)
 	chip_writeb(flash, 0x10, bios + 0xAAA);
 
 	programmer_delay(10);
-	toggle_ready_jedec(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_erase(flash, bios,
+					flash->chip->total_size * 1024);
 }
 
 int block_erase_en29lv640b(struct flashctx *flash, unsigned int start,
@@ -121,10 +121,8 @@ int block_erase_en29lv640b(struct flashctx *flash, unsigned int start,
 	chip_writeb(flash, 0x30, dst);
 
 	programmer_delay(10);
-	toggle_ready_jedec(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_erase(flash, bios, len);
 }
 
 int block_erase_chip_en29lv640b(struct flashctx *flash, unsigned int address,
@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "libflashrom.h"
 #ifdef _WIN32
 #include <windows.h>
 #undef min
@@ -89,6 +90,18 @@ enum write_granularity {
 	write_gran_1056bytes,	/* If less than 1056 bytes are written, the unwritten bytes are undefined. */
 };
 
+/* Multi-I/O SPI read commands, named after the number of lines used for
+ * opcode, address and data. */
+enum spi_read_mode {
+	SPI_READ_1_1_2 = 0,	/* Dual Output */
+	SPI_READ_1_2_2,		/* Dual I/O */
+	SPI_READ_1_1_4,		/* Quad Output */
+	SPI_READ_1_4_4,		/* Quad I/O */
+	SPI_READ_2_2_2,		/* DPI */
+	SPI_READ_4_4_4,		/* QPI */
+	NUM_SPI_READ_MODES
+};
+
 /*
  * How many different contiguous runs of erase blocks with one size each do
  * we have for a given erase function?
@@ -119,6 +132,8 @@ enum write_granularity {
 #define FEATURE_WRSR_EITHER	(FEATURE_WRSR_EWSR | FEATURE_WRSR_WREN)
 #define FEATURE_OTP		(1 << 8)
 #define FEATURE_QPI		(1 << 9)
+#define FEATURE_4BA_SUPPORT	(1 << 10)	/* 4-byte addressing is available */
+#define FEATURE_AAI_EBSY	(1 << 11)	/* SO can signal AAI busy (EBSY/DBSY) */
 
 struct flashctx;
 typedef int (erasefunc_t)(struct flashctx *flash, unsigned int addr, unsigned int blocklen);
@@ -141,6 +156,10 @@ struct flashchip {
 	unsigned int total_size;
 	/* Chip page size in bytes */
 	unsigned int page_size;
+	/* Largest naturally aligned range one program command can write.
+	 * 0 means page_size for the page programming functions and 1 (byte
+	 * or word programming) for all others, see flash_writechunk_size(). */
+	unsigned int max_writechunk_size;
 	int feature_bits;
 
 	/*
@@ -182,6 +201,27 @@ struct flashchip {
 		uint16_t max;
 	} voltage;
 	enum write_granularity gran;
+
+	/*
+	 * Typical operation times in microseconds, 0 means unknown and lets
+	 * the chip drivers fall back to generic (generous) defaults. The
+	 * worst case is assumed to be max_factor times the typical time.
+	 */
+	struct timing {
+		unsigned int byte_program;	/* One byte (or word) */
+		unsigned int page_program;	/* One page of page_size bytes */
+		/* One block of the corresponding entry in block_erasers[] */
+		unsigned int erase[NUM_ERASEFUNCTIONS];
+		unsigned int max_factor;
+	} timing;
+
+	/* Fast read commands (SPI only), an opcode of 0 means unsupported.
+	 * Clocks are counted at the width of the address phase. */
+	struct spi_read_cmd {
+		uint8_t opcode;
+		uint8_t mode_clocks;
+		uint8_t dummy_clocks;
+	} read_cmds[NUM_SPI_READ_MODES];
 };
 
 struct flashctx {
@@ -234,7 +274,6 @@ uint32_t chip_readl(const struct flashctx *flash, const chipaddr addr);
 void chip_readn(const struct flashctx *flash, uint8_t *buf, const chipaddr addr, size_t len);
 
 /* print.c */
-char *flashbuses_to_text(enum chipbustype bustype);
 int print_supported(void);
 void print_supported_wiki(void);
 
@@ -243,6 +282,9 @@ extern int verbose_screen;
 extern int verbose_logfile;
 extern const char flashrom_version[];
 extern const char *chip_to_probe;
+extern const char *digest_manifest;
+extern bool skip_locked;
+extern const char *journal_file;
 void map_flash_registers(struct flashctx *flash);
 int read_memmapped(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len);
 int erase_flash(struct flashctx *flash);
@@ -254,13 +296,22 @@ void tolower_string(char *str);
 char *extract_param(const char *const *haystack, const char *needle, const char *delim);
 int verify_range(struct flashctx *flash, uint8_t *cmpbuf, unsigned int start, unsigned int len);
 int need_erase(uint8_t *have, uint8_t *want, unsigned int len, enum write_granularity gran);
+unsigned int flash_writechunk_size(const struct flashctx *flash);
 char *strcat_realloc(char *dest, const char *src);
+char *flashbuses_to_text(enum chipbustype bustype);
 void print_version(void);
 void print_buildinfo(void);
 void print_banner(void);
 void list_programmers_linebreak(int startcol, int cols, int paren);
 int selfcheck(void);
 int doit(struct flashctx *flash, int force, const char *filename, int read_it, int write_it, int erase_it, int verify_it);
+int doit_buffer(struct flashctx *flash, int force, uint8_t *buf, int read_it, int write_it, int erase_it,
+		int verify_it);
+bool chip_fully_accessible(void);
+#define NUM_TESTPATTERNS 14
+int generate_testpattern(uint8_t *buf, uint32_t start, uint32_t len, int variant);
+int stress_flash(struct flashctx *flash, int force, const char *patterns);
+int preload_image_file(const char *filename);
 int read_buf_from_file(unsigned char *buf, unsigned long size, const char *filename);
 int write_buf_to_file(unsigned char *buf, unsigned long size, const char *filename);
 
@@ -283,6 +334,89 @@ enum test_state {
  */
 #define ERROR_FLASHROM_LIMIT -201
 
+/* digest.c */
+#define SHA256_DIGEST_SIZE 32
+struct sha256_ctx {
+	uint32_t state[8];
+	uint64_t count;
+	uint8_t buf[64];
+};
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const uint8_t *data, size_t len);
+void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+/* Digests of the chip contents, fed sequentially while reading the chip. */
+struct flash_digest {
+	struct sha256_ctx sha256;
+	uint32_t crc32;
+	unsigned int size;
+	unsigned int pos;
+	/* Optional per erase block manifest */
+	FILE *manifest;
+	const char *manifest_name;
+	const struct block_eraser *eraser;
+	int region;
+	unsigned int block;
+	unsigned int block_start;
+	unsigned int block_len;
+	struct sha256_ctx block_sha256;
+	uint8_t result[SHA256_DIGEST_SIZE];
+};
+int digest_init(struct flash_digest *d, const struct flashctx *flash, const char *manifest);
+void digest_update(struct flash_digest *d, const uint8_t *buf, unsigned int len);
+int digest_finish(struct flash_digest *d);
+void digest_print(const struct flash_digest *d);
+void digest_abort(struct flash_digest *d);
+
+/* journal.c */
+int journal_start(const char *filename, const struct flashctx *flash,
+		  const uint8_t plan[SHA256_DIGEST_SIZE]);
+bool journal_active(void);
+bool journal_block_done(unsigned int start, unsigned int len);
+int journal_commit(unsigned int start, unsigned int len);
+void journal_finish(bool finished);
+
+/* bench.c */
+int benchmark_flash(struct flashctx *flash, const char *profile, const char *key);
+int save_profile(const char *profile, const char *key, unsigned int read_chunk);
+void load_profile(struct flashctx *flash, const char *profile, const char *key);
+
+/* batch.c */
+int batch_flash(struct flashctx *flash, int force, const char *script);
+int batch_listen(struct flashctx *flash, int force, const char *path);
+
+/* gang.c */
+int gang_fork(char *const *specs, int count, int *ret);
+
+/* perf.c */
+enum perf_phase {
+	PERF_OTHER,		/* Setup, shutdown and anything not listed below */
+	PERF_PROBE,
+	PERF_READ,		/* Reading the chip to a file or digest */
+	PERF_PREREAD,		/* Reading blocks before erasing/writing them */
+	PERF_ERASE,
+	PERF_PROGRAM,
+	PERF_VERIFY,
+	PERF_NUM_PHASES
+};
+enum perf_phase perf_phase(enum perf_phase phase);
+void perf_count_read(unsigned int len);
+void perf_count_write(unsigned int len);
+void perf_count_erase(unsigned int len);
+void perf_count_skipped_block(void);
+void perf_count_spi_command(unsigned int writecnt, unsigned int readcnt);
+void perf_count_spi_multicommand(void);
+void perf_count_status_poll(void);
+void perf_count_delay(int usecs);
+int perf_report(const char *filename, const char *programmer_name, const char *chip);
+struct perf_totals {
+	uint64_t wall_us;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t bytes_erased;
+};
+void perf_get_totals(enum perf_phase phase, struct perf_totals *totals);
+
 /* cli_output.c */
 #ifndef STANDALONE
 int open_logfile(const char * const filename);
@@ -297,6 +431,9 @@ enum msglevel {
 	MSG_DEBUG2	= 4,
 	MSG_SPEW	= 5,
 };
+void print_to_stderr_only(void);
+int flashrom_print_cb(void *data, enum flashrom_log_level level, const char *fmt, va_list ap);
+/* libflashrom.c */
 /* Let gcc and clang check for correct printf-style format strings. */
 int print(enum msglevel level, const char *fmt, ...)
 #ifdef __MINGW32__
@@ -327,16 +464,28 @@ __attribute__((format(printf, 2, 3)));
 int register_include_arg(char *name);
 int process_include_args(void);
 int read_romlayout(char *name);
+int add_romentry(chipoff_t start, chipoff_t end, const char *name);
+int layout_from_ifd(const uint8_t *buf, size_t len);
+int read_image_layout(const char *filename, bool fmap);
 int normalize_romentries(const struct flashctx *flash);
-int build_new_image(const struct flashctx *flash, uint8_t *oldcontents, uint8_t *newcontents);
+int build_new_image(const struct flashctx *flash, uint8_t *oldcontents, uint8_t *newcontents,
+		    unsigned int start, unsigned int len);
+bool layout_includes_range(unsigned int start, unsigned int len);
+void layout_hash(struct sha256_ctx *ctx);
+void clear_include_args(void);
 void layout_cleanup(void);
 
+/* fmap.c */
+int layout_from_fmap(const uint8_t *buf, size_t len);
+
 /* spi.c */
 struct spi_command {
 	unsigned int writecnt;
 	unsigned int readcnt;
 	const unsigned char *writearr;
 	unsigned char *readarr;
+	/* Microseconds to wait after this command in a multicommand. */
+	unsigned int delay_us;
 };
 int spi_send_command(struct flashctx *flash, unsigned int writecnt, unsigned int readcnt, const unsigned char *writearr, unsigned char *readarr);
 int spi_send_multicommand(struct flashctx *flash, struct spi_command *cmds);
@@ -9665,7 +9665,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25VF020B,
 		.total_size	= 256,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EWSR,
+		.feature_bits	= FEATURE_WRSR_EWSR | FEATURE_AAI_EBSY,
 		.tested		= TEST_UNTESTED,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -9735,7 +9735,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25VF040B,
 		.total_size	= 512,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EWSR,
+		.feature_bits	= FEATURE_WRSR_EWSR | FEATURE_AAI_EBSY,
 		.tested		= TEST_OK_PREW,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -9773,7 +9773,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25VF040B_REMS,
 		.total_size	= 512,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EWSR,
+		.feature_bits	= FEATURE_WRSR_EWSR | FEATURE_AAI_EBSY,
 		.tested		= TEST_OK_PREW,
 		.probe		= probe_spi_rems,
 		.probe_timing	= TIMING_ZERO,
@@ -9811,7 +9811,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25VF080B,
 		.total_size	= 1024,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EWSR,
+		.feature_bits	= FEATURE_WRSR_EWSR | FEATURE_AAI_EBSY,
 		.tested		= TEST_OK_PREW,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -9849,7 +9849,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25VF016B,
 		.total_size	= 2048,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EITHER,
+		.feature_bits	= FEATURE_WRSR_EITHER | FEATURE_AAI_EBSY,
 		.tested		= TEST_OK_PREW,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -9887,7 +9887,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25VF032B,
 		.total_size	= 4096,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EWSR,
+		.feature_bits	= FEATURE_WRSR_EWSR | FEATURE_AAI_EBSY,
 		.tested		= TEST_OK_PREW,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -9963,7 +9963,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25WF512,
 		.total_size	= 64,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EITHER,
+		.feature_bits	= FEATURE_WRSR_EITHER | FEATURE_AAI_EBSY,
 		.tested		= TEST_UNTESTED,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -9997,7 +9997,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25WF010,
 		.total_size	= 128,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EITHER,
+		.feature_bits	= FEATURE_WRSR_EITHER | FEATURE_AAI_EBSY,
 		.tested		= TEST_UNTESTED,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -10031,7 +10031,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25WF020,
 		.total_size	= 256,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EITHER,
+		.feature_bits	= FEATURE_WRSR_EITHER | FEATURE_AAI_EBSY,
 		.tested		= TEST_UNTESTED,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -10068,7 +10068,7 @@ const struct flashchip flashchips[] = {
 		.model_id	= SST_SST25WF040,
 		.total_size	= 512,
 		.page_size	= 256,
-		.feature_bits	= FEATURE_WRSR_EITHER,
+		.feature_bits	= FEATURE_WRSR_EITHER | FEATURE_AAI_EBSY,
 		.tested		= TEST_UNTESTED,
 		.probe		= probe_spi_rdid,
 		.probe_timing	= TIMING_ZERO,
@@ -35,18 +35,43 @@
 #if HAVE_UTSNAME == 1
 #include <sys/utsname.h>
 #endif
+#if !defined(__DJGPP__) && !defined(__LIBPAYLOAD__) && !defined(_WIN32)
+#include <unistd.h>
+#include <sys/mman.h>
+#define HAVE_IMAGE_MMAP 1
+#endif
+#ifdef _WIN32
+#include <io.h>
+#endif
 #include "flash.h"
 #include "flashchips.h"
 #include "programmer.h"
 #include "hwaccess.h"
+#include "chipdrivers.h"
 
 const char flashrom_version[] = FLASHROM_VERSION;
 const char *chip_to_probe = NULL;
+/* File for the per erase block digests of the chip contents, if wanted. */
+const char *digest_manifest = NULL;
+/* Leave out locked ranges instead of refusing to write or erase them. */
+bool skip_locked = false;
+/* Journal of the committed blocks to resume interrupted writes, if wanted. */
+const char *journal_file = NULL;
 int verbose_screen = MSG_INFO;
 int verbose_logfile = MSG_DEBUG2;
 
 static enum programmer programmer = PROGRAMMER_INVALID;
 
+/* A chip range the programmer can not read and/or write. */
+struct access_restriction {
+	chipoff_t start;
+	chipoff_t end;
+	bool read;
+	bool write;
+};
+static struct access_restriction *access_restrictions = NULL;
+static int num_access_restrictions = 0;
+
 static const char *programmer_param = NULL;
 
 /*
@@ -83,7 +108,7 @@ const struct programmer_entry programmer_table[] = {
 		.init			= dummy_init,
 		.map_flash_region	= dummy_map,
 		.unmap_flash_region	= dummy_unmap,
-		.delay			= internal_delay,
+		.delay			= dummy_delay,
 	},
 #endif
 
@@ -426,10 +451,109 @@ int programmer_shutdown(void)
 
 	programmer_param = NULL;
 	registered_programmer_count = 0;
+	free(access_restrictions);
+	access_restrictions = NULL;
+	num_access_restrictions = 0;
 
 	return ret;
 }
 
+/* Tell the core that the programmer can not read and/or write the chip range
+ * [start, end], e.g. because of chipset locks. To be called by programmer init
+ * functions. Ranges which can not be read are not written either, because the
+ * result could never be verified. */
+int register_access_restriction(chipoff_t start, chipoff_t end, bool read, bool write)
+{
+	struct access_restriction *tmp;
+
+	if (read && write)
+		return 0;
+	tmp = realloc(access_restrictions, (num_access_restrictions + 1) * sizeof(*tmp));
+	if (!tmp) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	access_restrictions = tmp;
+	tmp[num_access_restrictions].start = start;
+	tmp[num_access_restrictions].end = end;
+	tmp[num_access_restrictions].read = read;
+	tmp[num_access_restrictions].write = read && write;
+	num_access_restrictions++;
+	return 0;
+}
+
+/* Can the programmer read and write the whole chip? */
+bool chip_fully_accessible(void)
+{
+	return num_access_restrictions == 0;
+}
+
+/* Return the end of the piece [addr, end) of the chip in which every byte has
+ * the same access rights, and store them in read and write. */
+static unsigned int access_piece(unsigned int addr, unsigned int end, bool *read, bool *write)
+{
+	const struct access_restriction *r;
+	int i;
+
+	*read = *write = true;
+	for (i = 0; i < num_access_restrictions; i++) {
+		r = &access_restrictions[i];
+		if (r->start > addr) {
+			if (r->start < end)
+				end = r->start;
+			continue;
+		}
+		if (r->end < addr)
+			continue;
+		*read &= r->read;
+		*write &= r->write;
+		if ((uint64_t)r->end + 1 < end)
+			end = r->end + 1;
+	}
+	return end;
+}
+
+/* Can the whole chip range [start, start + len) be read and written? */
+static bool range_accessible(unsigned int start, unsigned int len)
+{
+	bool read, write;
+
+	return access_piece(start, start + len, &read, &write) == start + len && write;
+}
+
+/* Is any byte of the chip range [start, start + len) writable? */
+static bool range_has_writable(unsigned int start, unsigned int len)
+{
+	unsigned int addr, next, end = start + len;
+	bool read, write;
+
+	for (addr = start; addr < end; addr = next) {
+		next = access_piece(addr, end, &read, &write);
+		if (write)
+			return true;
+	}
+	return false;
+}
+
+/* Read the chip range [start, start + len) into buf and count the bytes read.
+ * Unreadable parts are filled with 0xff instead. */
+static int read_accessible(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	unsigned int addr, next, end = start + len;
+	bool read, write;
+
+	for (addr = start; addr < end; addr = next) {
+		next = access_piece(addr, end, &read, &write);
+		if (!read)
+			memset(buf + addr - start, 0xff, next - addr);
+		else if (flash->chip->read(flash, buf + addr - start, addr, next - addr))
+			return 1;
+		else
+			perf_count_read(next - addr);
+	}
+	return 0;
+}
+
 void *programmer_map_flash_region(const char *descr, uintptr_t phys_addr, size_t len)
 {
 	void *ret = programmer_table[programmer].map_flash_region(descr, phys_addr, len);
@@ -487,8 +611,11 @@ void chip_readn(const struct flashctx *flash, uint8_t *buf, chipaddr addr,
 
 void programmer_delay(int usecs)
 {
-	if (usecs > 0)
+	if (usecs > 0) {
+		perf_count_delay(usecs);
+		spi_trace_delay(usecs);
 		programmer_table[programmer].delay(usecs);
+	}
 }
 
 void map_flash_registers(struct flashctx *flash)
@@ -543,6 +670,39 @@ char *strcat_realloc(char *dest, const char *src)
 	return dest;
 }
 
+/*
+ * Return a string corresponding to the bustype parameter.
+ * Memory is obtained with malloc() and must be freed with free() by the caller.
+ */
+char *flashbuses_to_text(enum chipbustype bustype)
+{
+	char *ret = calloc(1, 1);
+	/*
+	 * FIXME: Once all chipsets and flash chips have been updated, NONSPI
+	 * will cease to exist and should be eliminated here as well.
+	 */
+	if (bustype == BUS_NONSPI) {
+		ret = strcat_realloc(ret, "Non-SPI, ");
+	} else {
+		if (bustype & BUS_PARALLEL)
+			ret = strcat_realloc(ret, "Parallel, ");
+		if (bustype & BUS_LPC)
+			ret = strcat_realloc(ret, "LPC, ");
+		if (bustype & BUS_FWH)
+			ret = strcat_realloc(ret, "FWH, ");
+		if (bustype & BUS_SPI)
+			ret = strcat_realloc(ret, "SPI, ");
+		if (bustype & BUS_PROG)
+			ret = strcat_realloc(ret, "Programmer-specific, ");
+		if (bustype == BUS_NONE)
+			ret = strcat_realloc(ret, "None, ");
+	}
+	/* Kill last comma. */
+	ret[strlen(ret) - 2] = '\0';
+	ret = realloc(ret, strlen(ret) + 1);
+	return ret;
+}
+
 /* This is a somewhat hacked function similar in some ways to strtok().
  * It will look for needle with a subsequent '=' in haystack, return a copy of
  * needle and remove everything from the first occurrence of needle to the next
@@ -697,6 +857,7 @@ int verify_range(struct flashctx *flash, uint8_t *cmpbuf, unsigned int start, un
 			 "at 0x%x (len 0x%x)\n", start, len);
 		return ret;
 	}
+	perf_count_read(len);
 
 	ret = compare_range(cmpbuf, readbuf, start, len);
 out_free:
@@ -780,35 +941,72 @@ int need_erase(uint8_t *have, uint8_t *want, unsigned int len, enum write_granul
 	return result;
 }
 
+/*
+ * Return the largest naturally aligned range a single program command of the
+ * chip can write. Chips without an explicit max_writechunk_size use page_size
+ * if they are written by one of the generic page programming functions.
+ */
+unsigned int flash_writechunk_size(const struct flashctx *flash)
+{
+	const struct flashchip *chip = flash->chip;
+
+	if (chip->max_writechunk_size)
+		return chip->max_writechunk_size;
+	if ((chip->write == spi_chip_write_256 || chip->write == write_jedec) &&
+	    chip->page_size)
+		return chip->page_size;
+	return 1;
+}
+
+/*
+ * Return the size of the aligned windows one program operation is limited to,
+ * i.e. the chip's write chunk size further limited by the programmer's maximum
+ * write length. 0 means runs of changed bytes must not be coalesced.
+ */
+static unsigned int get_write_window(const struct flashctx *flash)
+{
+	unsigned int window = flash_writechunk_size(flash);
+
+	/* Each written byte can be programmed only once, even if unchanged. */
+	if (flash->chip->gran == write_gran_1byte || window < 2)
+		return 0;
+	if (flash->chip->bustype == BUS_SPI &&
+	    flash->pgm->spi.max_data_write != MAX_DATA_UNSPECIFIED)
+		window = min(window, flash->pgm->spi.max_data_write);
+	return window;
+}
+
 /**
  * Check if the buffer @have needs to be programmed to get the content of @want.
  * If yes, return 1 and fill in first_start with the start address of the
  * write operation and first_len with the length of the first to-be-written
  * chunk. If not, return 0 and leave first_start and first_len undefined.
  *
+ * Runs of changed chunks are coalesced only within one write window: every
+ * window needs a program operation of its own anyway, so merging across a
+ * window boundary would only transfer the unchanged data in between.
+ *
  * Warning: This function assumes that @have and @want point to naturally
  * aligned regions.
  *
  * @have	buffer with current content
  * @want	buffer with desired content
  * @len		length of the checked area
+ * @addr	chip address of @have[0], used to align to @window
  * @gran	write granularity (enum, not count)
+ * @window	write window size from get_write_window(), 0 to not coalesce
  * @first_start	offset of the first byte which needs to be written (passed in
  *		value is increased by the offset of the first needed write
  *		relative to have/want or unchanged if no write is needed)
  * @return	length of the first contiguous area which needs to be written
  *		0 if no write is needed
- *
- * FIXME: This function needs a parameter which tells it about coalescing
- * in relation to the max write length of the programmer and the max write
- * length of the chip.
  */
 static unsigned int get_next_write(uint8_t *have, uint8_t *want, unsigned int len,
-			  unsigned int *first_start,
-			  enum write_granularity gran)
+			  unsigned int addr, unsigned int *first_start,
+			  enum write_granularity gran, unsigned int window)
 {
 	int need_write = 0;
-	unsigned int rel_start = 0, first_len = 0;
+	unsigned int rel_start = 0, rel_end = 0;
 	unsigned int i, limit, stride;
 
 	switch (gran) {
@@ -845,25 +1043,25 @@ static unsigned int get_next_write(uint8_t *have, uint8_t *want, unsigned int le
 	for (i = 0; i < len / stride; i++) {
 		limit = min(stride, len - i * stride);
 		/* Are 'have' and 'want' identical? */
-		if (memcmp(have + i * stride, want + i * stride, limit)) {
-			if (!need_write) {
-				/* First location where have and want differ. */
-				need_write = 1;
-				rel_start = i * stride;
-			}
-		} else {
-			if (need_write) {
-				/* First location where have and want
-				 * do not differ anymore.
-				 */
+		if (!memcmp(have + i * stride, want + i * stride, limit))
+			continue;
+		if (!need_write) {
+			/* First location where have and want differ. */
+			need_write = 1;
+			rel_start = i * stride;
+		} else if (rel_end < i * stride) {
+			/* The unchanged data in between is only included in
+			 * the write if this change is in the same window as
+			 * the last byte written.
+			 */
+			if (!window || (addr + i * stride) / window !=
+				       (addr + rel_end - 1) / window)
 				break;
-			}
 		}
+		rel_end = i * stride + limit;
 	}
-	if (need_write)
-		first_len = min(i * stride - rel_start, len);
 	*first_start += rel_start;
-	return first_len;
+	return rel_end - rel_start;
 }
 
 /* This function generates various test patterns useful for testing controller
@@ -915,90 +1113,60 @@ static unsigned int get_next_write(uint8_t *have, uint8_t *want, unsigned int le
  * None of the patterns can detect aliasing at boundaries which are a multiple
  * of 16 MBytes (but such chips do not exist anyway for Parallel/LPC/FWH/SPI).
  */
-int generate_testpattern(uint8_t *buf, uint32_t size, int variant)
+static uint8_t testpattern_byte(uint32_t addr, int variant)
 {
-	int i;
-
-	if (!buf) {
-		msg_gerr("Invalid buffer!\n");
-		return 1;
-	}
+	/* Block number of patterns 0-7, see above. */
+	if (variant <= 7 && (addr & 0xff) == 254)
+		return (addr >> 16) & 0xff;
+	if (variant <= 7 && (addr & 0xff) == 255)
+		return (addr >> 8) & 0xff;
 
 	switch (variant) {
 	case 0:
-		for (i = 0; i < size; i++)
-			buf[i] = (i & 0xf) << 4 | 0x5;
-		break;
+		return (addr & 0xf) << 4 | 0x5;
 	case 1:
-		for (i = 0; i < size; i++)
-			buf[i] = (i & 0xf) << 4 | 0xa;
-		break;
+		return (addr & 0xf) << 4 | 0xa;
 	case 2:
-		for (i = 0; i < size; i++)
-			buf[i] = 0x50 | (i & 0xf);
-		break;
+		return 0x50 | (addr & 0xf);
 	case 3:
-		for (i = 0; i < size; i++)
-			buf[i] = 0xa0 | (i & 0xf);
-		break;
+		return 0xa0 | (addr & 0xf);
 	case 4:
-		for (i = 0; i < size; i++)
-			buf[i] = (i & 0xf) << 4;
-		break;
+		return (addr & 0xf) << 4;
 	case 5:
-		for (i = 0; i < size; i++)
-			buf[i] = i & 0xf;
-		break;
-	case 6:
-		memset(buf, 0x00, size);
-		break;
-	case 7:
-		memset(buf, 0xff, size);
-		break;
+		return addr & 0xf;
 	case 8:
-		for (i = 0; i < size; i++)
-			buf[i] = i & 0xff;
-		break;
+		return addr & 0xff;
 	case 9:
-		for (i = 0; i < size; i++)
-			buf[i] = ~(i & 0xff);
-		break;
+		return ~(addr & 0xff);
 	case 10:
-		for (i = 0; i < size % 2; i++) {
-			buf[i * 2] = (i >> 8) & 0xff;
-			buf[i * 2 + 1] = i & 0xff;
-		}
-		if (size & 0x1)
-			buf[i * 2] = (i >> 8) & 0xff;
-		break;
+		return (addr & 1) ? (addr >> 1) & 0xff : (addr >> 9) & 0xff;
 	case 11:
-		for (i = 0; i < size % 2; i++) {
-			buf[i * 2] = ~((i >> 8) & 0xff);
-			buf[i * 2 + 1] = ~(i & 0xff);
-		}
-		if (size & 0x1)
-			buf[i * 2] = ~((i >> 8) & 0xff);
-		break;
-	case 12:
-		memset(buf, 0x00, size);
-		break;
+		return ~((addr & 1) ? (addr >> 1) & 0xff : (addr >> 9) & 0xff);
+	case 7:
 	case 13:
-		memset(buf, 0xff, size);
-		break;
+		return 0xff;
+	default:
+		/* 6 and 12 */
+		return 0x00;
 	}
+}
 
-	if ((variant >= 0) && (variant <= 7)) {
-		/* Write block number in the last two bytes of each 256-byte
-		 * block, big endian for easier reading of the hexdump.
-		 * Note that this wraps around for chips larger than 2^24 bytes
-		 * (16 MB).
-		 */
-		for (i = 0; i < size / 256; i++) {
-			buf[i * 256 + 254] = (i >> 8) & 0xff;
-			buf[i * 256 + 255] = i & 0xff;
-		}
-	}
+/* Fill buf with len bytes of the pattern at chip offset start, so the pattern
+ * can be generated block by block. */
+int generate_testpattern(uint8_t *buf, uint32_t start, uint32_t len, int variant)
+{
+	uint32_t i;
 
+	if (!buf) {
+		msg_gerr("Invalid buffer!\n");
+		return 1;
+	}
+	if (variant < 0 || variant >= NUM_TESTPATTERNS) {
+		msg_gerr("Invalid test pattern %i!\n", variant);
+		return 1;
+	}
+	for (i = 0; i < len; i++)
+		buf[i] = testpattern_byte(start + i, variant);
 	return 0;
 }
 
@@ -1166,46 +1334,347 @@ notfound:
 	return chip - flashchips;
 }
 
-int read_buf_from_file(unsigned char *buf, unsigned long size,
-		       const char *filename)
+/*
+ * An image file accessed block by block. Where possible the file is memory
+ * mapped so flash contents go straight from/to the page cache: Images to be
+ * written or verified are mapped privately (the layout merge may modify the
+ * mapping without touching the file), images being read are mapped shared.
+ * Otherwise the blocks are copied with stdio.
+ * The file name "-" stands for stdin (read) or stdout (write). Pipes and other
+ * non-regular files can only be accessed sequentially.
+ */
+struct image_file {
+	const char *filename;
+	FILE *file;
+	uint8_t *map;		/* NULL if stdio is used */
+	unsigned long size;
+	unsigned long pos;	/* Current stdio file position */
+	bool writable;
+	bool seekable;		/* A regular file, not a pipe */
+	bool testpattern;	/* Generate test pattern variant instead of a file */
+	int variant;
+	/* map points to memory which is not ours, e.g. the preloaded image or
+	 * a library caller's buffer. It is never modified when reading. */
+	bool borrowed;
+};
+
+/* An image which was read into memory once by preload_image_file(), so that
+ * e.g. gang programming workers share it instead of reading it again. */
+static struct {
+	char *filename;
+	uint8_t *data;
+	unsigned long size;
+} preloaded_image;
+
+static int close_image_file(struct image_file *image);
+
+static void map_image_file(struct image_file *image)
+{
+#if HAVE_IMAGE_MMAP == 1
+	int fd = fileno(image->file);
+	void *map;
+
+	if (image->writable) {
+		if (ftruncate(fd, image->size))
+			return;
+#ifdef __linux__
+		/* Writing to a mapping of a sparse file on a full file system
+		 * causes SIGBUS instead of an error. Allocate in advance. */
+		if (posix_fallocate(fd, 0, image->size))
+			return;
+#endif
+		map = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	} else {
+		map = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	if (map == MAP_FAILED) {
+		msg_gdbg("Could not map image file \"%s\": %s\n", image->filename, strerror(errno));
+		return;
+	}
+	image->map = map;
+#endif
+}
+
+/* An image in buf, which is read into if writable. */
+static void open_buffer_image(struct image_file *image, uint8_t *buf, unsigned long size,
+			      bool writable)
+{
+	memset(image, 0, sizeof(*image));
+	image->filename = "buffer";
+	image->map = buf;
+	image->size = size;
+	image->writable = writable;
+	image->seekable = true;
+	image->borrowed = true;
+}
+
+/* Open an image file for reading (and check that its size matches the flash
+ * chip) or create one for writing. */
+static int open_image_file(struct image_file *image, const char *filename, unsigned long size,
+			   bool writable)
 {
 #ifdef __LIBPAYLOAD__
 	msg_gerr("Error: No file I/O support in libpayload\n");
 	return 1;
 #else
-	unsigned long numbytes;
-	FILE *image;
 	struct stat image_stat;
 
-	if ((image = fopen(filename, "rb")) == NULL) {
+	memset(image, 0, sizeof(*image));
+	image->filename = filename;
+	image->size = size;
+	image->writable = writable;
+	if (!filename) {
+		msg_gerr("No filename specified.\n");
+		return 1;
+	}
+	if (!writable && preloaded_image.filename && !strcmp(filename, preloaded_image.filename)) {
+		if (preloaded_image.size != size) {
+			msg_gerr("Error: Image size (%lu B) doesn't match the flash chip's size (%lu B)!\n",
+				 preloaded_image.size, size);
+			return 1;
+		}
+		open_buffer_image(image, preloaded_image.data, size, false);
+		return 0;
+	}
+	if (!strcmp(filename, "-")) {
+		image->file = writable ? stdout : stdin;
+#ifdef _WIN32
+		setmode(fileno(image->file), O_BINARY);
+#endif
+	} else if ((image->file = fopen(filename, writable ? "w+b" : "rb")) == NULL) {
 		msg_gerr("Error: opening file \"%s\" failed: %s\n", filename, strerror(errno));
 		return 1;
 	}
-	if (fstat(fileno(image), &image_stat) != 0) {
-		msg_gerr("Error: getting metadata of file \"%s\" failed: %s\n", filename, strerror(errno));
-		fclose(image);
+	if (fstat(fileno(image->file), &image_stat) != 0) {
+		msg_gerr("Error: getting metadata of file \"%s\" failed: %s\n", filename,
+			 strerror(errno));
+		close_image_file(image);
 		return 1;
 	}
-	if (image_stat.st_size != size) {
+	/* stdin/stdout are always treated as a stream, even if redirected to
+	 * a file, because the file position may be anywhere. */
+	image->seekable = S_ISREG(image_stat.st_mode) && image->file != stdin &&
+			  image->file != stdout;
+	if (!image->seekable) {
+		msg_gdbg("Accessing image \"%s\" sequentially.\n", filename);
+		return 0;
+	}
+	if (!writable && image_stat.st_size != size) {
 		msg_gerr("Error: Image size (%jd B) doesn't match the flash chip's size (%lu B)!\n",
 			 (intmax_t)image_stat.st_size, size);
-		fclose(image);
+		close_image_file(image);
 		return 1;
 	}
-	numbytes = fread(buf, 1, size, image);
-	if (fclose(image)) {
-		msg_gerr("Error: closing file \"%s\" failed: %s\n", filename, strerror(errno));
+	map_image_file(image);
+	return 0;
+#endif
+}
+
+/* An image with test pattern variant, see generate_testpattern(). */
+static void open_pattern_image(struct image_file *image, unsigned long size, int variant)
+{
+	memset(image, 0, sizeof(*image));
+	image->filename = "test pattern";
+	image->size = size;
+	image->seekable = true;
+	image->testpattern = true;
+	image->variant = variant;
+}
+
+static int close_image_file(struct image_file *image)
+{
+#ifdef __LIBPAYLOAD__
+	return 1;
+#else
+	int ret = 0;
+
+	if (image->testpattern || image->borrowed)
+		return 0;
+
+#if HAVE_IMAGE_MMAP == 1
+	if (image->map) {
+		if (image->writable && msync(image->map, image->size, MS_ASYNC)) {
+			msg_gerr("Error: writing file \"%s\" failed: %s\n", image->filename,
+				 strerror(errno));
+			ret = 1;
+		}
+		munmap(image->map, image->size);
+	}
+#endif
+	if (image->file == stdin)
+		return ret;
+	if (image->file == stdout ? fflush(image->file) : fclose(image->file)) {
+		msg_gerr("Error: closing file \"%s\" failed: %s\n", image->filename, strerror(errno));
+		ret = 1;
+	}
+	return ret;
+#endif
+}
+
+/* The file part of get_image_range(). */
+static uint8_t *read_image_range(struct image_file *image, uint8_t *buf, unsigned int start,
+				 unsigned int len)
+{
+#ifdef __LIBPAYLOAD__
+	return NULL;
+#else
+	size_t numbytes;
+
+	/* The caller may modify the data. */
+	if (image->borrowed) {
+		memcpy(buf, image->map + start, len);
+		return buf;
+	}
+	if (image->map)
+		return image->map + start;
+	/* Avoid seeking for sequential access, pipes are not seekable. */
+	if (image->pos != start && fseek(image->file, start, SEEK_SET)) {
+		msg_gerr("Error: seeking to 0x%x in the image failed: %s\n", start, strerror(errno));
+		return NULL;
+	}
+	numbytes = fread(buf, 1, len, image->file);
+	image->pos = start + numbytes;
+	if (numbytes != len && !image->seekable) {
+		msg_gerr("Error: Image is smaller than the flash chip's size (%lu B)!\n", image->size);
+		return NULL;
+	}
+	if (numbytes != len) {
+		msg_gerr("Error: Failed to read complete file. Got %zu bytes, "
+			 "wanted %u at 0x%x!\n", numbytes, len, start);
+		return NULL;
+	}
+	return buf;
+#endif
+}
+
+/*
+ * Return a pointer to len bytes of the image at offset start. Mapped images
+ * are used in place, otherwise the data is read (or the test pattern is
+ * generated) into buf. The returned data may be modified, this does not change
+ * the file. Returns NULL on error.
+ */
+static uint8_t *get_image_range(struct image_file *image, uint8_t *buf, unsigned int start,
+				unsigned int len)
+{
+	if (image->testpattern)
+		return generate_testpattern(buf, start, len, image->variant) ? NULL : buf;
+	return read_image_range(image, buf, start, len);
+}
+
+/* Can get_image_range() return data without copying it to a buffer? */
+static bool image_in_place(const struct image_file *image)
+{
+	return image->map && !image->borrowed;
+}
+
+/* A streamed image has to end where the chip ends. Regular files were checked
+ * when opening them. */
+static int check_image_end(struct image_file *image)
+{
+	if (image->seekable || image->writable || image->pos != image->size)
+		return 0;
+	if (fgetc(image->file) != EOF) {
+		msg_gerr("Error: Image is larger than the flash chip's size (%lu B)!\n", image->size);
 		return 1;
 	}
-	if (numbytes != size) {
-		msg_gerr("Error: Failed to read complete file. Got %ld bytes, "
-			 "wanted %ld!\n", numbytes, size);
+	return 0;
+}
+
+/* Return where len bytes at offset start of a writable image have to be stored
+ * before put_image_range() is called: in the mapping or in buf. */
+static uint8_t *image_range_buffer(struct image_file *image, uint8_t *buf, unsigned int start)
+{
+	return image->map ? image->map + start : buf;
+}
+
+static int put_image_range(struct image_file *image, uint8_t *buf, unsigned int start,
+			   unsigned int len)
+{
+	if (image->map)
+		return 0;
+#ifdef __LIBPAYLOAD__
+	return 1;
+#else
+	if ((image->pos != start && fseek(image->file, start, SEEK_SET)) ||
+	    fwrite(buf, 1, len, image->file) != len) {
+		msg_gerr("File %s could not be written completely.\n", image->filename);
+		return 1;
+	}
+	image->pos = start + len;
+	return 0;
+#endif
+}
+
+/* Read the whole image filename into memory for all later open_image_file()
+ * calls. The chip size is not known yet, so it is checked when opening it. */
+int preload_image_file(const char *filename)
+{
+#ifdef __LIBPAYLOAD__
+	msg_gerr("Error: No file I/O support in libpayload\n");
+	return 1;
+#else
+	unsigned long alloc = 0;
+	uint8_t *data = NULL;
+	size_t numbytes;
+	FILE *file;
+
+	if (!strcmp(filename, "-")) {
+		file = stdin;
+#ifdef _WIN32
+		setmode(fileno(file), O_BINARY);
+#endif
+	} else if ((file = fopen(filename, "rb")) == NULL) {
+		msg_gerr("Error: opening file \"%s\" failed: %s\n", filename, strerror(errno));
+		return 1;
+	}
+	preloaded_image.size = 0;
+	do {
+		if (preloaded_image.size == alloc) {
+			alloc = alloc ? alloc * 2 : 1024 * 1024;
+			data = realloc(data, alloc);
+			if (!data) {
+				msg_gerr("Out of memory!\n");
+				exit(1);
+			}
+		}
+		numbytes = fread(data + preloaded_image.size, 1, alloc - preloaded_image.size, file);
+		preloaded_image.size += numbytes;
+	} while (numbytes);
+	if (ferror(file)) {
+		msg_gerr("Error: reading file \"%s\" failed: %s\n", filename, strerror(errno));
+		if (file != stdin)
+			fclose(file);
+		free(data);
 		return 1;
 	}
+	if (file != stdin)
+		fclose(file);
+	preloaded_image.filename = strdup(filename);
+	preloaded_image.data = data;
+	msg_gdbg("Preloaded %lu bytes of image \"%s\".\n", preloaded_image.size, filename);
 	return 0;
 #endif
 }
 
+int read_buf_from_file(unsigned char *buf, unsigned long size,
+		       const char *filename)
+{
+	struct image_file image;
+	uint8_t *data;
+	int ret = 0;
+
+	if (open_image_file(&image, filename, size, false))
+		return 1;
+	data = get_image_range(&image, buf, 0, size);
+	if (!data)
+		ret = 1;
+	else if (data != buf)
+		memcpy(buf, data, size);
+	if (close_image_file(&image))
+		return 1;
+	return ret;
+}
+
 int write_buf_to_file(unsigned char *buf, unsigned long size,
 		      const char *filename)
 {
@@ -1236,38 +1705,92 @@ int write_buf_to_file(unsigned char *buf, unsigned long size,
 #endif
 }
 
-int read_flash_to_file(struct flashctx *flash, const char *filename)
+/* The whole chip is read (and verified) in chunks of this size to keep the
+ * memory use independent of the chip size. */
+#define STREAM_CHUNK_SIZE	(64 * 1024)
+
+/* Read the chip chunk by chunk straight into image, which may be mapped. The
+ * digests of the contents are computed on the way. Without an image (NULL)
+ * only the digests are computed. */
+static int read_flash_to_image(struct flashctx *flash, struct image_file *image)
 {
 	unsigned long size = flash->chip->total_size * 1024;
-	unsigned char *buf = calloc(size, sizeof(char));
-	int ret = 0;
+	unsigned int start, len, chunk = min(size, STREAM_CHUNK_SIZE);
+	struct flash_digest digest;
+	enum perf_phase old_phase;
+	uint8_t *buf = NULL, *dst;
+	int i, ret = 0;
 
 	msg_cinfo("Reading flash... ");
-	if (!buf) {
-		msg_gerr("Memory allocation failed!\n");
+	if (!flash->chip->read) {
+		msg_cerr("No read function available for this flash chip.\n");
 		msg_cinfo("FAILED.\n");
 		return 1;
 	}
-	if (!flash->chip->read) {
-		msg_cerr("No read function available for this flash chip.\n");
-		ret = 1;
-		goto out_free;
+	for (i = 0; i < num_access_restrictions; i++) {
+		if (!access_restrictions[i].read)
+			msg_cwarn("Warning: 0x%06x-0x%06x can not be read and is saved as 0xff.\n",
+				  access_restrictions[i].start, access_restrictions[i].end);
 	}
-	if (flash->chip->read(flash, buf, 0, size)) {
-		msg_cerr("Read operation failed!\n");
-		ret = 1;
-		goto out_free;
+	if (digest_init(&digest, flash, digest_manifest)) {
+		msg_cinfo("FAILED.\n");
+		return 1;
 	}
-
-	ret = write_buf_to_file(buf, size, filename);
-out_free:
-	free(buf);
-	msg_cinfo("%s.\n", ret ? "FAILED" : "done");
-	return ret;
-}
-
-/* This function shares a lot of its structure with erase_and_write_flash() and
- * walk_eraseregions().
+	if (!image || !image->map) {
+		buf = malloc(chunk);
+		if (!buf) {
+			msg_gerr("Memory allocation failed!\n");
+			ret = 1;
+			goto out;
+		}
+	}
+	old_phase = perf_phase(PERF_READ);
+	for (start = 0; start < size; start += len) {
+		len = min(chunk, size - start);
+		dst = image ? image_range_buffer(image, buf, start) : buf;
+		if (read_accessible(flash, dst, start, len)) {
+			msg_cerr("Read operation failed!\n");
+			ret = 1;
+			break;
+		}
+		digest_update(&digest, dst, len);
+		if (image && put_image_range(image, dst, start, len)) {
+			ret = 1;
+			break;
+		}
+	}
+	perf_phase(old_phase);
+out:
+	free(buf);
+	msg_cinfo("%s.\n", ret ? "FAILED" : "done");
+	if (ret)
+		digest_abort(&digest);
+	else if (digest_finish(&digest))
+		ret = 1;
+	else
+		digest_print(&digest);
+	return ret;
+}
+
+int read_flash_to_file(struct flashctx *flash, const char *filename)
+{
+	struct image_file image;
+	int ret;
+
+	if (!filename)
+		return read_flash_to_image(flash, NULL);
+	if (open_image_file(&image, filename, flash->chip->total_size * 1024, true)) {
+		msg_cinfo("Reading flash... FAILED.\n");
+		return 1;
+	}
+	ret = read_flash_to_image(flash, &image);
+	if (close_image_file(&image))
+		ret = 1;
+	return ret;
+}
+
+/* This function shares a lot of its structure with erase_and_write_flash() and
+ * walk_eraseregions().
  * Even if an error is found, the function will keep going and check the rest.
  */
 static int selfcheck_eraseblocks(const struct flashchip *chip)
@@ -1335,32 +1858,132 @@ static int selfcheck_eraseblocks(const struct flashchip *chip)
 	return ret;
 }
 
+/*
+ * The erase/write engine works on one erase block at a time: The current
+ * contents of the block are read from the chip and the wanted contents from the
+ * image file (merged with the current contents according to the layout), so
+ * memory use is bounded by the largest erase block instead of several copies
+ * of the whole chip.
+ */
+/* Time it took to erase/write each block which was not skipped. */
+struct block_stats {
+	struct {
+		unsigned int start;
+		unsigned int len;
+		uint32_t us;
+	} *blocks;
+	unsigned int count;
+	unsigned int alloc;
+};
+
+struct write_state {
+	struct image_file *image;	/* Wanted contents, NULL to erase the chip */
+	struct block_stats *stats;	/* Optional */
+	uint8_t *curcontents;	/* Current contents of the erase block */
+	uint8_t *newcontents;	/* Wanted contents of the erase block */
+	uint8_t *newbuf;	/* Block buffer for newcontents if not mapped */
+	bool verify;		/* Verify each block right after writing it */
+	bool erase_all;		/* Erase every block without reading it first */
+	bool read_failed;	/* Reading the chip failed, contents unknown */
+};
+
+static int read_block_contents(struct flashctx *flash, struct write_state *state,
+			       unsigned int start, unsigned int len)
+{
+	if (state->erase_all) {
+		/* Contents which need an erase whatever the chip holds. */
+		memset(state->curcontents, 0x00, len);
+	} else if (read_accessible(flash, state->curcontents, start, len)) {
+		msg_cerr("Reading flash contents at 0x%06x failed!\n", start);
+		state->read_failed = true;
+		return 1;
+	}
+	if (!state->image) {
+		state->newcontents = state->newbuf;
+		memset(state->newcontents, 0xff, len);
+		return 0;
+	}
+	state->newcontents = get_image_range(state->image, state->newbuf, start, len);
+	if (!state->newcontents)
+		return 1;
+	return build_new_image(flash, state->curcontents, state->newcontents, start, len);
+}
+
+static void add_block_time(struct block_stats *stats, unsigned int start, unsigned int len,
+			   uint32_t us)
+{
+	void *tmp;
+
+	if (stats->count == stats->alloc) {
+		stats->alloc = stats->alloc ? stats->alloc * 2 : 256;
+		tmp = realloc(stats->blocks, stats->alloc * sizeof(*stats->blocks));
+		if (!tmp) {
+			msg_gerr("Out of memory!\n");
+			exit(1);
+		}
+		stats->blocks = tmp;
+	}
+	stats->blocks[stats->count].start = start;
+	stats->blocks[stats->count].len = len;
+	stats->blocks[stats->count].us = us;
+	stats->count++;
+}
+
 static int erase_and_write_block_helper(struct flashctx *flash,
 					unsigned int start, unsigned int len,
-					uint8_t *curcontents,
-					uint8_t *newcontents,
+					void *data,
 					int (*erasefn) (struct flashctx *flash,
 							unsigned int addr,
 							unsigned int len))
 {
+	struct write_state *state = data;
+	uint8_t *curcontents = state->curcontents;
+	uint8_t *newcontents;
 	unsigned int starthere = 0, lenhere = 0;
 	int ret = 0, skip = 1, writecount = 0;
 	enum write_granularity gran = flash->chip->gran;
+	unsigned int window = get_write_window(flash);
+	enum perf_phase old_phase = perf_phase(PERF_PREREAD);
+	uint64_t t = time_us();
 
-	/* curcontents and newcontents are opaque to walk_eraseregions, and
-	 * need to be adjusted here to keep the impression of proper abstraction
-	 */
-	curcontents += start;
-	newcontents += start;
 	msg_cdbg(":");
+	/* Blocks outside of the included regions keep their contents, so they
+	 * are not even read. Streamed images have to be read sequentially. */
+	if (state->image && state->image->seekable && !layout_includes_range(start, len)) {
+		msg_cdbg("S");
+		perf_count_skipped_block();
+		goto out;
+	}
+	/* Committed by an interrupted write with the same journal. */
+	if (journal_block_done(start, len)) {
+		msg_cdbg("J");
+		perf_count_skipped_block();
+		goto out;
+	}
+	/* Locked blocks were checked by check_locked_ranges() already. The
+	 * eraser was chosen so that no block is partly locked. */
+	if (!range_has_writable(start, len)) {
+		msg_cdbg("L");
+		perf_count_skipped_block();
+		goto out;
+	}
+	if (read_block_contents(flash, state, start, len)) {
+		ret = 1;
+		goto out;
+	}
+	newcontents = state->newcontents;
 	if (need_erase(curcontents, newcontents, len, gran)) {
 		msg_cdbg("E");
+		all_skipped = false;
+		perf_phase(PERF_ERASE);
 		ret = erasefn(flash, start, len);
 		if (ret)
-			return ret;
+			goto out;
+		perf_count_erase(len);
 		if (check_erased_range(flash, start, len)) {
 			msg_cerr("ERASE FAILED!\n");
-			return -1;
+			ret = -1;
+			goto out;
 		}
 		/* Erase was successful. Adjust curcontents. */
 		memset(curcontents, 0xff, len);
@@ -1369,21 +1992,36 @@ static int erase_and_write_block_helper(struct flashctx *flash,
 	/* get_next_write() sets starthere to a new value after the call. */
 	while ((lenhere = get_next_write(curcontents + starthere,
 					 newcontents + starthere,
-					 len - starthere, &starthere, gran))) {
+					 len - starthere, start + starthere,
+					 &starthere, gran, window))) {
 		if (!writecount++)
 			msg_cdbg("W");
+		all_skipped = false;
+		perf_phase(PERF_PROGRAM);
 		/* Needs the partial write function signature. */
 		ret = flash->chip->write(flash, newcontents + starthere,
 				   start + starthere, lenhere);
 		if (ret)
-			return ret;
+			goto out;
+		perf_count_write(lenhere);
 		starthere += lenhere;
 		skip = 0;
 	}
-	if (skip)
+	if (skip) {
 		msg_cdbg("S");
-	else
-		all_skipped = false;
+		perf_count_skipped_block();
+	} else if (state->verify || journal_active()) {
+		/* Only verified blocks are committed to the journal. */
+		perf_phase(PERF_VERIFY);
+		if (verify_range(flash, newcontents, start, len))
+			ret = -1;
+	}
+	if (!ret && state->image && journal_commit(start, len))
+		ret = 1;
+	if (!skip && !ret && state->stats)
+		add_block_time(state->stats, start, len, time_us() - t);
+out:
+	perf_phase(old_phase);
 	return ret;
 }
 
@@ -1391,13 +2029,12 @@ static int walk_eraseregions(struct flashctx *flash, int erasefunction,
 			     int (*do_something) (struct flashctx *flash,
 						  unsigned int addr,
 						  unsigned int len,
-						  uint8_t *param1,
-						  uint8_t *param2,
+						  void *data,
 						  int (*erasefn) (
 							struct flashctx *flash,
 							unsigned int addr,
 							unsigned int len)),
-			     void *param1, void *param2)
+			     void *data)
 {
 	int i, j;
 	unsigned int start = 0;
@@ -1415,7 +2052,7 @@ static int walk_eraseregions(struct flashctx *flash, int erasefunction,
 				msg_cdbg(", ");
 			msg_cdbg("0x%06x-0x%06x", start,
 				     start + len - 1);
-			if (do_something(flash, start, len, param1, param2,
+			if (do_something(flash, start, len, data,
 					 eraser.block_erase)) {
 				return 1;
 			}
@@ -1426,6 +2063,19 @@ static int walk_eraseregions(struct flashctx *flash, int erasefunction,
 	return 0;
 }
 
+/* Return the size of the largest block of erase function k. */
+static unsigned int max_eraseblock_size(const struct flashctx *flash, int k)
+{
+	const struct block_eraser *eraser = &flash->chip->block_erasers[k];
+	unsigned int size = 0;
+	int i;
+
+	for (i = 0; i < NUM_ERASEREGIONS; i++)
+		if (eraser->eraseblocks[i].count && eraser->eraseblocks[i].size > size)
+			size = eraser->eraseblocks[i].size;
+	return size;
+}
+
 static int check_block_eraser(const struct flashctx *flash, int k, int log)
 {
 	struct block_eraser eraser = flash->chip->block_erasers[k];
@@ -1451,23 +2101,44 @@ static int check_block_eraser(const struct flashctx *flash, int k, int log)
 	return 0;
 }
 
-int erase_and_write_flash(struct flashctx *flash, uint8_t *oldcontents,
-			  uint8_t *newcontents)
+/* Does erase function k have a block which is partly locked? It would destroy
+ * the locked part, or fail. */
+static bool eraser_splits_locked_ranges(const struct flashctx *flash, int k)
+{
+	const struct block_eraser *eraser = &flash->chip->block_erasers[k];
+	unsigned int start = 0, len;
+	int i, j;
+
+	if (!num_access_restrictions)
+		return false;
+	for (i = 0; i < NUM_ERASEREGIONS; i++) {
+		len = eraser->eraseblocks[i].size;
+		for (j = 0; j < eraser->eraseblocks[i].count; j++, start += len) {
+			if (!range_accessible(start, len) && range_has_writable(start, len))
+				return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Bring the chip to the contents of image (merged with the current contents
+ * according to the layout), or erase it if image is NULL. If verify is set,
+ * every changed block is verified right after writing it. This is needed for
+ * streamed images which can not be read a second time.
+ */
+static int erase_and_write_flash(struct flashctx *flash, struct image_file *image, bool verify,
+				 struct block_stats *stats)
 {
 	int k, ret = 1;
-	uint8_t *curcontents;
-	unsigned long size = flash->chip->total_size * 1024;
+	/* Like before, -E erases every block, even a blank one, without
+	 * reading the chip first. */
+	struct write_state state = { .image = image, .stats = stats, .verify = verify,
+				     .erase_all = !image };
+	unsigned int blocksize;
 	unsigned int usable_erasefunctions = count_usable_erasers(flash);
 
 	msg_cinfo("Erasing and writing flash chip... ");
-	curcontents = malloc(size);
-	if (!curcontents) {
-		msg_gerr("Out of memory!\n");
-		exit(1);
-	}
-	/* Copy oldcontents to curcontents to avoid clobbering oldcontents. */
-	memcpy(curcontents, oldcontents, size);
-
 	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
 		if (k != 0)
 			msg_cdbg("Looking for another erase function.\n");
@@ -1479,22 +2150,31 @@ int erase_and_write_flash(struct flashctx *flash, uint8_t *oldcontents,
 		if (check_block_eraser(flash, k, 1))
 			continue;
 		usable_erasefunctions--;
+		if (eraser_splits_locked_ranges(flash, k)) {
+			msg_cdbg("erase blocks span locked and accessible ranges. ");
+			continue;
+		}
+		blocksize = max_eraseblock_size(flash, k);
+		state.curcontents = malloc(blocksize);
+		/* Mapped images are used in place. */
+		state.newbuf = (image && image_in_place(image)) ? NULL : malloc(blocksize);
+		if (!state.curcontents || (!state.newbuf && !(image && image_in_place(image)))) {
+			msg_gerr("Out of memory!\n");
+			exit(1);
+		}
+		/* Blocks which were written successfully before the failure
+		 * are skipped when walking the chip with the next eraser.
+		 */
 		ret = walk_eraseregions(flash, k, &erase_and_write_block_helper,
-					curcontents, newcontents);
+					&state);
+		free(state.curcontents);
+		free(state.newbuf);
 		/* If everything is OK, don't try another erase function. */
 		if (!ret)
 			break;
-		/* Write/erase failed, so try to find out what the current chip
-		 * contents are. If no usable erase functions remain, we can
-		 * skip this: the next iteration will break immediately anyway.
-		 */
-		if (!usable_erasefunctions)
-			continue;
-		/* Reading the whole chip may take a while, inform the user even
-		 * in non-verbose mode.
-		 */
-		msg_cinfo("Reading current flash chip contents... ");
-		if (flash->chip->read(flash, curcontents, 0, size)) {
+		/* Blocks erased already are found by reading them. */
+		state.erase_all = false;
+		if (state.read_failed) {
 			/* Now we are truly screwed. Read failed as well. */
 			msg_cerr("Can't read anymore! Aborting.\n");
 			/* We have no idea about the flash chip contents, so
@@ -1502,10 +2182,12 @@ int erase_and_write_flash(struct flashctx *flash, uint8_t *oldcontents,
 			 */
 			break;
 		}
-		msg_cinfo("done. ");
+		if (image && !image->seekable) {
+			msg_cerr("Can't retry with another erase function, the image can't "
+				 "be read again.\n");
+			break;
+		}
 	}
-	/* Free the scratchpad. */
-	free(curcontents);
 
 	if (ret) {
 		msg_cerr("FAILED!\n");
@@ -1517,6 +2199,121 @@ int erase_and_write_flash(struct flashctx *flash, uint8_t *oldcontents,
 	return ret;
 }
 
+/* Compare the chip against image (merged according to the layout) in chunks
+ * of STREAM_CHUNK_SIZE bytes. Like compare_range(), only the first mismatch is
+ * printed, followed by the number of mismatching bytes on the whole chip.
+ * The digests of the chip contents are stored in digest unless reading failed
+ * (return value 1). If first_fail is not NULL, it is set to the offset of the
+ * first mismatch. */
+static int verify_flash(struct flashctx *flash, struct image_file *image,
+			struct flash_digest *digest, unsigned int *first_fail)
+{
+	unsigned long size = flash->chip->total_size * 1024;
+	unsigned int start, len, i, pos, next, chunk = min(size, STREAM_CHUNK_SIZE);
+	unsigned int failcount = 0;
+	uint8_t *havebuf, *wantbuf, *want;
+	enum perf_phase old_phase;
+	bool read, write;
+	int ret = 0;
+
+	if (digest_init(digest, flash, digest_manifest))
+		return 1;
+	havebuf = malloc(chunk);
+	wantbuf = image_in_place(image) ? NULL : malloc(chunk);
+	if (!havebuf || (!wantbuf && !image_in_place(image))) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	old_phase = perf_phase(PERF_VERIFY);
+	for (start = 0; start < size; start += len) {
+		len = min(chunk, size - start);
+		if (read_accessible(flash, havebuf, start, len)) {
+			msg_gerr("Verification impossible because read failed "
+				 "at 0x%x (len 0x%x)\n", start, len);
+			ret = 1;
+			break;
+		}
+		digest_update(digest, havebuf, len);
+		want = get_image_range(image, wantbuf, start, len);
+		if (!want || build_new_image(flash, havebuf, want, start, len)) {
+			ret = 1;
+			break;
+		}
+		/* Unreadable ranges, and locked ranges left out on request,
+		 * can not be compared. */
+		for (pos = start; pos < start + len; pos = next) {
+			next = access_piece(pos, start + len, &read, &write);
+			if (!read || (!write && skip_locked))
+				continue;
+			for (i = pos - start; i < next - start; i++) {
+				if (want[i] == havebuf[i])
+					continue;
+				if (failcount++)
+					continue;
+				msg_cerr("FAILED at 0x%08x! Expected=0x%02x, Found=0x%02x,",
+					 start + i, want[i], havebuf[i]);
+				if (first_fail)
+					*first_fail = start + i;
+			}
+		}
+	}
+	perf_phase(old_phase);
+	if (failcount) {
+		msg_cerr(" failed byte count from 0x%08x-0x%08lx: 0x%x\n",
+			 0, size - 1, failcount);
+		if (!ret)
+			ret = -1;
+	}
+	/* The digests describe the chip contents, even if they differ. */
+	if (ret == 1)
+		digest_abort(digest);
+	else if (digest_finish(digest))
+		ret = 1;
+	free(havebuf);
+	free(wantbuf);
+	return ret;
+}
+
+#if CONFIG_INTERNAL == 1
+/* The coreboot image checks need the whole image at once. */
+static int check_internal_image(struct image_file *image, unsigned long size)
+{
+	uint8_t *buf;
+	uint8_t *data;
+	int ret = 0;
+
+	if (!image->seekable) {
+		msg_pinfo("A streamed image can not be checked against the board.\n");
+		if (force_boardmismatch) {
+			msg_pinfo("Proceeding anyway because user forced us to.\n");
+			return 0;
+		}
+		msg_perr("Aborting. You can override this with "
+			 "-p internal:boardmismatch=force.\n");
+		return 1;
+	}
+	buf = image_in_place(image) ? NULL : malloc(size);
+	if (!buf && !image_in_place(image)) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	data = get_image_range(image, buf, 0, size);
+	if (!data) {
+		ret = 1;
+	} else if (cb_check_image(data, size) < 0) {
+		if (force_boardmismatch) {
+			msg_pinfo("Proceeding anyway because user forced us to.\n");
+		} else {
+			msg_perr("Aborting. You can override this with "
+				 "-p internal:boardmismatch=force.\n");
+			ret = 1;
+		}
+	}
+	free(buf);
+	return ret;
+}
+#endif
+
 static void nonfatal_help_message(void)
 {
 	msg_gerr("Writing to the flash chip apparently didn't do anything.\n");
@@ -1899,28 +2696,18 @@ int chip_safety_check(const struct flashctx *flash, int force, int read_it, int
 	return 0;
 }
 
-/* This function signature is horrible. We need to design a better interface,
- * but right now it allows us to split off the CLI code.
- * Besides that, the function itself is a textbook example of abysmal code flow.
- */
-int doit(struct flashctx *flash, int force, const char *filename, int read_it,
-	 int write_it, int erase_it, int verify_it)
+/* Checks and preparations shared by all operations on the chip. */
+static int prepare_flash_access(struct flashctx *flash, int force, int read_it, int write_it,
+				int erase_it, int verify_it)
 {
-	uint8_t *oldcontents;
-	uint8_t *newcontents;
-	int ret = 0;
-	unsigned long size = flash->chip->total_size * 1024;
-
 	if (chip_safety_check(flash, force, read_it, write_it, erase_it, verify_it)) {
 		msg_cerr("Aborting.\n");
-		ret = 1;
-		goto out_nofree;
+		return 1;
 	}
 
 	if (normalize_romentries(flash)) {
 		msg_cerr("Requested regions can not be handled. Aborting.\n");
-		ret = 1;
-		goto out_nofree;
+		return 1;
 	}
 
 	/* Given the existence of read locks, we want to unlock for read,
@@ -1928,32 +2715,151 @@ int doit(struct flashctx *flash, int force, const char *filename, int read_it,
 	 */
 	if (flash->chip->unlock)
 		flash->chip->unlock(flash);
+	return 0;
+}
 
-	if (read_it) {
-		ret = read_flash_to_file(flash, filename);
-		goto out_nofree;
-	}
+/* Does the chip range [start, start + len) hold the contents of image? */
+static int locked_range_matches(struct flashctx *flash, struct image_file *image, unsigned int start,
+				unsigned int len)
+{
+	unsigned int chunk = min(len, STREAM_CHUNK_SIZE), end = start + len, n;
+	uint8_t *havebuf, *wantbuf, *want;
+	int ret = 1;
 
-	oldcontents = malloc(size);
-	if (!oldcontents) {
+	havebuf = malloc(chunk);
+	wantbuf = image_in_place(image) ? NULL : malloc(chunk);
+	if (!havebuf || (!wantbuf && !image_in_place(image))) {
 		msg_gerr("Out of memory!\n");
 		exit(1);
 	}
-	/* Assume worst case: All bits are 0. */
-	memset(oldcontents, 0x00, size);
-	newcontents = malloc(size);
-	if (!newcontents) {
+	for (; start < end && ret == 1; start += n) {
+		n = min(chunk, end - start);
+		if (flash->chip->read(flash, havebuf, start, n)) {
+			msg_cerr("Reading flash contents at 0x%06x failed!\n", start);
+			ret = -1;
+			break;
+		}
+		perf_count_read(n);
+		want = get_image_range(image, wantbuf, start, n);
+		if (!want || build_new_image(flash, havebuf, want, start, n))
+			ret = -1;
+		else if (memcmp(want, havebuf, n))
+			ret = 0;
+	}
+	free(havebuf);
+	free(wantbuf);
+	return ret;
+}
+
+/*
+ * Locked ranges can not be written or erased, so refuse an operation which
+ * would have to change them before the chip is touched. An image which already
+ * matches the chip in a readable locked range is fine. With skip_locked, the
+ * locked ranges are left out instead.
+ */
+static int check_locked_ranges(struct flashctx *flash, struct image_file *image)
+{
+	unsigned long size = flash->chip->total_size * 1024;
+	const struct access_restriction *r;
+	unsigned int end, len;
+	enum perf_phase old_phase;
+	int i, k, ret = 0;
+
+	if (!num_access_restrictions)
+		return 0;
+	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
+		if (!check_block_eraser(flash, k, 0) && !eraser_splits_locked_ranges(flash, k))
+			break;
+	}
+	if (k == NUM_ERASEFUNCTIONS) {
+		msg_cerr("No erase function of this chip can erase around the locked ranges.\n");
+		return 1;
+	}
+	old_phase = perf_phase(PERF_PREREAD);
+	for (i = 0; i < num_access_restrictions; i++) {
+		r = &access_restrictions[i];
+		if (r->write || r->start >= size)
+			continue;
+		end = min(r->end, size - 1);
+		len = end - r->start + 1;
+		/* An erase ignores the layout. */
+		if (image && !layout_includes_range(r->start, len))
+			continue;
+		if (skip_locked) {
+			msg_cinfo("Leaving out the locked range 0x%06x-0x%06x.\n", r->start, end);
+			continue;
+		}
+		if (image && r->read && image->seekable) {
+			switch (locked_range_matches(flash, image, r->start, len)) {
+			case 1:
+				msg_cdbg("The locked range 0x%06x-0x%06x is up to date.\n", r->start, end);
+				continue;
+			case -1:
+				ret = 1;
+				continue;
+			}
+		}
+		msg_cerr("The range 0x%06x-0x%06x is locked and can not be %s.\n", r->start, end,
+			 image ? "written" : "erased");
+		ret = 1;
+	}
+	perf_phase(old_phase);
+	if (ret && image)
+		msg_cerr("Use --skip-locked to leave out the locked ranges, or select other regions "
+			 "with a layout.\n");
+	else if (ret)
+		msg_cerr("Use --skip-locked to leave out the locked ranges.\n");
+	return ret;
+}
+
+/* Start the journal of writing image with the current layout. */
+static int start_journal(struct flashctx *flash, struct image_file *image)
+{
+	unsigned long size = flash->chip->total_size * 1024;
+	unsigned int start, len, chunk = min(size, STREAM_CHUNK_SIZE);
+	uint8_t plan[SHA256_DIGEST_SIZE];
+	struct sha256_ctx ctx;
+	uint8_t *buf, *data;
+	int ret = 0;
+
+	if (!image->seekable) {
+		msg_gerr("Error: A streamed image can not be written with a journal.\n");
+		return 1;
+	}
+	buf = image_in_place(image) ? NULL : malloc(chunk);
+	if (!buf && !image_in_place(image)) {
 		msg_gerr("Out of memory!\n");
 		exit(1);
 	}
-	/* Assume best case: All bits should be 1. */
-	memset(newcontents, 0xff, size);
-	/* Side effect of the assumptions above: Default write action is erase
-	 * because newcontents looks like a completely erased chip, and
-	 * oldcontents being completely 0x00 means we have to erase everything
-	 * before we can write.
-	 */
+	sha256_init(&ctx);
+	for (start = 0; start < size; start += len) {
+		len = min(chunk, size - start);
+		data = get_image_range(image, buf, start, len);
+		if (!data) {
+			ret = 1;
+			break;
+		}
+		sha256_update(&ctx, data, len);
+	}
+	free(buf);
+	if (ret)
+		return 1;
+	layout_hash(&ctx);
+	sha256_final(&ctx, plan);
+	return journal_start(journal_file, flash, plan);
+}
 
+/* Erase the chip, or write and/or verify image, which is already open. */
+static int erase_write_verify(struct flashctx *flash, struct image_file *image, int write_it,
+			      int erase_it, int verify_it)
+{
+	struct flash_digest digest;
+	/* A streamed image can be read only once, so written blocks have to be
+	 * verified while they are still in memory. */
+	bool verify_inline = write_it && verify_it && !image->seekable;
+	int ret = 0;
+
+	all_skipped = true;
 	if (erase_it) {
 		/* FIXME: Do we really want the scary warning if erase failed?
 		 * After all, after erase the chip is either blank or partially
@@ -1961,67 +2867,42 @@ int doit(struct flashctx *flash, int force, const char *filename, int read_it,
 		 * so if the user wanted erase and reboots afterwards, the user
 		 * knows very well that booting won't work.
 		 */
-		if (erase_and_write_flash(flash, oldcontents, newcontents)) {
+		if (check_locked_ranges(flash, NULL))
+			return 1;
+		if (erase_and_write_flash(flash, NULL, false, NULL)) {
 			emergency_help_message();
-			ret = 1;
-		}
-		goto out;
-	}
-
-	if (write_it || verify_it) {
-		if (read_buf_from_file(newcontents, size, filename)) {
-			ret = 1;
-			goto out;
-		}
-
-#if CONFIG_INTERNAL == 1
-		if (programmer == PROGRAMMER_INTERNAL && cb_check_image(newcontents, size) < 0) {
-			if (force_boardmismatch) {
-				msg_pinfo("Proceeding anyway because user forced us to.\n");
-			} else {
-				msg_perr("Aborting. You can override this with "
-					 "-p internal:boardmismatch=force.\n");
-				ret = 1;
-				goto out;
-			}
+			return 1;
 		}
-#endif
+		return 0;
 	}
 
-	/* Read the whole chip to be able to check whether regions need to be
-	 * erased and to give better diagnostics in case write fails.
-	 * The alternative would be to read only the regions which are to be
-	 * preserved, but in that case we might perform unneeded erase which
-	 * takes time as well.
+	/* The image is merged with the current chip contents according to the
+	 * given layout while the chip is walked block by block.
 	 */
-	msg_cinfo("Reading old flash chip contents... ");
-	if (flash->chip->read(flash, oldcontents, 0, size)) {
-		ret = 1;
-		msg_cinfo("FAILED.\n");
-		goto out;
-	}
-	msg_cinfo("done.\n");
-
-	/* Build a new image taking the given layout into account. */
-	build_new_image(flash, oldcontents, newcontents);
-
-	// ////////////////////////////////////////////////////////////
-
 	if (write_it) {
-		if (erase_and_write_flash(flash, oldcontents, newcontents)) {
-			msg_cerr("Uh oh. Erase/write failed. Checking if "
-				 "anything changed.\n");
-			if (!flash->chip->read(flash, newcontents, 0, size)) {
-				if (!memcmp(oldcontents, newcontents, size)) {
-					msg_cinfo("Good. It seems nothing was changed.\n");
-					nonfatal_help_message();
-					ret = 1;
-					goto out;
-				}
+		if (check_locked_ranges(flash, image))
+			return 1;
+		if (journal_file && start_journal(flash, image))
+			return 1;
+		ret = erase_and_write_flash(flash, image, verify_inline, NULL) || check_image_end(image);
+		/* The journal is kept until the write is complete. */
+		journal_finish(!ret);
+		if (ret) {
+			msg_cerr("Uh oh. Erase/write failed.\n");
+			/* Blocks are only erased or written after they were
+			 * found to differ, so all_skipped tells us whether the
+			 * chip was touched at all.
+			 */
+			if (all_skipped) {
+				msg_cinfo("Good. It seems nothing was changed.\n");
+				nonfatal_help_message();
+			} else {
+				emergency_help_message();
 			}
-			emergency_help_message();
-			ret = 1;
-			goto out;
+			if (journal_file)
+				msg_cinfo("Run the same command again to resume the write from journal %s.\n",
+					  journal_file);
+			return 1;
 		}
 	}
 
@@ -2029,26 +2910,260 @@ int doit(struct flashctx *flash, int force, const char *filename, int read_it,
 	if (verify_it && (!write_it || !all_skipped)) {
 		msg_cinfo("Verifying flash... ");
 
-		if (write_it) {
+		if (verify_inline) {
+			/* Already done by erase_and_write_flash(). */
+			ret = 0;
+		} else if (write_it) {
 			/* Work around chips which need some time to calm down. */
 			programmer_delay(1000*1000);
-			ret = verify_range(flash, newcontents, 0, size);
+			ret = verify_flash(flash, image, &digest, NULL);
 			/* If we tried to write, and verification now fails, we
 			 * might have an emergency situation.
 			 */
 			if (ret)
 				emergency_help_message();
 		} else {
-			ret = compare_range(newcontents, oldcontents, 0, size);
+			ret = verify_flash(flash, image, &digest, NULL);
+			if (!ret)
+				ret = check_image_end(image);
 		}
 		if (!ret)
 			msg_cinfo("VERIFIED.\n");
+		if (!verify_inline && ret != 1)
+			digest_print(&digest);
 	}
+	/* Without a read back by verify_flash(), the manifest of the written
+	 * chip needs a read of its own. */
+	if (!ret && write_it && digest_manifest && (all_skipped || verify_inline))
+		ret = read_flash_to_image(flash, NULL);
+	return ret;
+}
+
+/* This function signature is horrible. We need to design a better interface,
+ * but right now it allows us to split off the CLI code.
+ */
+int doit(struct flashctx *flash, int force, const char *filename, int read_it,
+	 int write_it, int erase_it, int verify_it)
+{
+	struct image_file image_file;
+	struct image_file *image = NULL;
+	int ret = 0;
+	unsigned long size = flash->chip->total_size * 1024;
+
+	if (prepare_flash_access(flash, force, read_it, write_it, erase_it, verify_it)) {
+		ret = 1;
+		goto out;
+	}
+
+	if (read_it) {
+		ret = read_flash_to_file(flash, filename);
+		goto out;
+	}
+
+	if (write_it || verify_it) {
+		if (open_image_file(&image_file, filename, size, false)) {
+			ret = 1;
+			goto out;
+		}
+		image = &image_file;
+
+#if CONFIG_INTERNAL == 1
+		if (programmer == PROGRAMMER_INTERNAL && check_internal_image(image, size)) {
+			ret = 1;
+			goto out;
+		}
+#endif
+	}
+	ret = erase_write_verify(flash, image, write_it, erase_it, verify_it);
 
 out:
-	free(oldcontents);
-	free(newcontents);
-out_nofree:
+	if (image)
+		close_image_file(image);
 	programmer_shutdown();
 	return ret;
 }
+
+/* Like doit(), but with the image in buf, which has the size of the chip, and
+ * without shutting down the programmer. */
+int doit_buffer(struct flashctx *flash, int force, uint8_t *buf, int read_it,
+		int write_it, int erase_it, int verify_it)
+{
+	struct image_file image;
+	unsigned long size = flash->chip->total_size * 1024;
+
+	if (prepare_flash_access(flash, force, read_it, write_it, erase_it, verify_it))
+		return 1;
+	open_buffer_image(&image, buf, size, read_it);
+	if (read_it)
+		return read_flash_to_image(flash, &image);
+#if CONFIG_INTERNAL == 1
+	if ((write_it || verify_it) && programmer == PROGRAMMER_INTERNAL &&
+	    check_internal_image(&image, size))
+		return 1;
+#endif
+	return erase_write_verify(flash, &image, write_it, erase_it, verify_it);
+}
+
+/* Parse a list like "0,3,8-11" or "all" into selected. */
+static int parse_testpatterns(const char *patterns, bool *selected)
+{
+	const char *p = patterns;
+	char *end;
+	long first, last, i;
+
+	memset(selected, 0, NUM_TESTPATTERNS * sizeof(*selected));
+	if (!strcmp(patterns, "all")) {
+		for (i = 0; i < NUM_TESTPATTERNS; i++)
+			selected[i] = true;
+		return 0;
+	}
+	while (*p) {
+		first = last = strtol(p, &end, 10);
+		if (end != p && *end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+		}
+		if (end == p || (*end && *end != ',') || first < 0 || last >= NUM_TESTPATTERNS ||
+		    first > last) {
+			msg_gerr("Error: Invalid test pattern list \"%s\", use numbers from 0 to %i "
+				 "or \"all\".\n", patterns, NUM_TESTPATTERNS - 1);
+			return 1;
+		}
+		for (i = first; i <= last; i++)
+			selected[i] = true;
+		p = *end ? end + 1 : end;
+	}
+	return 0;
+}
+
+static double stress_kb_per_s(uint64_t bytes, uint64_t us)
+{
+	return us ? bytes * 1000000.0 / 1024 / us : 0;
+}
+
+/* Print blocks which took much longer than the median per byte. */
+#define STRESS_OUTLIER_FACTOR	4
+#define STRESS_OUTLIER_MIN_US	100
+#define STRESS_OUTLIERS_PRINTED	5
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned int report_block_outliers(const struct block_stats *stats)
+{
+	double *per_byte, median;
+	unsigned int i, outliers = 0;
+
+	if (!stats->count)
+		return 0;
+	per_byte = malloc(stats->count * sizeof(*per_byte));
+	if (!per_byte) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	for (i = 0; i < stats->count; i++)
+		per_byte[i] = (double)stats->blocks[i].us / stats->blocks[i].len;
+	qsort(per_byte, stats->count, sizeof(*per_byte), compare_double);
+	median = per_byte[stats->count / 2];
+	free(per_byte);
+	for (i = 0; i < stats->count; i++) {
+		if (stats->blocks[i].us < STRESS_OUTLIER_MIN_US ||
+		    stats->blocks[i].us <= STRESS_OUTLIER_FACTOR * median * stats->blocks[i].len)
+			continue;
+		if (outliers++ < STRESS_OUTLIERS_PRINTED)
+			msg_cinfo("  Slow block 0x%06x-0x%06x: %u us (median %.0f us)\n",
+				  stats->blocks[i].start,
+				  stats->blocks[i].start + stats->blocks[i].len - 1, stats->blocks[i].us,
+				  median * stats->blocks[i].len);
+	}
+	if (outliers > STRESS_OUTLIERS_PRINTED)
+		msg_cinfo("  %u more slow blocks.\n", outliers - STRESS_OUTLIERS_PRINTED);
+	return outliers;
+}
+
+/*
+ * Write each selected test pattern to the chip (or the regions included in the
+ * layout) and verify it. The whole contents are overwritten, so this refuses
+ * to run on anything but the dummy programmer unless forced.
+ */
+int stress_flash(struct flashctx *flash, int force, const char *patterns)
+{
+	static const enum perf_phase phases[] = { PERF_PREREAD, PERF_ERASE, PERF_PROGRAM, PERF_VERIFY };
+	static const char *const phase_names[] = { "pre-read", "erase", "program", "verify" };
+	unsigned long size = flash->chip->total_size * 1024;
+	struct perf_totals before[ARRAY_SIZE(phases)], after;
+	struct block_stats stats = { .blocks = NULL };
+	bool selected[NUM_TESTPATTERNS];
+	struct flash_digest digest;
+	struct image_file image;
+	unsigned int first_fail, i, tested = 0, failed = 0;
+	bool emulated = false;
+	uint64_t bytes;
+	int variant, ret;
+
+	if (parse_testpatterns(patterns, selected))
+		return 1;
+#if CONFIG_DUMMY == 1
+	emulated = programmer == PROGRAMMER_DUMMY;
+#endif
+	if (!emulated && !force) {
+		msg_cerr("The stress test overwrites the chip contents. Use --force to run it on "
+			 "real hardware.\n");
+		return 1;
+	}
+	if (chip_safety_check(flash, force, 0, 1, 1, 1)) {
+		msg_cerr("Aborting.\n");
+		return 1;
+	}
+	if (normalize_romentries(flash)) {
+		msg_cerr("Requested regions can not be handled. Aborting.\n");
+		return 1;
+	}
+	if (flash->chip->unlock)
+		flash->chip->unlock(flash);
+
+	for (variant = 0; variant < NUM_TESTPATTERNS; variant++) {
+		if (!selected[variant])
+			continue;
+		tested++;
+		msg_cinfo("Test pattern %i:\n", variant);
+		open_pattern_image(&image, size, variant);
+		for (i = 0; i < ARRAY_SIZE(phases); i++)
+			perf_get_totals(phases[i], &before[i]);
+		stats.count = 0;
+		all_skipped = true;
+		if (erase_and_write_flash(flash, &image, false, &stats)) {
+			msg_cerr("Erase/write failed, stopping the test.\n");
+			failed++;
+			break;
+		}
+		msg_cinfo("Verifying flash... ");
+		ret = verify_flash(flash, &image, &digest, &first_fail);
+		if (!ret)
+			msg_cinfo("VERIFIED.\n");
+		else if (ret == -1)
+			msg_cinfo("  First mismatch at 0x%06x.\n", first_fail);
+		if (ret)
+			failed++;
+		for (i = 0; i < ARRAY_SIZE(phases); i++) {
+			perf_get_totals(phases[i], &after);
+			bytes = after.bytes_read - before[i].bytes_read;
+			if (phases[i] == PERF_ERASE)
+				bytes = after.bytes_erased - before[i].bytes_erased;
+			else if (phases[i] == PERF_PROGRAM)
+				bytes = after.bytes_written - before[i].bytes_written;
+			msg_cinfo("  %-8s %10llu bytes %8llu us %10.1f kB/s\n", phase_names[i],
+				  (unsigned long long)bytes,
+				  (unsigned long long)(after.wall_us - before[i].wall_us),
+				  stress_kb_per_s(bytes, after.wall_us - before[i].wall_us));
+		}
+		report_block_outliers(&stats);
+	}
+	free(stats.blocks);
+	msg_cinfo("Stress test: %u of %u test patterns failed.\n", failed, tested);
+	return failed != 0;
+}
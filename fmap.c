@@ -0,0 +1,136 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Flash maps (FMAP) as used by coreboot and Chromium OS: a header with the
+ * signature "__FMAP__" somewhere in the image, followed by a list of named
+ * areas. All fields are little endian and not aligned.
+ */
+
+#include <string.h>
+#include "flash.h"
+
+#define FMAP_SIGNATURE		"__FMAP__"
+#define FMAP_SIGNATURE_LEN	8
+#define FMAP_VER_MAJOR		1
+#define FMAP_STRLEN		32
+
+/* Offsets in the header: signature, major and minor version, 64 bit base,
+ * 32 bit size, name and 16 bit number of areas. */
+#define FMAP_HDR_VER_MAJOR	8
+#define FMAP_HDR_NAME		22
+#define FMAP_HDR_NAREAS		54
+#define FMAP_HDR_LEN		56
+
+/* Offsets in an area: 32 bit offset, 32 bit size, name and 16 bit flags. */
+#define FMAP_AREA_OFFSET	0
+#define FMAP_AREA_SIZE		4
+#define FMAP_AREA_NAME		8
+#define FMAP_AREA_LEN		42
+
+/* The header is placed at least at this alignment by all known tools. */
+#define FMAP_MIN_ALIGN		4
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Returns the number of areas of a plausible header at offset, or -1. */
+static int fmap_check_header(const uint8_t *buf, size_t len, size_t offset)
+{
+	const uint8_t *hdr = buf + offset;
+	int nareas;
+
+	if (offset + FMAP_HDR_LEN > len || memcmp(hdr, FMAP_SIGNATURE, FMAP_SIGNATURE_LEN))
+		return -1;
+	if (hdr[FMAP_HDR_VER_MAJOR] != FMAP_VER_MAJOR)
+		return -1;
+	if (!memchr(hdr + FMAP_HDR_NAME, '\0', FMAP_STRLEN))
+		return -1;
+	nareas = get_le16(hdr + FMAP_HDR_NAREAS);
+	if (offset + FMAP_HDR_LEN + (size_t)nareas * FMAP_AREA_LEN > len)
+		return -1;
+	return nareas;
+}
+
+/*
+ * Find the FMAP header in buf. The signature is only compared at aligned
+ * offsets, coarse ones first: an FMAP usually starts a large aligned region,
+ * so it is found after a few compares in most images, and even the finest pass
+ * is a fraction of a byte by byte search. Every offset is checked only once.
+ */
+static long fmap_find(const uint8_t *buf, size_t len)
+{
+	size_t first, stride, offset;
+
+	for (first = FMAP_MIN_ALIGN; first * 2 < len; first <<= 1)
+		;
+	/* After the first pass, only the odd multiples of stride are new. */
+	for (stride = first; stride >= FMAP_MIN_ALIGN; stride >>= 1) {
+		offset = stride == first ? 0 : stride;
+		for (; offset + FMAP_HDR_LEN <= len; offset += stride == first ? stride : stride * 2) {
+			if (fmap_check_header(buf, len, offset) >= 0)
+				return offset;
+		}
+	}
+	return -1;
+}
+
+/* Add the areas of the FMAP in buf, the image of the whole chip, to the
+ * layout. */
+int layout_from_fmap(const uint8_t *buf, size_t len)
+{
+	const uint8_t *area;
+	char name[FMAP_STRLEN + 1];
+	uint32_t start, size;
+	long offset;
+	int i, nareas;
+
+	offset = fmap_find(buf, len);
+	if (offset < 0) {
+		msg_gerr("Error: No flash map (FMAP) found in the image.\n");
+		return 1;
+	}
+	nareas = fmap_check_header(buf, len, offset);
+	msg_gdbg("Found FMAP \"%s\" with %i areas at 0x%08lx.\n",
+		 (const char *)buf + offset + FMAP_HDR_NAME, nareas, offset);
+	for (i = 0; i < nareas; i++) {
+		area = buf + offset + FMAP_HDR_LEN + i * FMAP_AREA_LEN;
+		start = get_le32(area + FMAP_AREA_OFFSET);
+		size = get_le32(area + FMAP_AREA_SIZE);
+		memcpy(name, area + FMAP_AREA_NAME, FMAP_STRLEN);
+		name[FMAP_STRLEN] = '\0';
+		/* Empty areas can not be selected anyway. */
+		if (!size)
+			continue;
+		if (start >= len || size > len - start) {
+			msg_gerr("Error: FMAP area \"%s\" at 0x%08x-0x%08x is outside of the image.\n",
+				 name, start, start + size - 1);
+			return 1;
+		}
+		msg_gdbg("FMAP area %08x - %08x named %s\n", start, start + size - 1, name);
+		if (add_romentry(start, start + size - 1, name))
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Gang programming: Run the same operation with several programmers at once.
+ * Programmer drivers and the core keep their state in globals, so every
+ * programmer gets a worker process of its own. Workers inherit the delay loop
+ * calibration and a preloaded image from the parent, which collects their
+ * output line by line, prefixed with the device number, and reports the
+ * result of every device at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "flash.h"
+#include "programmer.h"
+
+#if !defined(_WIN32) && !defined(__DJGPP__) && !defined(__LIBPAYLOAD__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define GANG_LINE_MAX 1024
+
+struct gang_worker {
+	pid_t pid;
+	int fd;			/* Read end of the output pipe, -1 after EOF */
+	char line[GANG_LINE_MAX];
+	size_t len;
+	uint64_t start_us;
+	uint64_t end_us;
+	int status;
+};
+
+static void gang_flush_line(struct gang_worker *w, int device)
+{
+	if (!w->len)
+		return;
+	msg_ginfo("[%i] %.*s\n", device, (int)w->len, w->line);
+	w->len = 0;
+}
+
+/* Pass the output of worker w on, one complete line at a time. Returns 0 at
+ * EOF. */
+static int gang_read_output(struct gang_worker *w, int device)
+{
+	char buf[256];
+	ssize_t n, i;
+
+	n = read(w->fd, buf, sizeof(buf));
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return 1;
+	if (n <= 0) {
+		gang_flush_line(w, device);
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		if (buf[i] == '\n') {
+			gang_flush_line(w, device);
+			continue;
+		}
+		w->line[w->len++] = buf[i];
+		if (w->len == sizeof(w->line))
+			gang_flush_line(w, device);
+	}
+	return 1;
+}
+
+/* Collect the output of all workers until they are done. */
+static void gang_collect(struct gang_worker *workers, int count)
+{
+	struct pollfd *fds;
+	int i, n, running = count;
+
+	fds = malloc(count * sizeof(*fds));
+	if (!fds) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	while (running) {
+		for (i = 0, n = 0; i < count; i++) {
+			if (workers[i].fd < 0)
+				continue;
+			fds[n].fd = workers[i].fd;
+			fds[n].events = POLLIN;
+			fds[n].revents = 0;
+			n++;
+		}
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			msg_gerr("Error: waiting for gang workers failed: %s\n", strerror(errno));
+			break;
+		}
+		for (i = 0, n = 0; i < count; i++) {
+			if (workers[i].fd < 0)
+				continue;
+			if (fds[n++].revents && !gang_read_output(&workers[i], i)) {
+				close(workers[i].fd);
+				workers[i].fd = -1;
+				workers[i].end_us = time_us();
+				running--;
+			}
+		}
+	}
+	free(fds);
+}
+
+/*
+ * Start a worker process for each of the count programmer specs. In the worker
+ * for device n, n is returned and all output goes to the parent. The parent
+ * waits for all workers, prints their results, sets *ret to 0 if all of them
+ * succeeded and returns -1.
+ */
+int gang_fork(char *const *specs, int count, int *ret)
+{
+	struct gang_worker *workers;
+	int pipefd[2];
+	int i, j, failed = 0;
+
+	workers = calloc(count, sizeof(*workers));
+	if (!workers) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	msg_ginfo("Starting %i gang workers.\n", count);
+	/* Do not let the workers print what is still buffered here. */
+	fflush(NULL);
+	for (i = 0; i < count; i++) {
+		if (pipe(pipefd)) {
+			msg_gerr("Error: creating a pipe failed: %s\n", strerror(errno));
+			break;
+		}
+		workers[i].start_us = time_us();
+		workers[i].pid = fork();
+		if (workers[i].pid < 0) {
+			msg_gerr("Error: starting gang worker %i failed: %s\n", i, strerror(errno));
+			close(pipefd[0]);
+			close(pipefd[1]);
+			break;
+		}
+		if (!workers[i].pid) {
+			for (j = 0; j < i; j++)
+				close(workers[j].fd);
+			close(pipefd[0]);
+			dup2(pipefd[1], STDOUT_FILENO);
+			dup2(pipefd[1], STDERR_FILENO);
+			close(pipefd[1]);
+			free(workers);
+			return i;
+		}
+		close(pipefd[1]);
+		workers[i].fd = pipefd[0];
+	}
+	/* Workers which could not be started count as failed. */
+	for (j = i; j < count; j++) {
+		workers[j].fd = -1;
+		workers[j].status = -1;
+	}
+	gang_collect(workers, i);
+
+	for (j = 0; j < i; j++) {
+		while (waitpid(workers[j].pid, &workers[j].status, 0) < 0 && errno == EINTR)
+			;
+		if (!workers[j].end_us)
+			workers[j].end_us = time_us();
+	}
+	msg_ginfo("Gang results:\n");
+	for (j = 0; j < count; j++) {
+		if (j >= i) {
+			msg_ginfo("[%i] %s: NOT STARTED\n", j, specs[j]);
+		} else if (WIFEXITED(workers[j].status) && !WEXITSTATUS(workers[j].status)) {
+			msg_ginfo("[%i] %s: OK (%.2f s)\n", j, specs[j],
+				  (workers[j].end_us - workers[j].start_us) / 1000000.0);
+			continue;
+		} else if (WIFEXITED(workers[j].status)) {
+			msg_ginfo("[%i] %s: FAILED with exit code %i (%.2f s)\n", j, specs[j],
+				  WEXITSTATUS(workers[j].status),
+				  (workers[j].end_us - workers[j].start_us) / 1000000.0);
+		} else {
+			msg_ginfo("[%i] %s: FAILED by signal %i\n", j, specs[j],
+				  WIFSIGNALED(workers[j].status) ? WTERMSIG(workers[j].status) : 0);
+		}
+		failed++;
+	}
+	msg_ginfo("%i of %i devices failed.\n", failed, count);
+	free(workers);
+	*ret = failed ? 1 : 0;
+	return -1;
+}
+
+#else
+
+int gang_fork(char *const *specs, int count, int *ret)
+{
+	msg_gerr("Error: Gang programming is not supported on this platform.\n");
+	*ret = 1;
+	return -1;
+}
+
+#endif
@@ -1419,6 +1419,8 @@ static int ich_spi_send_multicommand(struct flashctx *flash,
 		}
 		ret = ich_spi_send_command(flash, cmds->writecnt, cmds->readcnt,
 					   cmds->writearr, cmds->readarr);
+		if (!ret && cmds->delay_us)
+			programmer_delay(cmds->delay_us);
 		/* Reset the type of all opcodes to non-atomic. */
 		for (i = 0; i < 8; i++)
 			curopcodes->opcode[i].atomic = 0;
@@ -1431,8 +1433,9 @@ static int ich_spi_send_multicommand(struct flashctx *flash,
 #define ICH_BRWA(x)  ((x >>  8) & 0xff)
 #define ICH_BRRA(x)  ((x >>  0) & 0xff)
 
-/* returns 0 if region is unused or r/w */
-static int ich9_handle_frap(uint32_t frap, int i)
+/* returns 0 if region is unused or r/w. Restricted regions are registered
+ * with the core unless force is set. */
+static int ich9_handle_frap(uint32_t frap, int i, int force)
 {
 	static const char *const access_names[4] = {
 		"locked", "read-only", "write-only", "read-write"
@@ -1466,6 +1469,8 @@ static int ich9_handle_frap(uint32_t frap, int i)
 	msg_pwarn("FREG%i: Warning: %s region (0x%08x-0x%08x) is %s.\n", i,
 		  region_names[i], base, (limit | 0x0fff),
 		  access_names[rwperms]);
+	if (!force)
+		register_access_restriction(base, limit | 0x0fff, rwperms & 1, rwperms & 2);
 	return 1;
 }
 
@@ -1478,8 +1483,9 @@ static int ich9_handle_frap(uint32_t frap, int i)
 #define ICH_PR_PERMS(pr)	(((~((pr) >> PR_RP_OFF) & 1) << 0) | \
 				 ((~((pr) >> PR_WP_OFF) & 1) << 1))
 
-/* returns 0 if range is unused (i.e. r/w) */
-static int ich9_handle_pr(int i)
+/* returns 0 if range is unused (i.e. r/w). Restricted ranges are registered
+ * with the core unless force is set. */
+static int ich9_handle_pr(int i, int force)
 {
 	static const char *const access_names[3] = {
 		"locked", "read-only", "write-only"
@@ -1496,6 +1502,9 @@ static int ich9_handle_pr(int i)
 	msg_pdbg("0x%02X: 0x%08x ", off, pr);
 	msg_pwarn("PR%u: Warning: 0x%08x-0x%08x is %s.\n", i, ICH_FREG_BASE(pr),
 		  ICH_FREG_LIMIT(pr) | 0x0fff, access_names[rwperms]);
+	if (!force)
+		register_access_restriction(ICH_FREG_BASE(pr), ICH_FREG_LIMIT(pr) | 0x0fff,
+					    rwperms & 1, rwperms & 2);
 	return 1;
 }
 
@@ -1681,7 +1690,7 @@ int ich_init_spi(struct pci_dev *dev, void *spibar, enum ich_chipset ich_gen)
 
 			/* Handle FREGx and FRAP registers */
 			for (i = 0; i < 5; i++)
-				ich_spi_rw_restricted |= ich9_handle_frap(tmp, i);
+				ich_spi_rw_restricted |= ich9_handle_frap(tmp, i, ich_spi_force);
 			if (ich_spi_rw_restricted)
 				msg_pwarn("Not all flash regions are freely accessible by flashrom. This is "
 					  "most likely\ndue to an active ME. Please see http://flashrom.org/ME "
@@ -1693,19 +1702,19 @@ int ich_init_spi(struct pci_dev *dev, void *spibar, enum ich_chipset ich_gen)
 			/* if not locked down try to disable PR locks first */
 			if (!ichspi_lock)
 				ich9_set_pr(i, 0, 0);
-			ich_spi_rw_restricted |= ich9_handle_pr(i);
+			ich_spi_rw_restricted |= ich9_handle_pr(i, ich_spi_force);
 		}
 
-		if (ich_spi_rw_restricted) {
-			if (!ich_spi_force)
-				programmer_may_write = 0;
-			msg_pinfo("Writes have been disabled for safety reasons. You can enforce write\n"
-				  "support with the ich_spi_force programmer option, but you will most likely\n"
-				  "harm your hardware! If you force flashrom you will get no support if\n"
-				  "something breaks. On a few mainboards it is possible to enable write\n"
-				  "access by setting a jumper (see its documentation or the board itself).\n");
-			if (ich_spi_force)
-				msg_pinfo("Continuing with write support because the user forced us to!\n");
+		/* The restricted ranges were registered above, so writes which
+		 * would need them are refused before the chip is touched. */
+		if (ich_spi_rw_restricted && !ich_spi_force) {
+			msg_pinfo("Writes and erases are limited to the accessible ranges. Images which\n"
+				  "differ from the chip in a locked range are refused unless --skip-locked\n"
+				  "is given. On a few mainboards it is possible to enable full access by\n"
+				  "setting a jumper (see its documentation or the board itself).\n");
+		} else if (ich_spi_rw_restricted) {
+			msg_pinfo("Ignoring the locked ranges because the user forced us to! You will most\n"
+				  "likely harm your hardware and get no support if something breaks.\n");
 		}
 
 		tmp = mmio_readl(ich_spibar + ICH9_REG_SSFS);
@@ -22,7 +22,11 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 #include "flash.h"
+#include "programmer.h"
 
 #define MAX_REFLASH_TRIES 0x10
 #define MASK_FULL 0xffff
@@ -37,30 +41,137 @@ uint8_t oddparity(uint8_t val)
 	return (val ^ (val >> 1)) & 0x1;
 }
 
-static void toggle_ready_jedec_common(const struct flashctx *flash,
-				      chipaddr dst, int delay)
+/* Generic worst case operation times for chips without timing information. */
+#define JEDEC_PROGRAM_TIMEOUT_US	(100 * 1000)
+/* Old parts need up to 8 s per 64 kB sector, be generous. */
+#define JEDEC_ERASE_TIMEOUT_US(len)	(10 * 1000 * 1000 + (len) / 64 * 10 * 1000)
+#define JEDEC_DEFAULT_MAX_FACTOR	10
+/* Upper bound for the polling interval while waiting for a program. */
+#define JEDEC_PROGRAM_POLL_MAX_US	64
+#define JEDEC_MAX_POLL_BATCH		63
+
+/* Worst case time for an operation with the given typical duration. */
+static unsigned int jedec_timeout(const struct flashchip *chip,
+				  unsigned int typical, unsigned int fallback)
 {
-	unsigned int i = 0;
+	unsigned int factor = JEDEC_DEFAULT_MAX_FACTOR;
+
+	if (!typical)
+		return fallback;
+	if (chip->timing.max_factor)
+		factor = chip->timing.max_factor;
+	if (typical > UINT_MAX / factor)
+		return UINT_MAX;
+	return typical * factor;
+}
+
+/* Typical time to erase a block of blocklen bytes, 0 if unknown. */
+static unsigned int jedec_erase_time(const struct flashchip *chip,
+				     unsigned int blocklen)
+{
+	int k, i;
+
+	for (k = 0; k < NUM_ERASEFUNCTIONS; k++) {
+		if (!chip->timing.erase[k])
+			continue;
+		for (i = 0; i < NUM_ERASEREGIONS; i++) {
+			if (chip->block_erasers[k].eraseblocks[i].size == blocklen)
+				return chip->timing.erase[k];
+		}
+	}
+	return 0;
+}
+
+/* Read the toggle bit at dst. If batch is at least 2, that many reads are
+ * issued back-to-back with a single chip_readn and the toggle bit of the last
+ * one is returned. Since batch is odd, a bit which is still toggling differs
+ * between the last reads of two consecutive batches (same address).
+ */
+static uint8_t read_toggle_bit(const struct flashctx *flash, chipaddr dst,
+			       unsigned int batch)
+{
+	uint8_t buf[JEDEC_MAX_POLL_BATCH];
+	chipaddr end = flash->virtual_memory + flash->chip->total_size * 1024;
+
+	if (batch < 2)
+		return chip_readb(flash, dst) & 0x40;
+	/* Any address of the chip shows the toggle bit, stay within it. */
+	if (dst + batch > end)
+		dst = end - batch;
+	chip_readn(flash, buf, dst, batch);
+	return buf[batch - 1] & 0x40;
+}
+
+/* Poll the toggle bit until it stops toggling or timeout_us have passed.
+ * The first interval between reads is min_us, and it doubles after every
+ * unsuccessful read up to max_us. Without a minimum interval, reads may be
+ * batched if the programmer supports it.
+ */
+static int toggle_ready_jedec_common(const struct flashctx *flash, chipaddr dst,
+				     unsigned int min_us, unsigned int max_us,
+				     unsigned int timeout_us)
+{
+	unsigned int interval = min_us;
+	unsigned int batch = 0;
+	uint64_t start, now;
 	uint8_t tmp1, tmp2;
 
-	tmp1 = chip_readb(flash, dst) & 0x40;
+	if (!min_us && flash->pgm->par.poll_readn > 1) {
+		batch = min(flash->pgm->par.poll_readn, JEDEC_MAX_POLL_BATCH);
+		batch = min(batch, flash->chip->total_size * 1024);
+		if (!(batch & 1))
+			batch--;
+	}
 
-	while (i++ < 0xFFFFFFF) {
-		if (delay)
-			programmer_delay(delay);
-		tmp2 = chip_readb(flash, dst) & 0x40;
-		if (tmp1 == tmp2) {
+	start = time_us();
+	tmp1 = read_toggle_bit(flash, dst, batch);
+	while (1) {
+		if (interval)
+			programmer_delay(interval);
+		/* Only give up after a read which started past the deadline. */
+		now = time_us();
+		perf_count_status_poll();
+		tmp2 = read_toggle_bit(flash, dst, batch);
+		if (tmp1 == tmp2)
+			return 0;
+		if (now - start >= timeout_us)
 			break;
-		}
 		tmp1 = tmp2;
+		interval = min(max(interval * 2, 1), max_us);
 	}
-	if (i > 0x100000)
-		msg_cdbg("%s: excessive loops, i=0x%x\n", __func__, i);
+	msg_cerr("%s: chip still busy after %u us, giving up.\n", __func__,
+		 timeout_us);
+	return TIMEOUT_ERROR;
+}
+
+/* Wait for completion of a byte/word program operation. */
+int toggle_ready_jedec(const struct flashctx *flash, chipaddr dst)
+{
+	return toggle_ready_jedec_common(flash, dst, 0, JEDEC_PROGRAM_POLL_MAX_US,
+			jedec_timeout(flash->chip, flash->chip->timing.byte_program,
+				      JEDEC_PROGRAM_TIMEOUT_US));
+}
+
+/* Wait for completion of a page program operation. */
+static int toggle_ready_jedec_page(const struct flashctx *flash, chipaddr dst)
+{
+	return toggle_ready_jedec_common(flash, dst, 0, JEDEC_PROGRAM_POLL_MAX_US,
+			jedec_timeout(flash->chip, flash->chip->timing.page_program,
+				      JEDEC_PROGRAM_TIMEOUT_US));
 }
 
-void toggle_ready_jedec(const struct flashctx *flash, chipaddr dst)
+/* Wait for completion of an erase of blocklen bytes. Polling starts tight
+ * and backs off to a quarter of the typical erase time (or 10 ms).
+ */
+int toggle_ready_jedec_erase(const struct flashctx *flash, chipaddr dst,
+			     unsigned int blocklen)
 {
-	toggle_ready_jedec_common(flash, dst, 0);
+	unsigned int typical = jedec_erase_time(flash->chip, blocklen);
+	unsigned int max_us = typical ? max(typical / 4, 1) : 10 * 1000;
+
+	return toggle_ready_jedec_common(flash, dst, 0, min(max_us, 100 * 1000),
+			jedec_timeout(flash->chip, typical,
+				      JEDEC_ERASE_TIMEOUT_US(blocklen)));
 }
 
 /* Some chips require a minimum delay between toggle bit reads.
@@ -68,29 +179,46 @@ void toggle_ready_jedec(const struct flashctx *flash, chipaddr dst)
  * but experiments show that 2 ms are already enough. Pick a safety factor
  * of 4 and use an 8 ms delay.
  * Given that erase is slow on all chips, it is recommended to use 
- * toggle_ready_jedec_slow in erase functions.
+ * toggle_ready_jedec_slow in erase functions. The interval backs off from
+ * there to a quarter of the typical erase time.
  */
-static void toggle_ready_jedec_slow(const struct flashctx *flash, chipaddr dst)
+static int toggle_ready_jedec_slow(const struct flashctx *flash, chipaddr dst,
+				   unsigned int blocklen)
 {
-	toggle_ready_jedec_common(flash, dst, 8 * 1000);
+	unsigned int typical = jedec_erase_time(flash->chip, blocklen);
+	unsigned int max_us = typical ? typical / 4 : 32 * 1000;
+
+	max_us = min(max(max_us, 8 * 1000), 100 * 1000);
+	return toggle_ready_jedec_common(flash, dst, 8 * 1000, max_us,
+			jedec_timeout(flash->chip, typical,
+				      JEDEC_ERASE_TIMEOUT_US(blocklen)));
 }
 
-void data_polling_jedec(const struct flashctx *flash, chipaddr dst,
-			uint8_t data)
+int data_polling_jedec(const struct flashctx *flash, chipaddr dst,
+		       uint8_t data)
 {
-	unsigned int i = 0;
-	uint8_t tmp;
+	unsigned int interval = 0;
+	unsigned int timeout_us = jedec_timeout(flash->chip,
+						flash->chip->timing.byte_program,
+						JEDEC_PROGRAM_TIMEOUT_US);
+	uint64_t start, now;
 
 	data &= 0x80;
 
-	while (i++ < 0xFFFFFFF) {
-		tmp = chip_readb(flash, dst) & 0x80;
-		if (tmp == data) {
+	start = time_us();
+	while (1) {
+		now = time_us();
+		perf_count_status_poll();
+		if ((chip_readb(flash, dst) & 0x80) == data)
+			return 0;
+		if (now - start >= timeout_us)
 			break;
-		}
+		programmer_delay(interval);
+		interval = min(max(interval * 2, 1), JEDEC_PROGRAM_POLL_MAX_US);
 	}
-	if (i > 0x100000)
-		msg_cdbg("%s: excessive loops, i=0x%x\n", __func__, i);
+	msg_cerr("%s: data polling timed out after %u us.\n", __func__,
+		 timeout_us);
+	return TIMEOUT_ERROR;
 }
 
 static unsigned int getaddrmask(const struct flashchip *chip)
@@ -265,10 +393,8 @@ static int erase_sector_jedec_common(struct flashctx *flash, unsigned int page,
 	programmer_delay(delay_us);
 
 	/* wait for Toggle bit ready         */
-	toggle_ready_jedec_slow(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_slow(flash, bios, pagesize);
 }
 
 static int erase_block_jedec_common(struct flashctx *flash, unsigned int block,
@@ -295,10 +421,8 @@ static int erase_block_jedec_common(struct flashctx *flash, unsigned int block,
 	programmer_delay(delay_us);
 
 	/* wait for Toggle bit ready         */
-	toggle_ready_jedec_slow(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_slow(flash, bios, blocksize);
 }
 
 static int erase_chip_jedec_common(struct flashctx *flash, unsigned int mask)
@@ -323,10 +447,9 @@ static int erase_chip_jedec_common(struct flashctx *flash, unsigned int mask)
 	chip_writeb(flash, 0x10, bios + (0x5555 & mask));
 	programmer_delay(delay_us);
 
-	toggle_ready_jedec_slow(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_slow(flash, bios,
+				       flash->chip->total_size * 1024);
 }
 
 static int write_byte_program_jedec_common(struct flashctx *flash, uint8_t *src,
@@ -346,7 +469,8 @@ retry:
 
 	/* transfer data from source to destination */
 	chip_writeb(flash, *src, dst);
-	toggle_ready_jedec(flash, bios);
+	if (toggle_ready_jedec(flash, bios))
+		return 1;
 
 	if (chip_readb(flash, dst) != *src && tried++ < MAX_REFLASH_TRIES) {
 		goto retry;
@@ -381,19 +505,16 @@ int write_jedec_1(struct flashctx *flash, uint8_t *src, unsigned int start,
 	return failed;
 }
 
+/* Program one page without verifying it, see write_jedec. */
 static int write_page_write_jedec_common(struct flashctx *flash, uint8_t *src,
 					 unsigned int start, unsigned int page_size)
 {
-	int i, tried = 0, failed;
-	uint8_t *s = src;
-	chipaddr bios = flash->virtual_memory;
-	chipaddr dst = bios + start;
-	chipaddr d = dst;
+	int i;
+	chipaddr dst = flash->virtual_memory + start;
 	unsigned int mask;
 
 	mask = getaddrmask(flash->chip);
 
-retry:
 	/* Issue JEDEC Start Program command */
 	start_program_jedec_common(flash, mask);
 
@@ -406,20 +527,7 @@ retry:
 		src++;
 	}
 
-	toggle_ready_jedec(flash, dst - 1);
-
-	dst = d;
-	src = s;
-	failed = verify_range(flash, src, start, page_size);
-
-	if (failed && tried++ < MAX_REFLASH_TRIES) {
-		msg_cerr("retrying.\n");
-		goto retry;
-	}
-	if (failed) {
-		msg_cerr(" page 0x%" PRIxPTR " failed!\n", (d - bios) / page_size);
-	}
-	return failed;
+	return toggle_ready_jedec_page(flash, dst - 1);
 }
 
 /* chunksize is page_size */
@@ -428,18 +536,26 @@ retry:
  * FIXME: Use the chunk code from Michael Karcher instead.
  * This function is a slightly modified copy of spi_write_chunked.
  * Each page is written separately in chunks with a maximum size of chunksize.
+ * Instead of reading back every page right after programming it, the whole
+ * range (which never exceeds one erase block) is verified with a single read
+ * afterwards and only the pages which did not verify are programmed again,
+ * at most MAX_REFLASH_TRIES times.
  */
 int write_jedec(struct flashctx *flash, uint8_t *buf, unsigned int start,
 		int unsigned len)
 {
 	unsigned int i, starthere, lenhere;
-	/* FIXME: page_size is the wrong variable. We need max_writechunk_size
-	 * in struct flashctx to do this properly. All chips using
-	 * write_jedec have page_size set to max_writechunk_size, so
-	 * we're OK for now.
-	 */
-	unsigned int page_size = flash->chip->page_size;
+	int tried = 0, failed = 0;
+	uint8_t *readbuf;
+	const unsigned int page_size = flash_writechunk_size(flash);
+
+	readbuf = malloc(len);
+	if (!readbuf) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
 
+retry:
 	/* Warning: This loop has a very unusual condition and body.
 	 * The loop needs to go through each page with at least one affected
 	 * byte. The lowest page number is (start / page_size) since that
@@ -456,11 +572,36 @@ int write_jedec(struct flashctx *flash, uint8_t *buf, unsigned int start,
 		/* Length of bytes in the range in this page. */
 		lenhere = min(start + len, (i + 1) * page_size) - starthere;
 
-		if (write_page_write_jedec_common(flash, buf + starthere - start, starthere, lenhere))
-			return 1;
+		/* On retries, skip the pages which verified fine. */
+		if (tried && !memcmp(readbuf + starthere - start,
+				     buf + starthere - start, lenhere))
+			continue;
+		if (write_page_write_jedec_common(flash, buf + starthere - start, starthere, lenhere)) {
+			msg_cerr(" page 0x%x failed!\n", i);
+			failed = 1;
+			goto out;
+		}
 	}
 
-	return 0;
+	if (flash->chip->read(flash, readbuf, start, len)) {
+		failed = 1;
+		goto out;
+	}
+	if (memcmp(readbuf, buf, len)) {
+		if (tried++ < MAX_REFLASH_TRIES) {
+			msg_cerr("retrying.\n");
+			goto retry;
+		}
+		for (i = 0; i < len; i++) {
+			if (readbuf[i] != buf[i])
+				break;
+		}
+		msg_cerr(" page 0x%x failed!\n", (start + i) / page_size);
+		failed = 1;
+	}
+out:
+	free(readbuf);
+	return failed;
 }
 
 /* erase chip with block_erase() prototype */
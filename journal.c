@@ -0,0 +1,265 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Write journal: A text file which identifies a write (chip and a digest of
+ * the image and the layout) and lists every erase block which was verified to
+ * hold its new contents:
+ *
+ *   # flashrom write journal
+ *   chip <size> <vendor> <name>
+ *   plan <sha256>
+ *   done 0x<start> 0x<len>
+ *
+ * An interrupted write with the same plan skips the listed blocks without even
+ * reading them. The journal is removed after the write is complete.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if !defined(_WIN32) && !defined(__LIBPAYLOAD__)
+#include <unistd.h>
+#endif
+#include "flash.h"
+
+#define JOURNAL_MAGIC	"# flashrom write journal\n"
+
+/* A range of committed blocks [start, end]. */
+struct journal_range {
+	unsigned int start;
+	unsigned int end;
+};
+
+static FILE *journal;
+static const char *journal_name;
+/* Committed blocks, sorted and merged. */
+static struct journal_range *committed;
+static int num_committed;
+static int max_committed;
+
+/* Return the index of the first committed range which ends at or after addr,
+ * num_committed if there is none. */
+static int find_committed(unsigned int addr)
+{
+	int lo = 0, hi = num_committed, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (committed[mid].end < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int add_committed(unsigned int start, unsigned int len)
+{
+	unsigned int end = start + len - 1;
+	struct journal_range *tmp;
+	int i, j;
+
+	i = find_committed(start ? start - 1 : 0);
+	/* Merge with every range which overlaps or touches [start, end]. */
+	for (j = i; j < num_committed && (uint64_t)committed[j].start <= (uint64_t)end + 1; j++) {
+		if (committed[j].start < start)
+			start = committed[j].start;
+		if (committed[j].end > end)
+			end = committed[j].end;
+	}
+	if (j == i) {
+		if (num_committed == max_committed) {
+			max_committed = max_committed ? max_committed * 2 : 64;
+			tmp = realloc(committed, max_committed * sizeof(*committed));
+			if (!tmp) {
+				msg_gerr("Out of memory!\n");
+				return 1;
+			}
+			committed = tmp;
+		}
+		memmove(committed + i + 1, committed + i, (num_committed - i) * sizeof(*committed));
+		num_committed++;
+	} else if (j > i + 1) {
+		memmove(committed + i + 1, committed + j, (num_committed - j) * sizeof(*committed));
+		num_committed -= j - i - 1;
+	}
+	committed[i].start = start;
+	committed[i].end = end;
+	return 0;
+}
+
+bool journal_active(void)
+{
+	return journal != NULL;
+}
+
+/* Was the block [start, start + len) committed by this or an interrupted run? */
+bool journal_block_done(unsigned int start, unsigned int len)
+{
+	int i;
+
+	if (!journal || !len)
+		return false;
+	i = find_committed(start);
+	return i < num_committed && committed[i].start <= start &&
+	       (uint64_t)committed[i].end >= (uint64_t)start + len - 1;
+}
+
+static void journal_free(void)
+{
+	free(committed);
+	committed = NULL;
+	num_committed = 0;
+	max_committed = 0;
+}
+
+#ifndef __LIBPAYLOAD__
+/* Make everything written to the journal survive a power loss. */
+static int journal_sync(void)
+{
+	if (fflush(journal))
+		goto fail;
+#if !defined(_WIN32)
+	if (fsync(fileno(journal)))
+		goto fail;
+#endif
+	return 0;
+fail:
+	msg_gerr("Error: writing journal \"%s\" failed: %s\n", journal_name, strerror(errno));
+	return 1;
+}
+
+/* Read the committed blocks of an interrupted write with the same header.
+ * Returns 1 if the journal belongs to this write. */
+static int journal_load(const char *filename, const char *header)
+{
+	char line[128];
+	size_t len = strlen(header), pos = 0, n;
+	unsigned int start, blocklen;
+	uint64_t bytes = 0;
+	char end;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f)
+		return 0;
+	/* The header has to match exactly. */
+	while (pos < len && fgets(line, sizeof(line), f)) {
+		n = strlen(line);
+		if (n > len - pos || memcmp(line, header + pos, n))
+			break;
+		pos += n;
+	}
+	if (pos < len) {
+		fclose(f);
+		msg_cinfo("Journal %s belongs to another write, starting over.\n", filename);
+		return 0;
+	}
+	/* A line torn by the interruption is not complete and is ignored. */
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "done 0x%x 0x%x%c", &start, &blocklen, &end) != 3 || end != '\n' ||
+		    !blocklen)
+			continue;
+		if (add_committed(start, blocklen))
+			break;
+		bytes += blocklen;
+	}
+	fclose(f);
+	msg_cinfo("Resuming the write from journal %s, %llu bytes are done already.\n", filename,
+		  (unsigned long long)bytes);
+	return 1;
+}
+
+/*
+ * Start journaling the write of plan, a digest of the image and the layout, to
+ * filename. If filename holds the journal of an interrupted write of the same
+ * plan to the same chip, its committed blocks are skipped.
+ */
+int journal_start(const char *filename, const struct flashctx *flash,
+		  const uint8_t plan[SHA256_DIGEST_SIZE])
+{
+	char header[512];
+	int i, len, resume;
+
+	len = snprintf(header, sizeof(header), JOURNAL_MAGIC "chip %u %s %s\nplan ",
+		       flash->chip->total_size * 1024, flash->chip->vendor, flash->chip->name);
+	for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+		len += snprintf(header + len, sizeof(header) - len, "%02x", plan[i]);
+	snprintf(header + len, sizeof(header) - len, "\n");
+
+	journal_free();
+	resume = journal_load(filename, header);
+	journal = fopen(filename, resume ? "a" : "w");
+	if (!journal) {
+		msg_gerr("Error: opening journal \"%s\" failed: %s\n", filename, strerror(errno));
+		journal_free();
+		return 1;
+	}
+	journal_name = filename;
+	/* A torn last line is finished by an empty one. */
+	if (fputs(resume ? "\n" : header, journal) == EOF || journal_sync()) {
+		journal_finish(false);
+		return 1;
+	}
+	return 0;
+}
+
+/* Record that the block [start, start + len) holds its new contents. */
+int journal_commit(unsigned int start, unsigned int len)
+{
+	if (!journal || journal_block_done(start, len))
+		return 0;
+	if (add_committed(start, len))
+		return 1;
+	fprintf(journal, "done 0x%08x 0x%x\n", start, len);
+	return journal_sync();
+}
+
+/* Stop journaling. The journal of a finished write is removed. */
+void journal_finish(bool finished)
+{
+	if (!journal)
+		return;
+	fclose(journal);
+	journal = NULL;
+	if (finished && remove(journal_name))
+		msg_gwarn("Warning: removing journal \"%s\" failed: %s\n", journal_name,
+			  strerror(errno));
+	journal_free();
+}
+
+#else
+
+int journal_start(const char *filename, const struct flashctx *flash,
+		  const uint8_t plan[SHA256_DIGEST_SIZE])
+{
+	msg_gerr("Error: No file I/O support in libpayload\n");
+	return 1;
+}
+
+int journal_commit(unsigned int start, unsigned int len)
+{
+	return 0;
+}
+
+void journal_finish(bool finished)
+{
+}
+
+#endif
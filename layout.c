@@ -22,34 +22,205 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <limits.h>
+#include <ctype.h>
+#include <errno.h>
 #include "flash.h"
 #include "programmer.h"
 
-#define MAX_ROMLAYOUT	32
-
 typedef struct {
 	chipoff_t start;
 	chipoff_t end;
 	unsigned int included;
-	char name[256];
+	char *name;
 } romentry_t;
 
+/* An address range [start, end] of the chip. */
+struct layout_range {
+	chipoff_t start;
+	chipoff_t end;
+};
+
 /* rom_entries store the entries specified in a layout file and associated run-time data */
-static romentry_t rom_entries[MAX_ROMLAYOUT];
+static romentry_t *rom_entries = NULL;
 static int num_rom_entries = 0; /* the number of successfully parsed rom_entries */
+static int max_rom_entries = 0;
 
 /* include_args holds the arguments specified at the command line with -i. They must be processed at some point
  * so that desired regions are marked as "included" in the rom_entries list. */
-static char *include_args[MAX_ROMLAYOUT];
+static char **include_args = NULL;
 static int num_include_args = 0; /* the number of valid include_args. */
+static int max_include_args = 0;
+
+/* The union of all included entries, sorted and without overlaps, built once
+ * by process_include_args() for the lookups while reading and writing. */
+static struct layout_range *included_ranges = NULL;
+static int num_included_ranges = 0;
+
+/* Make room for one more element in the array *list of *count elements with
+ * room for *max. */
+static int grow_array(void **list, int count, int *max, size_t size)
+{
+	void *tmp;
+	int newmax;
+
+	if (count < *max)
+		return 0;
+	newmax = *max ? *max * 2 : 16;
+	tmp = realloc(*list, newmax * size);
+	if (!tmp) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	*list = tmp;
+	*max = newmax;
+	return 0;
+}
+
+/* returns the index of the entry (or a negative value if it is not found) */
+static int find_romentry(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_rom_entries; i++) {
+		if (!strcmp(rom_entries[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+/* Add a region as if it was read from a layout file. */
+int add_romentry(chipoff_t start, chipoff_t end, const char *name)
+{
+	char *tmp;
+
+	if (find_romentry(name) >= 0) {
+		msg_gerr("Duplicate region name: \"%s\".\n", name);
+		return 1;
+	}
+	tmp = strdup(name);
+	if (!tmp || grow_array((void **)&rom_entries, num_rom_entries, &max_rom_entries,
+			       sizeof(*rom_entries))) {
+		if (!tmp)
+			msg_gerr("Out of memory!\n");
+		free(tmp);
+		return 1;
+	}
+	rom_entries[num_rom_entries].start = start;
+	rom_entries[num_rom_entries].end = end;
+	rom_entries[num_rom_entries].included = 0;
+	rom_entries[num_rom_entries].name = tmp;
+	num_rom_entries++;
+	return 0;
+}
+
+/* Signature of the Intel flash descriptor at offset 0x10, or at 0 on old
+ * chipsets. */
+#define IFD_SIGNATURE	0x0ff0a55a
+#define IFD_MAX_REGIONS	5
+
+static uint32_t ifd_read32(const uint8_t *buf, size_t offset)
+{
+	return buf[offset] | buf[offset + 1] << 8 | buf[offset + 2] << 16 |
+	       (uint32_t)buf[offset + 3] << 24;
+}
+
+/* Add the regions of the Intel flash descriptor in buf, the image of the
+ * whole chip, to the layout. Unused regions are left out. */
+int layout_from_ifd(const uint8_t *buf, size_t len)
+{
+	static const char *const region_names[IFD_MAX_REGIONS] = {
+		"FD", "BIOS", "ME", "GbE", "PD"
+	};
+	uint32_t flmap0, flreg, base, limit;
+	size_t sig, frba;
+	int i;
+
+	if (len >= 0x20 && ifd_read32(buf, 0x10) == IFD_SIGNATURE)
+		sig = 0x10;
+	else if (len >= 0x10 && ifd_read32(buf, 0) == IFD_SIGNATURE)
+		sig = 0;
+	else {
+		msg_gerr("Error: No Intel flash descriptor found in the image.\n");
+		return 1;
+	}
+	flmap0 = ifd_read32(buf, sig + 4);
+	frba = (flmap0 >> 12) & 0xff0;
+	if (frba + IFD_MAX_REGIONS * 4 > len) {
+		msg_gerr("Error: The flash descriptor regions are outside of the image.\n");
+		return 1;
+	}
+	for (i = 0; i < IFD_MAX_REGIONS; i++) {
+		flreg = ifd_read32(buf, frba + i * 4);
+		base = (flreg << 12) & 0x01fff000;
+		limit = ((flreg >> 4) & 0x01fff000) | 0xfff;
+		if (base > limit)
+			continue;
+		if (limit >= len) {
+			msg_gerr("Error: Flash descriptor region \"%s\" at 0x%08x-0x%08x is outside "
+				 "of the image.\n", region_names[i], base, limit);
+			return 1;
+		}
+		msg_gdbg("Flash descriptor region %08x - %08x named %s\n", base, limit,
+			 region_names[i]);
+		if (add_romentry(base, limit, region_names[i]))
+			return 1;
+	}
+	return 0;
+}
 
 #ifndef __LIBPAYLOAD__
+/* Parse one line of a layout file: "start:end name" with hexadecimal offsets.
+ * Returns 1 for an entry, 0 for an empty line and -1 on errors. */
+static int parse_layout_line(char *line, chipoff_t *start, chipoff_t *end, char **name)
+{
+	unsigned long long val[2];
+	char *pos, *next;
+	int i;
+
+	/* Everything after # is a comment. */
+	pos = strchr(line, '#');
+	if (pos)
+		*pos = '\0';
+	for (pos = line; isspace((unsigned char)*pos); pos++)
+		;
+	if (!*pos)
+		return 0;
+
+	for (i = 0; i < 2; i++) {
+		val[i] = strtoull(pos, &next, 16);
+		if (next == pos || val[i] > FL_MAX_CHIPADDR)
+			return -1;
+		pos = next;
+		if (i == 0 && *pos++ != ':')
+			return -1;
+	}
+	if (!isspace((unsigned char)*pos))
+		return -1;
+	while (isspace((unsigned char)*pos))
+		pos++;
+	*name = pos;
+	while (*pos && !isspace((unsigned char)*pos))
+		pos++;
+	if (*pos) {
+		*pos++ = '\0';
+		while (isspace((unsigned char)*pos))
+			pos++;
+	}
+	/* Names can not contain spaces. */
+	if (!**name || *pos)
+		return -1;
+	*start = val[0];
+	*end = val[1];
+	return 1;
+}
+
 int read_romlayout(char *name)
 {
 	FILE *romlayout;
-	char tempstr[256];
-	int i;
+	char *line = NULL, *tmp, *regname;
+	size_t linesize = 256, len;
+	chipoff_t start, end;
+	int i, lineno = 0, ret = 0;
 
 	romlayout = fopen(name, "r");
 
@@ -59,33 +230,51 @@ int read_romlayout(char *name)
 		return -1;
 	}
 
-	while (!feof(romlayout)) {
-		char *tstr1, *tstr2;
-
-		if (num_rom_entries >= MAX_ROMLAYOUT) {
-			msg_gerr("Maximum number of ROM images (%i) in layout "
-				 "file reached.\n", MAX_ROMLAYOUT);
-			return 1;
+	line = malloc(linesize);
+	if (!line) {
+		msg_gerr("Out of memory!\n");
+		fclose(romlayout);
+		return 1;
+	}
+	len = 0;
+	while (1) {
+		if (!fgets(line + len, linesize - len, romlayout)) {
+			/* The buffer may have grown for a last line without a
+			 * newline, which is still pending. */
+			if (!len)
+				break;
+		} else {
+			len += strlen(line + len);
+			/* Lines can be arbitrarily long, e.g. with long region
+			 * names. */
+			if (len == linesize - 1 && line[len - 1] != '\n') {
+				tmp = realloc(line, linesize * 2);
+				if (!tmp) {
+					msg_gerr("Out of memory!\n");
+					ret = 1;
+					goto out;
+				}
+				line = tmp;
+				linesize *= 2;
+				continue;
+			}
 		}
-		if (2 != fscanf(romlayout, "%s %s\n", tempstr, rom_entries[num_rom_entries].name))
-			continue;
-#if 0
-		// fscanf does not like arbitrary comments like that :( later
-		if (tempstr[0] == '#') {
+		len = 0;
+		lineno++;
+		switch (parse_layout_line(line, &start, &end, &regname)) {
+		case 0:
 			continue;
+		case 1:
+			break;
+		default:
+			msg_gerr("Error parsing layout file %s in line %i.\n", name, lineno);
+			ret = 1;
+			goto out;
 		}
-#endif
-		tstr1 = strtok(tempstr, ":");
-		tstr2 = strtok(NULL, ":");
-		if (!tstr1 || !tstr2) {
-			msg_gerr("Error parsing layout file. Offending string: \"%s\"\n", tempstr);
-			fclose(romlayout);
-			return 1;
+		if (add_romentry(start, end, regname)) {
+			ret = 1;
+			goto out;
 		}
-		rom_entries[num_rom_entries].start = strtol(tstr1, (char **)NULL, 16);
-		rom_entries[num_rom_entries].end = strtol(tstr2, (char **)NULL, 16);
-		rom_entries[num_rom_entries].included = 0;
-		num_rom_entries++;
 	}
 
 	for (i = 0; i < num_rom_entries; i++) {
@@ -94,9 +283,49 @@ int read_romlayout(char *name)
 			     rom_entries[i].end, rom_entries[i].name);
 	}
 
+out:
+	free(line);
 	fclose(romlayout);
 
-	return 0;
+	return ret;
+}
+
+/* Take the layout from the flash map or the Intel flash descriptor in the
+ * image file filename. */
+int read_image_layout(const char *filename, bool fmap)
+{
+	FILE *image;
+	uint8_t *buf;
+	long size;
+	int ret;
+
+	image = fopen(filename, "rb");
+	if (!image) {
+		msg_gerr("Error: opening file \"%s\" failed: %s\n", filename, strerror(errno));
+		return 1;
+	}
+	if (fseek(image, 0, SEEK_END) || (size = ftell(image)) < 0 || fseek(image, 0, SEEK_SET)) {
+		msg_gerr("Error: getting the size of \"%s\" failed: %s\n", filename, strerror(errno));
+		fclose(image);
+		return 1;
+	}
+	buf = malloc(size ? size : 1);
+	if (!buf) {
+		msg_gerr("Out of memory!\n");
+		fclose(image);
+		return 1;
+	}
+	if (fread(buf, 1, size, image) != (size_t)size) {
+		msg_gerr("Error: reading \"%s\" failed.\n", filename);
+		ret = 1;
+	} else if (fmap) {
+		ret = layout_from_fmap(buf, size);
+	} else {
+		ret = layout_from_ifd(buf, size);
+	}
+	free(buf);
+	fclose(image);
+	return ret;
 }
 #endif
 
@@ -114,11 +343,6 @@ int find_include_arg(const char *const name)
 /* register an include argument (-i) for later processing */
 int register_include_arg(char *name)
 {
-	if (num_include_args >= MAX_ROMLAYOUT) {
-		msg_gerr("Too many regions included (%i).\n", num_include_args);
-		return 1;
-	}
-
 	if (name == NULL) {
 		msg_gerr("<NULL> is a bad region name.\n");
 		return 1;
@@ -129,29 +353,56 @@ int register_include_arg(char *name)
 		return 1;
 	}
 
+	if (grow_array((void **)&include_args, num_include_args, &max_include_args,
+		       sizeof(*include_args)))
+		return 1;
 	include_args[num_include_args] = name;
 	num_include_args++;
 	return 0;
 }
 
-/* returns the index of the entry (or a negative value if it is not found) */
-static int find_romentry(char *name)
+static int compare_ranges(const void *a, const void *b)
 {
-	int i;
+	const struct layout_range *ra = a, *rb = b;
 
-	if (num_rom_entries == 0)
-		return -1;
+	if (ra->start != rb->start)
+		return ra->start < rb->start ? -1 : 1;
+	return 0;
+}
+
+/* Build the union of all included entries. Overlapping and adjacent entries
+ * are merged, so every address is in at most one range. */
+static int build_included_ranges(void)
+{
+	int i, n = 0;
 
-	msg_gspew("Looking for region \"%s\"... ", name);
+	free(included_ranges);
+	num_included_ranges = 0;
+	included_ranges = malloc(num_rom_entries * sizeof(*included_ranges));
+	if (!included_ranges) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
 	for (i = 0; i < num_rom_entries; i++) {
-		if (!strcmp(rom_entries[i].name, name)) {
-			rom_entries[i].included = 1;
-			msg_gspew("found.\n");
-			return i;
+		/* Invalid entries are rejected by normalize_romentries(). */
+		if (!rom_entries[i].included || rom_entries[i].start > rom_entries[i].end)
+			continue;
+		included_ranges[n].start = rom_entries[i].start;
+		included_ranges[n].end = rom_entries[i].end;
+		n++;
+	}
+	qsort(included_ranges, n, sizeof(*included_ranges), compare_ranges);
+	for (i = 0; i < n; i++) {
+		if (num_included_ranges &&
+		    (uint64_t)included_ranges[num_included_ranges - 1].end + 1 >= included_ranges[i].start) {
+			if (included_ranges[i].end > included_ranges[num_included_ranges - 1].end)
+				included_ranges[num_included_ranges - 1].end = included_ranges[i].end;
+			continue;
 		}
+		included_ranges[num_included_ranges++] = included_ranges[i];
 	}
-	msg_gspew("not found.\n");
-	return -1;
+	msg_gspew("%i included regions in %i ranges.\n", n, num_included_ranges);
+	return 0;
 }
 
 /* process -i arguments
@@ -159,8 +410,7 @@ static int find_romentry(char *name)
  */
 int process_include_args(void)
 {
-	int i;
-	unsigned int found = 0;
+	int i, entry;
 
 	if (num_include_args == 0)
 		return 0;
@@ -174,12 +424,16 @@ int process_include_args(void)
 	}
 
 	for (i = 0; i < num_include_args; i++) {
-		if (find_romentry(include_args[i]) < 0) {
+		msg_gspew("Looking for region \"%s\"... ", include_args[i]);
+		entry = find_romentry(include_args[i]);
+		if (entry < 0) {
+			msg_gspew("not found.\n");
 			msg_gerr("Invalid region specified: \"%s\".\n",
 				 include_args[i]);
 			return 1;
 		}
-		found++;
+		msg_gspew("found.\n");
+		rom_entries[entry].included = 1;
 	}
 
 	msg_ginfo("Using region%s: \"%s\"", num_include_args > 1 ? "s" : "",
@@ -187,10 +441,11 @@ int process_include_args(void)
 	for (i = 1; i < num_include_args; i++)
 		msg_ginfo(", \"%s\"", include_args[i]);
 	msg_ginfo(".\n");
-	return 0;
+	return build_included_ranges();
 }
 
-void layout_cleanup(void)
+/* Forget the -i arguments but keep the layout. */
+void clear_include_args(void)
 {
 	int i;
 	for (i = 0; i < num_include_args; i++) {
@@ -202,34 +457,74 @@ void layout_cleanup(void)
 	for (i = 0; i < num_rom_entries; i++) {
 		rom_entries[i].included = 0;
 	}
+	free(included_ranges);
+	included_ranges = NULL;
+	num_included_ranges = 0;
+}
+
+void layout_cleanup(void)
+{
+	int i;
+
+	clear_include_args();
+	free(include_args);
+	include_args = NULL;
+	max_include_args = 0;
+
+	for (i = 0; i < num_rom_entries; i++)
+		free(rom_entries[i].name);
+	free(rom_entries);
+	rom_entries = NULL;
 	num_rom_entries = 0;
+	max_rom_entries = 0;
 }
 
-romentry_t *get_next_included_romentry(unsigned int start)
+/* Return the index of the first included range which ends at or after addr,
+ * num_included_ranges if there is none. */
+static int find_included_range(chipoff_t addr)
+{
+	int lo = 0, hi = num_included_ranges, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (included_ranges[mid].end < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Is any byte of the chip range [start, start + len) to be taken from the new
+ * image? Without included regions, the whole chip is. */
+bool layout_includes_range(unsigned int start, unsigned int len)
 {
 	int i;
-	unsigned int best_start = UINT_MAX;
-	romentry_t *best_entry = NULL;
-	romentry_t *cur;
 
-	/* First come, first serve for overlapping regions. */
-	for (i = 0; i < num_rom_entries; i++) {
-		cur = &rom_entries[i];
-		if (!cur->included)
-			continue;
-		/* Already past the current entry? */
-		if (start > cur->end)
-			continue;
-		/* Inside the current entry? */
-		if (start >= cur->start)
-			return cur;
-		/* Entry begins after start. */
-		if (best_start > cur->start) {
-			best_start = cur->start;
-			best_entry = cur;
+	if (num_include_args == 0)
+		return true;
+	if (!len)
+		return false;
+	i = find_included_range(start);
+	return i < num_included_ranges && included_ranges[i].start <= start + len - 1;
+}
+
+/* Feed the included ranges to ctx, so that writes with different layouts can
+ * be told apart. */
+void layout_hash(struct sha256_ctx *ctx)
+{
+	uint8_t buf[8];
+	int i, j;
+
+	if (num_include_args == 0)
+		return;
+	for (i = 0; i < num_included_ranges; i++) {
+		for (j = 0; j < 4; j++) {
+			buf[j] = included_ranges[i].start >> (j * 8);
+			buf[j + 4] = included_ranges[i].end >> (j * 8);
 		}
+		sha256_update(ctx, buf, sizeof(buf));
 	}
-	return best_entry;
 }
 
 /* Validate and - if needed - normalize layout entries. */
@@ -256,11 +551,16 @@ int normalize_romentries(const struct flashctx *flash)
 	return ret;
 }
 
-int build_new_image(const struct flashctx *flash, uint8_t *oldcontents, uint8_t *newcontents)
+/*
+ * Merge the old contents of the chip range [start, start + len) into the new
+ * image: Only the union of all included romentries is taken from the new
+ * image. oldcontents and newcontents hold just that range.
+ */
+int build_new_image(const struct flashctx *flash, uint8_t *oldcontents, uint8_t *newcontents,
+		    unsigned int start, unsigned int len)
 {
-	unsigned int start = 0;
-	romentry_t *entry;
-	unsigned int size = flash->chip->total_size * 1024;
+	uint64_t pos = start, end = (uint64_t)start + len;
+	int i;
 
 	/* If no regions were specified for inclusion, assume
 	 * that the user wants to write the complete new image.
@@ -268,26 +568,15 @@ int build_new_image(const struct flashctx *flash, uint8_t *oldcontents, uint8_t
 	if (num_include_args == 0)
 		return 0;
 
-	/* Non-included romentries are ignored.
-	 * The union of all included romentries is used from the new image.
-	 */
-	while (start < size) {
-		entry = get_next_included_romentry(start);
-		/* No more romentries for remaining region? */
-		if (!entry) {
-			memcpy(newcontents + start, oldcontents + start,
-			       size - start);
-			break;
+	/* Everything between the included ranges comes from the old contents. */
+	for (i = find_included_range(start); i < num_included_ranges && pos < end; i++) {
+		if (included_ranges[i].start > pos) {
+			memcpy(newcontents + pos - start, oldcontents + pos - start,
+			       (included_ranges[i].start < end ? included_ranges[i].start : end) - pos);
 		}
-		/* For non-included region, copy from old content. */
-		if (entry->start > start)
-			memcpy(newcontents + start, oldcontents + start,
-			       entry->start - start);
-		/* Skip to location after current romentry. */
-		start = entry->end + 1;
-		/* Catch overflow. */
-		if (!start)
-			break;
+		pos = (uint64_t)included_ranges[i].end + 1;
 	}
+	if (pos < end)
+		memcpy(newcontents + pos - start, oldcontents + pos - start, end - pos);
 	return 0;
 }
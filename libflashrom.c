@@ -0,0 +1,531 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Context based library interface on top of the flashrom core. The core and
+ * the programmer drivers are not reentrant, so the core is owned by at most
+ * one initialized programmer. Other threads wait for it in
+ * flashrom_programmer_init(). Layouts are kept by the caller and installed in
+ * the core only for the duration of an operation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "flash.h"
+#include "programmer.h"
+#include "libflashrom.h"
+
+#if !defined(_WIN32) && !defined(__DJGPP__) && !defined(__LIBPAYLOAD__)
+#include <pthread.h>
+
+static pthread_mutex_t core_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t core_released = PTHREAD_COND_INITIALIZER;
+
+static void core_lock(void)
+{
+	pthread_mutex_lock(&core_mutex);
+}
+
+static void core_unlock(void)
+{
+	pthread_mutex_unlock(&core_mutex);
+}
+
+static void core_wait(void)
+{
+	pthread_cond_wait(&core_released, &core_mutex);
+}
+
+static void core_wake(void)
+{
+	pthread_cond_broadcast(&core_released);
+}
+
+static pthread_key_t core_user_key;
+static pthread_once_t core_user_once = PTHREAD_ONCE_INIT;
+
+static void core_user_init(void)
+{
+	pthread_key_create(&core_user_key, NULL);
+}
+
+/* The programmer on whose behalf the calling thread holds core_mutex. */
+static struct flashrom_programmer *core_user(void)
+{
+	pthread_once(&core_user_once, core_user_init);
+	return pthread_getspecific(core_user_key);
+}
+
+static void set_core_user(struct flashrom_programmer *fp)
+{
+	pthread_once(&core_user_once, core_user_init);
+	pthread_setspecific(core_user_key, fp);
+}
+#else
+/* No threads, nothing to wait for. */
+static void core_lock(void) {}
+static void core_unlock(void) {}
+static void core_wait(void) {}
+static void core_wake(void) {}
+
+static struct flashrom_programmer *core_user_fp = NULL;
+
+static struct flashrom_programmer *core_user(void)
+{
+	return core_user_fp;
+}
+
+static void set_core_user(struct flashrom_programmer *fp)
+{
+	core_user_fp = fp;
+}
+#endif
+
+struct flashrom_programmer {
+	enum programmer prog;
+	char *params;
+	flashrom_log_callback *log;
+	void *log_data;
+	/* Tells this initialization apart from later ones at the same address. */
+	unsigned long serial;
+};
+
+struct flashrom_flashctx {
+	struct flashctx flash;
+	const struct flashrom_layout *layout;
+	int force;
+	/* The programmer the chip was probed with and its serial. */
+	struct flashrom_programmer *owner;
+	unsigned long owner_serial;
+};
+
+struct flashrom_region {
+	size_t start;
+	size_t end;
+	char *name;
+	int included;
+};
+
+struct flashrom_layout {
+	struct flashrom_region *regions;
+	int num_regions;
+};
+
+static flashrom_log_callback *global_log = NULL;
+static void *global_log_data = NULL;
+/* The programmer which is initialized, protected by core_mutex. */
+static struct flashrom_programmer *core_owner = NULL;
+static unsigned long core_serial = 0;
+
+/* Please note that level is the verbosity, not the importance of the message. */
+int print(enum msglevel level, const char *fmt, ...)
+{
+	struct flashrom_programmer *fp = core_user();
+	flashrom_log_callback *log;
+	void *data;
+	va_list ap;
+	int ret;
+
+	/* Messages of an operation go to the log of its programmer. A thread
+	 * which runs one holds core_mutex already, others have to take it. */
+	if (fp && fp->log) {
+		log = fp->log;
+		data = fp->log_data;
+	} else if (fp) {
+		log = global_log;
+		data = global_log_data;
+	} else {
+		core_lock();
+		log = global_log;
+		data = global_log_data;
+		core_unlock();
+	}
+	if (!log)
+		return 0;
+	va_start(ap, fmt);
+	ret = log(data, (enum flashrom_log_level)level, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+void flashrom_set_log_callback(flashrom_log_callback *log, void *data)
+{
+	core_lock();
+	global_log = log;
+	global_log_data = data;
+	core_unlock();
+}
+
+/* Call this once before any other function. */
+int flashrom_init(int perform_selfcheck)
+{
+	if (perform_selfcheck && selfcheck())
+		return 1;
+	myusec_calibrate_delay();
+	return 0;
+}
+
+int flashrom_shutdown(void)
+{
+	int ret;
+
+	core_lock();
+	ret = core_owner != NULL;
+	core_unlock();
+	if (ret)
+		msg_gerr("Error: A programmer is still initialized.\n");
+	return ret;
+}
+
+int flashrom_programmer_init(struct flashrom_programmer **flashprog, const char *prog_name,
+			     const char *prog_params, flashrom_log_callback *log, void *log_data)
+{
+	struct flashrom_programmer *fp;
+	unsigned int prog;
+
+	for (prog = 0; prog < PROGRAMMER_INVALID; prog++) {
+		if (!strcmp(programmer_table[prog].name, prog_name))
+			break;
+	}
+	if (prog == PROGRAMMER_INVALID) {
+		msg_gerr("Error: Unknown programmer \"%s\".\n", prog_name);
+		return 1;
+	}
+	fp = calloc(1, sizeof(*fp));
+	if (!fp) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	/* Programmer drivers take their parameters apart. */
+	if (prog_params) {
+		fp->params = strdup(prog_params);
+		if (!fp->params) {
+			msg_gerr("Out of memory!\n");
+			free(fp);
+			return 1;
+		}
+	}
+	fp->prog = prog;
+	fp->log = log;
+	fp->log_data = log_data;
+
+	core_lock();
+	while (core_owner)
+		core_wait();
+	core_owner = fp;
+	fp->serial = ++core_serial;
+	set_core_user(fp);
+	if (programmer_init(fp->prog, fp->params)) {
+		msg_perr("Error: Programmer initialization failed.\n");
+		programmer_shutdown();
+		set_core_user(NULL);
+		core_owner = NULL;
+		core_wake();
+		core_unlock();
+		free(fp->params);
+		free(fp);
+		return 1;
+	}
+	set_core_user(NULL);
+	core_unlock();
+	*flashprog = fp;
+	return 0;
+}
+
+int flashrom_programmer_shutdown(struct flashrom_programmer *flashprog)
+{
+	int ret;
+
+	core_lock();
+	if (core_owner != flashprog) {
+		core_unlock();
+		msg_gerr("Error: Programmer is not initialized.\n");
+		return 1;
+	}
+	set_core_user(flashprog);
+	ret = programmer_shutdown();
+	set_core_user(NULL);
+	core_owner = NULL;
+	core_wake();
+	core_unlock();
+	free(flashprog->params);
+	free(flashprog);
+	return ret ? 1 : 0;
+}
+
+int flashrom_flash_probe(struct flashrom_flashctx **flashctx, struct flashrom_programmer *flashprog,
+			 const char *chip_name)
+{
+	struct flashctx flashes[2] = {{0}};
+	struct flashrom_flashctx *ctx;
+	int i, startchip, chipcount = 0;
+
+	core_lock();
+	if (core_owner != flashprog) {
+		core_unlock();
+		msg_gerr("Error: Programmer is not initialized.\n");
+		return 1;
+	}
+	set_core_user(flashprog);
+	chip_to_probe = chip_name;
+	for (i = 0; i < registered_programmer_count; i++) {
+		startchip = 0;
+		while (chipcount < ARRAY_SIZE(flashes)) {
+			startchip = probe_flash(&registered_programmers[i], startchip, &flashes[chipcount], 0);
+			if (startchip == -1)
+				break;
+			chipcount++;
+			startchip++;
+		}
+	}
+	chip_to_probe = NULL;
+
+	if (chipcount > 1) {
+		msg_cinfo("Multiple flash chip definitions match the detected chip(s): \"%s\", \"%s\"\n",
+			  flashes[0].chip->name, flashes[1].chip->name);
+		for (i = 0; i < chipcount; i++) {
+			programmer_unmap_flash_region((void *)flashes[i].virtual_memory,
+						      flashes[i].chip->total_size * 1024);
+			free(flashes[i].chip);
+		}
+		set_core_user(NULL);
+		core_unlock();
+		return 3;
+	}
+	set_core_user(NULL);
+	core_unlock();
+	if (!chipcount)
+		return 2;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	ctx->flash = flashes[0];
+	ctx->owner = flashprog;
+	ctx->owner_serial = flashprog->serial;
+	*flashctx = ctx;
+	return 0;
+}
+
+size_t flashrom_flash_getsize(const struct flashrom_flashctx *flashctx)
+{
+	return flashctx->flash.chip->total_size * 1024;
+}
+
+const char *flashrom_flash_getname(const struct flashrom_flashctx *flashctx)
+{
+	return flashctx->flash.chip->name;
+}
+
+/* Ignore chip and programmer safety checks, like -f on the command line. */
+void flashrom_flash_set_force(struct flashrom_flashctx *flashctx, int force)
+{
+	flashctx->force = force;
+}
+
+/* Has the programmer the chip was probed with still the core? Call with
+ * core_mutex held. The owner may be freed already, so its serial is only read
+ * through core_owner. */
+static int owns_core(const struct flashrom_flashctx *flashctx)
+{
+	return core_owner && core_owner == flashctx->owner &&
+	       core_owner->serial == flashctx->owner_serial;
+}
+
+/* After the programmer was shut down, only the context itself is left. */
+void flashrom_flash_release(struct flashrom_flashctx *flashctx)
+{
+	if (!flashctx)
+		return;
+	core_lock();
+	if (owns_core(flashctx)) {
+		set_core_user(core_owner);
+		programmer_unmap_flash_region((void *)flashctx->flash.virtual_memory,
+					      flashctx->flash.chip->total_size * 1024);
+		set_core_user(NULL);
+	}
+	core_unlock();
+	free(flashctx->flash.chip);
+	free(flashctx);
+}
+
+static int layout_has_included(const struct flashrom_layout *layout)
+{
+	int i;
+
+	for (i = 0; layout && i < layout->num_regions; i++) {
+		if (layout->regions[i].included)
+			return 1;
+	}
+	return 0;
+}
+
+/* Enter the layout into the tables of layout.c. */
+static int install_layout(const struct flashrom_layout *layout)
+{
+	char *name;
+	int i;
+
+	if (!layout)
+		return 0;
+	for (i = 0; i < layout->num_regions; i++) {
+		if (add_romentry(layout->regions[i].start, layout->regions[i].end,
+				 layout->regions[i].name))
+			return 1;
+	}
+	for (i = 0; i < layout->num_regions; i++) {
+		if (!layout->regions[i].included)
+			continue;
+		name = strdup(layout->regions[i].name);
+		if (!name) {
+			msg_gerr("Out of memory!\n");
+			return 1;
+		}
+		if (register_include_arg(name)) {
+			free(name);
+			return 1;
+		}
+	}
+	return process_include_args();
+}
+
+static int flash_operation(struct flashrom_flashctx *flashctx, uint8_t *buf, size_t len, int read_it,
+			   int write_it, int erase_it, int verify_it)
+{
+	size_t size = flashrom_flash_getsize(flashctx);
+	int ret;
+
+	if (buf && len != size) {
+		msg_gerr("Error: Image size (%zu B) does not match the flash chip size (%zu B).\n",
+			 len, size);
+		return 1;
+	}
+	core_lock();
+	if (!owns_core(flashctx)) {
+		core_unlock();
+		msg_gerr("Error: The programmer of the flash chip is not initialized.\n");
+		return 1;
+	}
+	set_core_user(core_owner);
+	/* Like on the command line, an erase always covers the whole chip. */
+	if (erase_it && layout_has_included(flashctx->layout)) {
+		msg_gerr("Error: Layouts are supported for write operations only.\n");
+		ret = 1;
+	} else {
+		ret = install_layout(flashctx->layout);
+		if (!ret)
+			ret = doit_buffer(&flashctx->flash, flashctx->force, buf, read_it, write_it,
+					  erase_it, verify_it);
+		layout_cleanup();
+	}
+	set_core_user(NULL);
+	core_unlock();
+	return ret;
+}
+
+int flashrom_flash_erase(struct flashrom_flashctx *flashctx)
+{
+	return flash_operation(flashctx, NULL, 0, 0, 0, 1, 0);
+}
+
+int flashrom_image_read(struct flashrom_flashctx *flashctx, void *buf, size_t len)
+{
+	return flash_operation(flashctx, buf, len, 1, 0, 0, 0);
+}
+
+/* The image is only read, never modified. */
+int flashrom_image_write(struct flashrom_flashctx *flashctx, const void *buf, size_t len, int verify)
+{
+	return flash_operation(flashctx, (uint8_t *)buf, len, 0, 1, 0, verify);
+}
+
+int flashrom_image_verify(struct flashrom_flashctx *flashctx, const void *buf, size_t len)
+{
+	return flash_operation(flashctx, (uint8_t *)buf, len, 0, 0, 0, 1);
+}
+
+int flashrom_layout_new(struct flashrom_layout **layout)
+{
+	*layout = calloc(1, sizeof(**layout));
+	if (!*layout) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	return 0;
+}
+
+int flashrom_layout_add_region(struct flashrom_layout *layout, size_t start, size_t end,
+			       const char *name)
+{
+	struct flashrom_region *regions;
+	char *tmp;
+
+	if (start > end || end > FL_MAX_CHIPADDR) {
+		msg_gerr("Error: Invalid address range 0x%zx-0x%zx of region \"%s\".\n", start, end,
+			 name);
+		return 1;
+	}
+	tmp = strdup(name);
+	regions = realloc(layout->regions, (layout->num_regions + 1) * sizeof(*regions));
+	if (!tmp || !regions) {
+		msg_gerr("Out of memory!\n");
+		free(tmp);
+		if (regions)
+			layout->regions = regions;
+		return 1;
+	}
+	layout->regions = regions;
+	regions[layout->num_regions].start = start;
+	regions[layout->num_regions].end = end;
+	regions[layout->num_regions].name = tmp;
+	regions[layout->num_regions].included = 0;
+	layout->num_regions++;
+	return 0;
+}
+
+int flashrom_layout_include_region(struct flashrom_layout *layout, const char *name)
+{
+	int i;
+
+	for (i = 0; i < layout->num_regions; i++) {
+		if (!strcmp(layout->regions[i].name, name)) {
+			layout->regions[i].included = 1;
+			return 0;
+		}
+	}
+	msg_gerr("Error: Invalid region specified: \"%s\".\n", name);
+	return 1;
+}
+
+void flashrom_layout_release(struct flashrom_layout *layout)
+{
+	int i;
+
+	if (!layout)
+		return;
+	for (i = 0; i < layout->num_regions; i++)
+		free(layout->regions[i].name);
+	free(layout->regions);
+	free(layout);
+}
+
+void flashrom_layout_set(struct flashrom_flashctx *flashctx, const struct flashrom_layout *layout)
+{
+	flashctx->layout = layout;
+}
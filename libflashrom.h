@@ -0,0 +1,92 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Public interface of libflashrom.
+ *
+ * Programmers, flash chips and layouts are objects owned by the caller, and
+ * all messages go to a log callback instead of stdout. All functions may be
+ * called from any thread.
+ *
+ * Most programmer drivers keep their state in globals, so only one programmer
+ * can be active at a time: flashrom_programmer_init() waits until no other
+ * programmer is initialized, and the programmer owns flashrom until
+ * flashrom_programmer_shutdown(). Operations on one programmer are serialized.
+ * Operations on a flash chip fail once its programmer was shut down.
+ */
+
+#ifndef __LIBFLASHROM_H__
+#define __LIBFLASHROM_H__ 1
+
+#include <stdarg.h>
+#include <stddef.h>
+
+int flashrom_init(int perform_selfcheck);
+int flashrom_shutdown(void);
+
+/* Same values as enum msglevel in flash.h. */
+enum flashrom_log_level {
+	FLASHROM_MSG_ERROR	= 0,
+	FLASHROM_MSG_WARN	= 1,
+	FLASHROM_MSG_INFO	= 2,
+	FLASHROM_MSG_DEBUG	= 3,
+	FLASHROM_MSG_DEBUG2	= 4,
+	FLASHROM_MSG_SPEW	= 5,
+};
+typedef int flashrom_log_callback(void *data, enum flashrom_log_level level, const char *fmt,
+				  va_list ap);
+/* Messages which do not belong to a programmer with a log callback of its own.
+ * Without a callback, they are dropped. */
+void flashrom_set_log_callback(flashrom_log_callback *log, void *data);
+
+struct flashrom_programmer;
+/* prog_params may be NULL. log may be NULL to use the global log callback. */
+int flashrom_programmer_init(struct flashrom_programmer **flashprog, const char *prog_name,
+			     const char *prog_params, flashrom_log_callback *log, void *log_data);
+int flashrom_programmer_shutdown(struct flashrom_programmer *flashprog);
+
+struct flashrom_flashctx;
+/* Returns 0 if exactly one chip was found, 3 if several chip definitions match
+ * and chip_name is needed to pick one, 2 if nothing was found and 1 on other
+ * errors. chip_name may be NULL. */
+int flashrom_flash_probe(struct flashrom_flashctx **flashctx, struct flashrom_programmer *flashprog,
+			 const char *chip_name);
+size_t flashrom_flash_getsize(const struct flashrom_flashctx *flashctx);
+const char *flashrom_flash_getname(const struct flashrom_flashctx *flashctx);
+void flashrom_flash_set_force(struct flashrom_flashctx *flashctx, int force);
+/* Erases the whole chip, fails if the layout of the chip includes regions. */
+int flashrom_flash_erase(struct flashrom_flashctx *flashctx);
+void flashrom_flash_release(struct flashrom_flashctx *flashctx);
+
+/* Images have the size of the chip. Only the regions included in the layout
+ * of the chip, if any, are written and verified. */
+int flashrom_image_read(struct flashrom_flashctx *flashctx, void *buf, size_t len);
+int flashrom_image_write(struct flashrom_flashctx *flashctx, const void *buf, size_t len, int verify);
+int flashrom_image_verify(struct flashrom_flashctx *flashctx, const void *buf, size_t len);
+
+struct flashrom_layout;
+int flashrom_layout_new(struct flashrom_layout **layout);
+/* start and end are inclusive, like in layout files. */
+int flashrom_layout_add_region(struct flashrom_layout *layout, size_t start, size_t end,
+			       const char *name);
+int flashrom_layout_include_region(struct flashrom_layout *layout, const char *name);
+void flashrom_layout_release(struct flashrom_layout *layout);
+/* The layout has to stay around until the chip is released or gets another
+ * layout. NULL selects the whole chip. */
+void flashrom_layout_set(struct flashrom_flashctx *flashctx, const struct flashrom_layout *layout);
+
+#endif /* !__LIBFLASHROM_H__ */
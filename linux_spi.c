@@ -35,12 +35,16 @@
 #include "spi.h"
 
 static int fd = -1;
+/* Largest SPI_IOC_MESSAGE spidev accepts, from its bufsiz module parameter. */
+static unsigned int linux_spi_bufsiz = 4096;
 
 static int linux_spi_shutdown(void *data);
 static int linux_spi_send_command(struct flashctx *flash, unsigned int writecnt,
 				  unsigned int readcnt,
 				  const unsigned char *txbuf,
 				  unsigned char *rxbuf);
+static int linux_spi_send_multicommand(struct flashctx *flash,
+				       struct spi_command *cmds);
 static int linux_spi_read(struct flashctx *flash, uint8_t *buf,
 			  unsigned int start, unsigned int len);
 static int linux_spi_write_256(struct flashctx *flash, uint8_t *buf,
@@ -51,12 +55,31 @@ static const struct spi_programmer spi_programmer_linux = {
 	.max_data_read	= MAX_DATA_UNSPECIFIED, /* TODO? */
 	.max_data_write	= MAX_DATA_UNSPECIFIED, /* TODO? */
 	.command	= linux_spi_send_command,
-	.multicommand	= default_spi_send_multicommand,
+	.multicommand	= linux_spi_send_multicommand,
 	.read		= linux_spi_read,
 	.write_256	= linux_spi_write_256,
 	.write_aai	= default_spi_write_aai,
 };
 
+/* spidev rejects messages with more data (both directions summed up) than its
+ * bufsiz parameter. Use as much of it as possible per transfer. */
+static void linux_spi_get_bufsiz(void)
+{
+	FILE *fp;
+	unsigned int bufsiz;
+
+	fp = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+	if (!fp) {
+		msg_pdbg("Could not read spidev bufsiz, assuming %u bytes.\n",
+			 linux_spi_bufsiz);
+		return;
+	}
+	if (fscanf(fp, "%u", &bufsiz) == 1 && bufsiz > JEDEC_READ_OUTSIZE)
+		linux_spi_bufsiz = bufsiz;
+	fclose(fp);
+	msg_pdbg("Using spidev buffer size of %u bytes.\n", linux_spi_bufsiz);
+}
+
 int linux_spi_init(void)
 {
 	char *p, *endp, *dev;
@@ -120,6 +143,7 @@ int linux_spi_init(void)
 		return 1;
 	}
 
+	linux_spi_get_bufsiz();
 	register_spi_programmer(&spi_programmer_linux);
 
 	return 0;
@@ -172,18 +196,91 @@ static int linux_spi_send_command(struct flashctx *flash, unsigned int writecnt,
 	return 0;
 }
 
+/* Limit for the transfers in one SPI_IOC_MESSAGE. */
+#define LINUX_SPI_MAX_TRANSFERS	64
+
+/* Submit as many commands as possible as one message. CS# is deasserted
+ * between them and the requested delays are done by the kernel, so timed
+ * command sequences (e.g. AAI programming) need only a few syscalls. spidev
+ * delays before it toggles CS#, but the chip starts to work only when CS# goes
+ * high, so a delay gets a zero-length transfer of its own after the command. */
+static int linux_spi_send_multicommand(struct flashctx *flash,
+				       struct spi_command *cmds)
+{
+	struct spi_ioc_transfer msg[LINUX_SPI_MAX_TRANSFERS];
+	unsigned int n, bytes, delay;
+	int ret;
+
+	if (fd == -1)
+		return -1;
+
+	while (cmds->writecnt || cmds->readcnt) {
+		memset(msg, 0, sizeof(msg));
+		n = 0;
+		bytes = 0;
+		delay = 0;
+		for (; cmds->writecnt || cmds->readcnt; cmds++) {
+			unsigned int len = cmds->writecnt + cmds->readcnt;
+
+			if (cmds->writecnt == 0)
+				return SPI_INVALID_LENGTH;
+			if (n + 3 > LINUX_SPI_MAX_TRANSFERS ||
+			    bytes + len > linux_spi_bufsiz ||
+			    cmds->delay_us > 0xffff)
+				break;
+			msg[n].tx_buf = (uint64_t)(ptrdiff_t)cmds->writearr;
+			msg[n++].len = cmds->writecnt;
+			if (cmds->readcnt) {
+				msg[n].rx_buf = (uint64_t)(ptrdiff_t)cmds->readarr;
+				msg[n++].len = cmds->readcnt;
+			}
+			msg[n - 1].cs_change = 1;
+			bytes += len;
+			delay = cmds->delay_us;
+			if (delay) {
+				msg[n].delay_usecs = delay;
+				msg[n++].cs_change = 1;
+			}
+		}
+		if (!n) {
+			/* Does not fit into a message, send it on its own. */
+			ret = linux_spi_send_command(flash, cmds->writecnt,
+						     cmds->readcnt,
+						     cmds->writearr,
+						     cmds->readarr);
+			if (ret)
+				return ret;
+			programmer_delay(cmds->delay_us);
+			cmds++;
+			continue;
+		}
+		/* The kernel would delay the last command with CS# still
+		 * asserted, so its delay is done after the message. */
+		if (delay)
+			n--;
+		/* cs_change on the last transfer would keep CS# asserted. */
+		msg[n - 1].cs_change = 0;
+		if (ioctl(fd, SPI_IOC_MESSAGE(n), msg) == -1) {
+			msg_cerr("%s: ioctl: %s\n", __func__, strerror(errno));
+			return -1;
+		}
+		programmer_delay(delay);
+	}
+	return 0;
+}
+
 static int linux_spi_read(struct flashctx *flash, uint8_t *buf,
 			  unsigned int start, unsigned int len)
 {
 	return spi_read_chunked(flash, buf, start, len,
-				(unsigned int)getpagesize());
+				linux_spi_bufsiz - JEDEC_READ_OUTSIZE);
 }
 
 static int linux_spi_write_256(struct flashctx *flash, uint8_t *buf,
 			       unsigned int start, unsigned int len)
 {
 	return spi_write_chunked(flash, buf, start, len,
-				((unsigned int)getpagesize()) - 4);
+				linux_spi_bufsiz - 4);
 }
 
 #endif // CONFIG_LINUX_SPI == 1
@@ -42,7 +42,8 @@ int write_m29f400bt(struct flashctx *flash, uint8_t *src, unsigned int start,
 
 		/* transfer data from source to destination */
 		chip_writeb(flash, *src, dst);
-		toggle_ready_jedec(flash, dst);
+		if (toggle_ready_jedec(flash, dst))
+			return 1;
 #if 0
 		/* We only want to print something in the error case. */
 		msg_cerr("Value in the flash at address 0x%lx = %#x, want %#x\n",
@@ -52,7 +53,7 @@ int write_m29f400bt(struct flashctx *flash, uint8_t *src, unsigned int start,
 		src++;
 	}
 
-	/* FIXME: Ignore errors for now. */
+	/* FIXME: Ignore verify errors for now. */
 	return 0;
 }
 
@@ -100,10 +101,9 @@ int erase_m29f400bt(struct flashctx *flash)
 	chip_writeb(flash, 0x10, bios + 0xAAA);
 
 	programmer_delay(10);
-	toggle_ready_jedec(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_erase(flash, bios,
+					flash->chip->total_size * 1024);
 }
 
 int block_erase_m29f400bt(struct flashctx *flash, unsigned int start,
@@ -121,10 +121,8 @@ int block_erase_m29f400bt(struct flashctx *flash, unsigned int start,
 	chip_writeb(flash, 0x30, dst);
 
 	programmer_delay(10);
-	toggle_ready_jedec(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_erase(flash, bios, len);
 }
 
 int block_erase_chip_m29f400bt(struct flashctx *flash, unsigned int address,
@@ -0,0 +1,223 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Performance counters: Everything flashrom does is accounted to the current
+ * phase of the operation, and a summary can be written as JSON at exit.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "flash.h"
+#include "programmer.h"
+
+/* Distinct erase block sizes recorded per phase. Chips have only a handful. */
+#define PERF_MAX_ERASE_SIZES 16
+
+struct perf_counters {
+	uint64_t wall_us;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t bytes_erased;
+	uint64_t spi_commands;
+	uint64_t spi_multicommands;
+	uint64_t spi_bytes_out;
+	uint64_t spi_bytes_in;
+	uint64_t status_polls;
+	uint64_t delays;
+	uint64_t delay_us;
+	uint64_t skipped_blocks;
+	struct {
+		unsigned int size;
+		uint64_t count;
+	} erases[PERF_MAX_ERASE_SIZES];
+};
+
+static const char *const perf_phase_names[PERF_NUM_PHASES] = {
+	[PERF_OTHER]	= "other",
+	[PERF_PROBE]	= "probe",
+	[PERF_READ]	= "read",
+	[PERF_PREREAD]	= "pre-read",
+	[PERF_ERASE]	= "erase",
+	[PERF_PROGRAM]	= "program",
+	[PERF_VERIFY]	= "verify",
+};
+
+static struct perf_counters perf[PERF_NUM_PHASES];
+static enum perf_phase cur_phase = PERF_OTHER;
+static uint64_t phase_start;
+
+/* Account the time since the last switch to the current phase. */
+static void perf_account_time(void)
+{
+	uint64_t now = time_us();
+
+	if (phase_start)
+		perf[cur_phase].wall_us += now - phase_start;
+	phase_start = now;
+}
+
+/* Switch to a new phase and return the previous one so it can be restored. */
+enum perf_phase perf_phase(enum perf_phase phase)
+{
+	enum perf_phase old = cur_phase;
+
+	if (phase == cur_phase)
+		return old;
+	perf_account_time();
+	cur_phase = phase;
+	return old;
+}
+
+void perf_count_read(unsigned int len)
+{
+	perf[cur_phase].bytes_read += len;
+}
+
+void perf_count_write(unsigned int len)
+{
+	perf[cur_phase].bytes_written += len;
+}
+
+void perf_count_erase(unsigned int len)
+{
+	struct perf_counters *p = &perf[cur_phase];
+	int i;
+
+	p->bytes_erased += len;
+	for (i = 0; i < PERF_MAX_ERASE_SIZES; i++) {
+		if (!p->erases[i].count)
+			p->erases[i].size = len;
+		if (p->erases[i].size == len) {
+			p->erases[i].count++;
+			return;
+		}
+	}
+}
+
+void perf_count_skipped_block(void)
+{
+	perf[cur_phase].skipped_blocks++;
+}
+
+void perf_count_spi_command(unsigned int writecnt, unsigned int readcnt)
+{
+	perf[cur_phase].spi_commands++;
+	perf[cur_phase].spi_bytes_out += writecnt;
+	perf[cur_phase].spi_bytes_in += readcnt;
+}
+
+void perf_count_spi_multicommand(void)
+{
+	perf[cur_phase].spi_multicommands++;
+}
+
+void perf_count_status_poll(void)
+{
+	perf[cur_phase].status_polls++;
+}
+
+void perf_count_delay(int usecs)
+{
+	perf[cur_phase].delays++;
+	perf[cur_phase].delay_us += usecs;
+}
+
+/* Counters of phase so far, for callers measuring parts of an operation. */
+void perf_get_totals(enum perf_phase phase, struct perf_totals *totals)
+{
+	perf_account_time();
+	totals->wall_us = perf[phase].wall_us;
+	totals->bytes_read = perf[phase].bytes_read;
+	totals->bytes_written = perf[phase].bytes_written;
+	totals->bytes_erased = perf[phase].bytes_erased;
+}
+
+/* Print str as JSON string, or null if str is NULL. */
+static void print_json_string(FILE *f, const char *str)
+{
+	if (!str) {
+		fprintf(f, "null");
+		return;
+	}
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', f);
+		if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+/* Write all counters as JSON to filename. programmer_name and chip may be NULL
+ * if flashrom did not get that far. */
+int perf_report(const char *filename, const char *programmer_name, const char *chip)
+{
+	const struct perf_counters *p;
+	uint64_t total = 0;
+	FILE *f;
+	int i, j;
+
+	perf_account_time();
+	f = fopen(filename, "w");
+	if (!f) {
+		msg_gerr("Error: opening performance report \"%s\" failed: %s\n", filename,
+			 strerror(errno));
+		return 1;
+	}
+	for (i = 0; i < PERF_NUM_PHASES; i++)
+		total += perf[i].wall_us;
+
+	fprintf(f, "{\n\t\"programmer\": ");
+	print_json_string(f, programmer_name);
+	fprintf(f, ",\n\t\"chip\": ");
+	print_json_string(f, chip);
+	fprintf(f, ",\n\t\"wall_us\": %llu,\n\t\"phases\": {\n", (unsigned long long)total);
+	for (i = 0; i < PERF_NUM_PHASES; i++) {
+		p = &perf[i];
+		fprintf(f, "\t\t\"%s\": {\n", perf_phase_names[i]);
+		fprintf(f, "\t\t\t\"wall_us\": %llu,\n", (unsigned long long)p->wall_us);
+		fprintf(f, "\t\t\t\"bytes_read\": %llu,\n", (unsigned long long)p->bytes_read);
+		fprintf(f, "\t\t\t\"bytes_written\": %llu,\n", (unsigned long long)p->bytes_written);
+		fprintf(f, "\t\t\t\"bytes_erased\": %llu,\n", (unsigned long long)p->bytes_erased);
+		fprintf(f, "\t\t\t\"spi_commands\": %llu,\n", (unsigned long long)p->spi_commands);
+		fprintf(f, "\t\t\t\"spi_multicommands\": %llu,\n",
+			(unsigned long long)p->spi_multicommands);
+		fprintf(f, "\t\t\t\"spi_bytes_out\": %llu,\n", (unsigned long long)p->spi_bytes_out);
+		fprintf(f, "\t\t\t\"spi_bytes_in\": %llu,\n", (unsigned long long)p->spi_bytes_in);
+		fprintf(f, "\t\t\t\"status_polls\": %llu,\n", (unsigned long long)p->status_polls);
+		fprintf(f, "\t\t\t\"delays\": %llu,\n", (unsigned long long)p->delays);
+		fprintf(f, "\t\t\t\"delay_us\": %llu,\n", (unsigned long long)p->delay_us);
+		fprintf(f, "\t\t\t\"skipped_blocks\": %llu,\n", (unsigned long long)p->skipped_blocks);
+		fprintf(f, "\t\t\t\"erases\": {");
+		for (j = 0; j < PERF_MAX_ERASE_SIZES && p->erases[j].count; j++)
+			fprintf(f, "%s\"%u\": %llu", j ? ", " : "", p->erases[j].size,
+				(unsigned long long)p->erases[j].count);
+		fprintf(f, "}\n\t\t}%s\n", (i < PERF_NUM_PHASES - 1) ? "," : "");
+	}
+	fprintf(f, "\t}\n}\n");
+	if (fclose(f)) {
+		msg_gerr("Error: writing performance report \"%s\" failed: %s\n", filename,
+			 strerror(errno));
+		return 1;
+	}
+	return 0;
+}
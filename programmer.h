@@ -252,6 +252,7 @@ void myusec_delay(int usecs);
 void myusec_calibrate_delay(void);
 void internal_sleep(int usecs);
 void internal_delay(int usecs);
+uint64_t time_us(void);
 
 #if CONFIG_INTERNAL == 1
 /* board_enable.c */
@@ -363,6 +364,7 @@ void rmmio_vall(void *addr);
 /* dummyflasher.c */
 #if CONFIG_DUMMY == 1
 int dummy_init(void);
+void dummy_delay(int usecs);
 void *dummy_map(const char *descr, uintptr_t phys_addr, size_t len);
 void dummy_unmap(void *virt_addr, size_t len);
 #endif
@@ -483,6 +485,7 @@ struct decode_sizes {
 // FIXME: These need to be local, not global
 extern struct decode_sizes max_rom_decode;
 extern int programmer_may_write;
+int register_access_restriction(chipoff_t start, chipoff_t end, bool read, bool write);
 extern unsigned long flashbase;
 void check_chip_supported(const struct flashchip *chip);
 int check_max_decode(enum chipbustype buses, uint32_t size);
@@ -535,6 +538,10 @@ struct spi_programmer {
 	enum spi_controller type;
 	unsigned int max_data_read;
 	unsigned int max_data_write;
+	/* Optional: Read length that gives the best throughput if it is smaller
+	 * than max_data_read, e.g. a transfer filling the host side buffers
+	 * exactly. MAX_DATA_UNSPECIFIED means max_data_read is best. */
+	unsigned int preferred_data_read;
 	int (*command)(struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
 		   const unsigned char *writearr, unsigned char *readarr);
 	int (*multicommand)(struct flashctx *flash, struct spi_command *cmds);
@@ -543,6 +550,9 @@ struct spi_programmer {
 	int (*read)(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len);
 	int (*write_256)(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len);
 	int (*write_aai)(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len);
+	/* Optional: Assert CS# without clocking and wait until the chip drives
+	 * MISO high (hardware end-of-write detection, see JEDEC_EBSY). */
+	int (*wait_miso_ready)(struct flashctx *flash, unsigned int timeout_us);
 	const void *data;
 };
 
@@ -554,6 +564,14 @@ int default_spi_write_256(struct flashctx *flash, uint8_t *buf, unsigned int sta
 int default_spi_write_aai(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len);
 int register_spi_programmer(const struct spi_programmer *programmer);
 
+/* spi_trace.c */
+int spi_trace_open(const char *filename);
+int spi_trace_close(void);
+void spi_trace_wrap(struct spi_programmer *spi, int index);
+void spi_trace_delay(int usecs);
+int spi_trace_replay(struct flashctx *flash, const char *filename);
+int spi_trace_diff(const char *file_a, const char *file_b);
+
 /* The following enum is needed by ich_descriptor_tool and ich* code as well as in chipset_enable.c. */
 enum ich_chipset {
 	CHIPSET_ICH_UNKNOWN,
@@ -636,9 +654,16 @@ struct par_programmer {
 	uint16_t (*chip_readw) (const struct flashctx *flash, const chipaddr addr);
 	uint32_t (*chip_readl) (const struct flashctx *flash, const chipaddr addr);
 	void (*chip_readn) (const struct flashctx *flash, uint8_t *buf, const chipaddr addr, size_t len);
+	/* Number of back-to-back status reads chip drivers may batch into a
+	 * single chip_readn while polling, 0 if chip_readn is unsuitable
+	 * (e.g. because it may use wider or reordered accesses). Should be
+	 * odd to make a toggling bit visible between two batches. */
+	unsigned int poll_readn;
 	const void *data;
 };
 int register_par_programmer(const struct par_programmer *pgm, const enum chipbustype buses);
+/* The limit of 4 is totally arbitrary. */
+#define PROGRAMMERS_MAX 4
 struct registered_programmer {
 	enum chipbustype buses_supported;
 	union {
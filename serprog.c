@@ -296,15 +296,13 @@ static int serprog_spi_send_command(struct flashctx *flash,
 				    unsigned int writecnt, unsigned int readcnt,
 				    const unsigned char *writearr,
 				    unsigned char *readarr);
-static int serprog_spi_read(struct flashctx *flash, uint8_t *buf,
-			    unsigned int start, unsigned int len);
 static struct spi_programmer spi_programmer_serprog = {
 	.type		= SPI_CONTROLLER_SERPROG,
 	.max_data_read	= MAX_DATA_READ_UNLIMITED,
 	.max_data_write	= MAX_DATA_WRITE_UNLIMITED,
 	.command	= serprog_spi_send_command,
 	.multicommand	= default_spi_send_multicommand,
-	.read		= serprog_spi_read,
+	.read		= default_spi_read,
 	.write_256	= default_spi_write_256,
 	.write_aai	= default_spi_write_aai,
 };
@@ -324,6 +322,9 @@ static const struct par_programmer par_programmer_serprog = {
 		.chip_writew		= fallback_chip_writew,
 		.chip_writel		= fallback_chip_writel,
 		.chip_writen		= fallback_chip_writen,
+		/* Read-n is executed as back-to-back byte reads on the device
+		 * and saves a round trip per status read while polling. */
+		.poll_readn		= 15,
 };
 
 static enum chipbustype serprog_buses_supported = BUS_NONE;
@@ -918,22 +919,3 @@ static int serprog_spi_send_command(struct flashctx *flash,
 	free(parmbuf);
 	return ret;
 }
-
-/* FIXME: This function is optimized so that it does not split each transaction
- * into chip page_size long blocks unnecessarily like spi_read_chunked. This has
- * the advantage that it is much faster for most chips, but breaks those with
- * non-continuous reads. When spi_read_chunked is fixed this method can be removed. */
-static int serprog_spi_read(struct flashctx *flash, uint8_t *buf,
-			    unsigned int start, unsigned int len)
-{
-	unsigned int i, cur_len;
-	const unsigned int max_read = spi_programmer_serprog.max_data_read;
-	for (i = 0; i < len; i += cur_len) {
-		int ret;
-		cur_len = min(max_read, (len - i));
-		ret = spi_nbyte_read(flash, start + i, buf + i, cur_len);
-		if (ret)
-			return ret;
-	}
-	return 0;
-}
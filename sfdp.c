@@ -23,29 +23,72 @@
 #include "flash.h"
 #include "spi.h"
 #include "chipdrivers.h"
+#include "programmer.h"
+
+/* Upper bound for the number of bytes fetched with a single SFDP read. The
+ * parameter tables we care about are much smaller than that. */
+#define SFDP_MAX_STEP 256
+
+/* State shared by all SFDP reads of one probe. The step size starts at what
+ * the programmer claims to support and is halved whenever a read fails. If
+ * even single byte reads fail, the dummy byte is sent instead of being read
+ * and discarded and the step size starts over. */
+struct sfdp_reader {
+	struct flashctx *flash;
+	unsigned int maxstep;
+	unsigned int step;
+	int dummy_in_cmd;
+	uint8_t *buf; /* maxstep + 1 bytes for responses including the dummy byte */
+};
+
+static int sfdp_reader_init(struct sfdp_reader *r, struct flashctx *flash)
+{
+	unsigned int max_data_read = flash->pgm->spi.max_data_read;
+
+	r->flash = flash;
+	/* One byte of each read is the dummy byte. */
+	if (max_data_read == MAX_DATA_UNSPECIFIED)
+		r->maxstep = 64;
+	else
+		r->maxstep = min(max(max_data_read, 2) - 1, SFDP_MAX_STEP);
+	r->step = r->maxstep;
+	r->dummy_in_cmd = 0;
+	r->buf = malloc(r->maxstep + 1);
+	if (!r->buf) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	return 0;
+}
 
-static int spi_sfdp_read_sfdp_chunk(struct flashctx *flash, uint32_t address, uint8_t *buf, int len)
+static void sfdp_reader_cleanup(struct sfdp_reader *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+static int spi_sfdp_read_sfdp_chunk(struct sfdp_reader *r, uint32_t address, uint8_t *buf, int len)
 {
 	int i, ret;
-	uint8_t *newbuf;
 	const unsigned char cmd[JEDEC_SFDP_OUTSIZE] = {
 		JEDEC_SFDP,
 		(address >> 16) & 0xff,
 		(address >> 8) & 0xff,
 		(address >> 0) & 0xff,
 		/* FIXME: the following dummy byte explodes on some programmers.
-		 * One workaround is to read the dummy byte
-		 * instead and discard its value.
+		 * Therefore the dummy byte is read and discarded by default
+		 * and only sent if that does not work at all.
 		 */
 		0
 	};
 	msg_cspew("%s: addr=0x%x, len=%d, data:\n", __func__, address, len);
-	newbuf = malloc(len + 1);
-	if (!newbuf)
-		return SPI_PROGRAMMER_ERROR;
-	ret = spi_send_command(flash, sizeof(cmd) - 1, len + 1, cmd, newbuf);
-	memmove(buf, newbuf + 1, len);
-	free(newbuf);
+	if (r->dummy_in_cmd) {
+		ret = spi_send_command(r->flash, sizeof(cmd), len, cmd, buf);
+	} else {
+		ret = spi_send_command(r->flash, sizeof(cmd) - 1, len + 1, cmd, r->buf);
+		if (!ret)
+			memcpy(buf, r->buf + 1, len);
+	}
 	if (ret)
 		return ret;
 	for (i = 0; i < len; i++)
@@ -54,18 +97,28 @@ static int spi_sfdp_read_sfdp_chunk(struct flashctx *flash, uint32_t address, ui
 	return 0;
 }
 
-static int spi_sfdp_read_sfdp(struct flashctx *flash, uint32_t address, uint8_t *buf, int len)
+static int spi_sfdp_read_sfdp(struct sfdp_reader *r, uint32_t address, uint8_t *buf, int len)
 {
-	/* FIXME: There are different upper bounds for the number of bytes to
-	 * read on the various programmers (even depending on the rest of the
-	 * structure of the transaction). 2 is a safe bet. */
-	int maxstep = 2;
 	int ret = 0;
 	while (len > 0) {
-		int step = min(len, maxstep);
-		ret = spi_sfdp_read_sfdp_chunk(flash, address, buf, step);
-		if (ret)
+		int step = min(len, r->step);
+		ret = spi_sfdp_read_sfdp_chunk(r, address, buf, step);
+		if (ret) {
+			if (r->step > 1) {
+				r->step /= 2;
+				msg_cdbg2("SFDP read of %d bytes failed, retrying with at most %u.\n",
+					  step, r->step);
+				continue;
+			}
+			if (!r->dummy_in_cmd) {
+				msg_cdbg2("SFDP reads with discarded dummy byte failed, "
+					  "sending it instead.\n");
+				r->dummy_in_cmd = 1;
+				r->step = r->maxstep;
+				continue;
+			}
 			return ret;
+		}
 		address += step;
 		buf += step;
 		len -= step;
@@ -81,6 +134,7 @@ struct sfdp_tbl_hdr {
 	uint32_t ptp; /* 24b pointer */
 };
 
+/* Returns the index of the (possibly already existing) eraser or -1. */
 static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint32_t block_size)
 {
 	int i;
@@ -91,7 +145,7 @@ static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint3
 	    total_size % block_size != 0) {
 		msg_cdbg("%s: invalid input, please report to "
 			 "flashrom@flashrom.org\n", __func__);
-		return 1;
+		return -1;
 	}
 
 	for (i = 0; i < NUM_ERASEFUNCTIONS; i++) {
@@ -102,7 +156,7 @@ static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint3
 			msg_cdbg2("  Tried to add a duplicate block eraser: "
 				  "%d x %d B with opcode 0x%02x.\n",
 				  total_size/block_size, block_size, opcode);
-			return 1;
+			return i;
 		}
 		if (eraser->eraseblocks[0].size != 0 ||
 		    eraser->block_erase != NULL) {
@@ -117,12 +171,75 @@ static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint3
 		msg_cdbg2("  Block eraser %d: %d x %d B with opcode "
 			  "0x%02x\n", i, total_size/block_size, block_size,
 			  opcode);
-		return 0;
+		return i;
 	}
 	msg_cinfo("%s: Not enough space to store another eraser (i=%d)."
 		  " Please report this at flashrom@flashrom.org\n",
 		  __func__, i);
-	return 1;
+	return -1;
+}
+
+/* Add a chip erase (0xc7) eraser, returns its index or -1. */
+static int sfdp_add_chip_eraser(struct flashchip *chip)
+{
+	int i;
+	uint32_t total_size = chip->total_size * 1024;
+
+	for (i = 0; i < NUM_ERASEFUNCTIONS; i++) {
+		struct block_eraser *eraser = &chip->block_erasers[i];
+		if (eraser->block_erase == spi_block_erase_c7)
+			return i;
+		if (eraser->block_erase != NULL)
+			continue;
+		eraser->block_erase = spi_block_erase_c7;
+		eraser->eraseblocks[0].size = total_size;
+		eraser->eraseblocks[0].count = 1;
+		msg_cdbg2("  Block eraser %d: 1 x %d B with opcode 0xc7\n", i,
+			  total_size);
+		return i;
+	}
+	return -1;
+}
+
+static uint32_t sfdp_get_dword(const uint8_t *buf, int dw)
+{
+	return ((uint32_t)buf[4 * dw + 0]) |
+	       ((uint32_t)buf[4 * dw + 1]) << 8 |
+	       ((uint32_t)buf[4 * dw + 2]) << 16 |
+	       ((uint32_t)buf[4 * dw + 3]) << 24;
+}
+
+/* Decode a typical time field of the JESD216A tables: a count (stored minus
+ * one) of count_bits bits followed by a unit selector. */
+static unsigned int sfdp_decode_time(uint32_t field, int count_bits,
+				     const unsigned int *units)
+{
+	unsigned int count = (field & ((1 << count_bits) - 1)) + 1;
+
+	return count * units[field >> count_bits];
+}
+
+static const char *const sfdp_read_mode_names[NUM_SPI_READ_MODES] = {
+	[SPI_READ_1_1_2] = "1-1-2",
+	[SPI_READ_1_2_2] = "1-2-2",
+	[SPI_READ_1_1_4] = "1-1-4",
+	[SPI_READ_1_4_4] = "1-4-4",
+	[SPI_READ_2_2_2] = "2-2-2",
+	[SPI_READ_4_4_4] = "4-4-4",
+};
+
+/* Store a fast read command from a 16 bit field of double words 3-7. */
+static void sfdp_add_read_cmd(struct flashchip *chip, enum spi_read_mode mode,
+			      uint16_t field)
+{
+	struct spi_read_cmd *cmd = &chip->read_cmds[mode];
+
+	cmd->dummy_clocks = field & 0x1f;
+	cmd->mode_clocks = (field >> 5) & 0x7;
+	cmd->opcode = field >> 8;
+	msg_cdbg2("  %s fast read: opcode 0x%02x, %d mode and %d dummy "
+		  "clocks.\n", sfdp_read_mode_names[mode], cmd->opcode,
+		  cmd->mode_clocks, cmd->dummy_clocks);
 }
 
 static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
@@ -132,10 +249,12 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 	uint8_t tmp8;
 	uint32_t total_size; /* in bytes */
 	uint32_t block_size;
+	int erasers[4] = { -1, -1, -1, -1 };
+	int max_factor;
 	int j;
 
 	msg_cdbg("Parsing JEDEC flash parameter table... ");
-	if (len != 9 * 4 && len != 4 * 4) {
+	if (len < 9 * 4 && len != 4 * 4) {
 		msg_cdbg("%s: len out of spec\n", __func__);
 		return 1;
 	}
@@ -154,6 +273,7 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 		break;
 	case 0x1:
 		msg_cdbg2("  3-Byte (and optionally 4-Byte) addressing.\n");
+		chip->feature_bits |= FEATURE_4BA_SUPPORT;
 		break;
 	case 0x2:
 		msg_cdbg("  4-Byte only addressing (not supported by "
@@ -170,17 +290,17 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 		msg_cdbg2("volatile and writes to the status register have to "
 			  "be enabled with ");
 		if (tmp32 & (1 << 4)) {
-			chip->feature_bits = FEATURE_WRSR_WREN;
+			chip->feature_bits |= FEATURE_WRSR_WREN;
 			msg_cdbg2("WREN (0x06).\n");
 		} else {
-			chip->feature_bits = FEATURE_WRSR_EWSR;
+			chip->feature_bits |= FEATURE_WRSR_EWSR;
 			msg_cdbg2("EWSR (0x50).\n");
 		}
 	} else {
 		msg_cdbg2("non-volatile and the standard does not allow "
 			  "vendors to tell us whether EWSR/WREN is needed for "
 			  "status register writes - assuming EWSR.\n");
-			chip->feature_bits = FEATURE_WRSR_EWSR;
+			chip->feature_bits |= FEATURE_WRSR_EWSR;
 		}
 
 	msg_cdbg2("  Write chunk size is ");
@@ -223,8 +343,6 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 	if (opcode_4k_erase != 0xFF)
 		sfdp_add_uniform_eraser(chip, opcode_4k_erase, 4 * 1024);
 
-	/* FIXME: double words 3-7 contain unused fast read information */
-
 	if (len == 4 * 4) {
 		msg_cdbg("  It seems like this chip supports the preliminary "
 			 "Intel version of SFDP, skipping processing of double "
@@ -232,6 +350,22 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 		goto done;
 	}
 
+	/* 3.-7. double word: fast read commands, announced in the 1st one. */
+	tmp32 = sfdp_get_dword(buf, 0);
+	if (tmp32 & (1 << 21))
+		sfdp_add_read_cmd(chip, SPI_READ_1_4_4, sfdp_get_dword(buf, 2) & 0xffff);
+	if (tmp32 & (1 << 22))
+		sfdp_add_read_cmd(chip, SPI_READ_1_1_4, sfdp_get_dword(buf, 2) >> 16);
+	if (tmp32 & (1 << 16))
+		sfdp_add_read_cmd(chip, SPI_READ_1_1_2, sfdp_get_dword(buf, 3) & 0xffff);
+	if (tmp32 & (1 << 20))
+		sfdp_add_read_cmd(chip, SPI_READ_1_2_2, sfdp_get_dword(buf, 3) >> 16);
+	tmp32 = sfdp_get_dword(buf, 4);
+	if (tmp32 & (1 << 0))
+		sfdp_add_read_cmd(chip, SPI_READ_2_2_2, sfdp_get_dword(buf, 5) >> 16);
+	if (tmp32 & (1 << 4))
+		sfdp_add_read_cmd(chip, SPI_READ_4_4_4, sfdp_get_dword(buf, 6) >> 16);
+
 	/* 8. double word */
 	for (j = 0; j < 4; j++) {
 		/* 7 double words from the start + 2 bytes for every eraser */
@@ -252,7 +386,53 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 		tmp8 = buf[(4 * 7) + (j * 2) + 1];
 		msg_cspew("   Erase Sector Type %d Opcode: 0x%02x\n", j + 1,
 			  tmp8);
-		sfdp_add_uniform_eraser(chip, tmp8, block_size);
+		erasers[j] = sfdp_add_uniform_eraser(chip, tmp8, block_size);
+	}
+
+	if (len < 11 * 4) {
+		msg_cdbg2("  No timing information (JESD216 before revision A).\n");
+		goto done;
+	}
+
+	/* 10. double word: typical erase times of the 4 erase types */
+	tmp32 = sfdp_get_dword(buf, 9);
+	max_factor = 2 * ((tmp32 & 0xf) + 1);
+	for (j = 0; j < 4; j++) {
+		static const unsigned int units[] = { 1000, 16000, 128000, 1000000 };
+		unsigned int typ = sfdp_decode_time((tmp32 >> (4 + 7 * j)) & 0x7f, 5, units);
+
+		if (erasers[j] < 0)
+			continue;
+		chip->timing.erase[erasers[j]] = typ;
+		msg_cdbg2("  Erase Sector Type %d takes %u us typically.\n", j + 1, typ);
+	}
+
+	/* 11. double word: page size, program and chip erase times */
+	tmp32 = sfdp_get_dword(buf, 10);
+	max_factor = max(max_factor, 2 * ((tmp32 & 0xf) + 1));
+	chip->timing.max_factor = max_factor;
+	msg_cdbg2("  Maximum times are up to %d times the typical ones.\n", max_factor);
+	if (chip->write == spi_chip_write_256) {
+		chip->page_size = 1 << ((tmp32 >> 4) & 0xf);
+		msg_cdbg2("  Page size is %d B.\n", chip->page_size);
+	}
+	{
+		static const unsigned int page_units[] = { 8, 64 };
+		static const unsigned int byte_units[] = { 1, 8 };
+		static const unsigned int chip_units[] = { 16000, 256000, 4000000, 64000000 };
+		unsigned int typ;
+
+		chip->timing.page_program = sfdp_decode_time((tmp32 >> 8) & 0x3f, 5, page_units);
+		chip->timing.byte_program = sfdp_decode_time((tmp32 >> 14) & 0x1f, 4, byte_units);
+		msg_cdbg2("  Page program takes %u us, the first byte %u us typically.\n",
+			  chip->timing.page_program, chip->timing.byte_program);
+		/* Chip erase (0xc7) is not part of the table but supported by all JESD216 devices. */
+		typ = sfdp_decode_time((tmp32 >> 24) & 0x7f, 5, chip_units);
+		j = sfdp_add_chip_eraser(chip);
+		if (j >= 0) {
+			chip->timing.erase[j] = typ;
+			msg_cdbg2("  Chip erase takes %u us typically.\n", typ);
+		}
 	}
 
 done:
@@ -271,10 +451,15 @@ int probe_spi_sfdp(struct flashctx *flash)
 	struct sfdp_tbl_hdr *hdrs;
 	uint8_t *hbuf;
 	uint8_t *tbuf;
+	struct sfdp_reader r;
 
-	if (spi_sfdp_read_sfdp(flash, 0x00, buf, 4)) {
-		msg_cdbg("Receiving SFDP signature failed.\n");
+	if (sfdp_reader_init(&r, flash))
 		return 0;
+
+	/* Signature, revision and number of parameter headers in one go. */
+	if (spi_sfdp_read_sfdp(&r, 0x00, buf, 8)) {
+		msg_cdbg("Receiving SFDP signature failed.\n");
+		goto cleanup_reader;
 	}
 	tmp32 = buf[0];
 	tmp32 |= ((unsigned int)buf[1]) << 8;
@@ -284,21 +469,16 @@ int probe_spi_sfdp(struct flashctx *flash)
 	if (tmp32 != 0x50444653) {
 		msg_cdbg2("Signature = 0x%08x (should be 0x50444653)\n", tmp32);
 		msg_cdbg("No SFDP signature found.\n");
-		return 0;
+		goto cleanup_reader;
 	}
 
-	if (spi_sfdp_read_sfdp(flash, 0x04, buf, 3)) {
-		msg_cdbg("Receiving SFDP revision and number of parameter "
-			 "headers (NPH) failed. ");
-		return 0;
-	}
-	msg_cdbg2("SFDP revision = %d.%d\n", buf[1], buf[0]);
-	if (buf[1] != 0x01) {
+	msg_cdbg2("SFDP revision = %d.%d\n", buf[5], buf[4]);
+	if (buf[5] != 0x01) {
 		msg_cdbg("The chip supports an unknown version of SFDP. "
 			  "Aborting SFDP probe!\n");
-		return 0;
+		goto cleanup_reader;
 	}
-	nph = buf[2];
+	nph = buf[6];
 	msg_cdbg2("SFDP number of parameter headers is %d (NPH = %d).\n",
 		  nph + 1, nph);
 
@@ -309,7 +489,7 @@ int probe_spi_sfdp(struct flashctx *flash)
 		msg_gerr("Out of memory!\n");
 		goto cleanup_hdrs;
 	}
-	if (spi_sfdp_read_sfdp(flash, 0x08, hbuf, (nph + 1) * 8)) {
+	if (spi_sfdp_read_sfdp(&r, 0x08, hbuf, (nph + 1) * 8)) {
 		msg_cdbg("Receiving SFDP parameter table headers failed.\n");
 		goto cleanup_hdrs;
 	}
@@ -344,7 +524,7 @@ int probe_spi_sfdp(struct flashctx *flash)
 			msg_gerr("Out of memory!\n");
 			goto cleanup_hdrs;
 		}
-		if (spi_sfdp_read_sfdp(flash, tmp32, tbuf, len)){
+		if (spi_sfdp_read_sfdp(&r, tmp32, tbuf, len)){
 			msg_cdbg("Fetching SFDP parameter table %d failed.\n",
 				 i);
 			free(tbuf);
@@ -377,7 +557,7 @@ int probe_spi_sfdp(struct flashctx *flash)
 				msg_cdbg("The chip contains an unknown "
 					  "version of the JEDEC flash "
 					  "parameters table, skipping it.\n");
-			} else if (len != 9 * 4 && len != 4 * 4) {
+			} else if (len < 9 * 4 && len != 4 * 4) {
 				msg_cdbg("Length of the mandatory JEDEC SFDP "
 					 "parameter table is wrong (%d B), "
 					 "skipping it.\n", len);
@@ -390,5 +570,7 @@ int probe_spi_sfdp(struct flashctx *flash)
 cleanup_hdrs:
 	free(hdrs);
 	free(hbuf);
+cleanup_reader:
+	sfdp_reader_cleanup(&r);
 	return ret;
 }
@@ -34,12 +34,21 @@ int spi_send_command(struct flashctx *flash, unsigned int writecnt,
 		     unsigned int readcnt, const unsigned char *writearr,
 		     unsigned char *readarr)
 {
+	perf_count_spi_command(writecnt, readcnt);
 	return flash->pgm->spi.command(flash, writecnt, readcnt, writearr,
 				       readarr);
 }
 
 int spi_send_multicommand(struct flashctx *flash, struct spi_command *cmds)
 {
+	const struct spi_command *cmd;
+
+	perf_count_spi_multicommand();
+	/* The default implementation sends each command with spi_send_command,
+	 * which counts it. */
+	if (flash->pgm->spi.multicommand != default_spi_send_multicommand)
+		for (cmd = cmds; cmd->writecnt || cmd->readcnt; cmd++)
+			perf_count_spi_command(cmd->writecnt, cmd->readcnt);
 	return flash->pgm->spi.multicommand(flash, cmds);
 }
 
@@ -61,7 +70,8 @@ int default_spi_send_command(struct flashctx *flash, unsigned int writecnt,
 		.readarr = NULL,
 	}};
 
-	return spi_send_multicommand(flash, cmd);
+	/* Bypass spi_send_multicommand(), this is a single command. */
+	return flash->pgm->spi.multicommand(flash, cmd);
 }
 
 int default_spi_send_multicommand(struct flashctx *flash,
@@ -71,6 +81,8 @@ int default_spi_send_multicommand(struct flashctx *flash,
 	for (; (cmds->writecnt || cmds->readcnt) && !result; cmds++) {
 		result = spi_send_command(flash, cmds->writecnt, cmds->readcnt,
 					  cmds->writearr, cmds->readarr);
+		if (!result && cmds->delay_us)
+			programmer_delay(cmds->delay_us);
 	}
 	return result;
 }
@@ -79,12 +91,15 @@ int default_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start,
 		     unsigned int len)
 {
 	unsigned int max_data = flash->pgm->spi.max_data_read;
+	unsigned int preferred = flash->pgm->spi.preferred_data_read;
 	if (max_data == MAX_DATA_UNSPECIFIED) {
 		msg_perr("%s called, but SPI read chunk size not defined "
 			 "on this hardware. Please report a bug at "
 			 "flashrom@flashrom.org\n", __func__);
 		return 1;
 	}
+	if (preferred != MAX_DATA_UNSPECIFIED && preferred < max_data)
+		max_data = preferred;
 	return spi_read_chunked(flash, buf, start, len, max_data);
 }
 
@@ -185,5 +200,6 @@ int register_spi_programmer(const struct spi_programmer *pgm)
 
 	rpgm.buses_supported = BUS_SPI;
 	rpgm.spi = *pgm;
+	spi_trace_wrap(&rpgm.spi, registered_programmer_count);
 	return register_programmer(&rpgm);
 }
@@ -152,6 +152,12 @@
 #define JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE	0x03
 #define JEDEC_AAI_WORD_PROGRAM_INSIZE		0x00
 
+/* Enable/disable SO as AAI busy (RY/BY#) output (SST25VF080B) */
+#define JEDEC_EBSY		0x70
+#define JEDEC_EBSY_OUTSIZE	0x01
+#define JEDEC_DBSY		0x80
+#define JEDEC_DBSY_OUTSIZE	0x01
+
 /* Error codes */
 #define SPI_GENERIC_ERROR	-1
 #define SPI_INVALID_OPCODE	-2
@@ -840,6 +840,23 @@ erasefunc_t *spi_get_erasefn_from_opcode(uint8_t opcode)
 	}
 }
 
+/* The inverse of spi_get_erasefn_from_opcode(), returns 0x00 for functions
+ * which are no SPI erase functions. */
+uint8_t spi_get_opcode_from_erasefn(erasefunc_t *func)
+{
+	static const uint8_t opcodes[] = {
+		0x20, 0x50, 0x52, 0x60, 0x62, 0x81, 0xc4, 0xc7, 0xd7, 0xd8, 0xdb,
+	};
+	int i;
+
+	if (!func)
+		return 0x00;
+	for (i = 0; i < ARRAY_SIZE(opcodes); i++)
+		if (spi_get_erasefn_from_opcode(opcodes[i]) == func)
+			return opcodes[i];
+	return 0x00;
+}
+
 int spi_byte_program(struct flashctx *flash, unsigned int addr,
 		     uint8_t databyte)
 {
@@ -939,38 +956,19 @@ int spi_nbyte_read(struct flashctx *flash, unsigned int address, uint8_t *bytes,
 }
 
 /*
- * Read a part of the flash chip.
- * FIXME: Use the chunk code from Michael Karcher instead.
- * Each page is read separately in chunks with a maximum size of chunksize.
+ * Read a part of the flash chip in chunks with a maximum size of chunksize.
+ * All chips handled by spi_chip_read support continuous reads across page
+ * boundaries, so the range is split by chunksize only.
  */
 int spi_read_chunked(struct flashctx *flash, uint8_t *buf, unsigned int start,
 		     unsigned int len, unsigned int chunksize)
 {
 	int rc = 0;
-	unsigned int i, j, starthere, lenhere, toread;
-	unsigned int page_size = flash->chip->page_size;
-
-	/* Warning: This loop has a very unusual condition and body.
-	 * The loop needs to go through each page with at least one affected
-	 * byte. The lowest page number is (start / page_size) since that
-	 * division rounds down. The highest page number we want is the page
-	 * where the last byte of the range lives. That last byte has the
-	 * address (start + len - 1), thus the highest page number is
-	 * (start + len - 1) / page_size. Since we want to include that last
-	 * page as well, the loop condition uses <=.
-	 */
-	for (i = start / page_size; i <= (start + len - 1) / page_size; i++) {
-		/* Byte position of the first byte in the range in this page. */
-		/* starthere is an offset to the base address of the chip. */
-		starthere = max(start, i * page_size);
-		/* Length of bytes in the range in this page. */
-		lenhere = min(start + len, (i + 1) * page_size) - starthere;
-		for (j = 0; j < lenhere; j += chunksize) {
-			toread = min(chunksize, lenhere - j);
-			rc = spi_nbyte_read(flash, starthere + j, buf + starthere - start + j, toread);
-			if (rc)
-				break;
-		}
+	unsigned int i, toread;
+
+	for (i = 0; i < len; i += toread) {
+		toread = min(chunksize, len - i);
+		rc = spi_nbyte_read(flash, start + i, buf + i, toread);
 		if (rc)
 			break;
 	}
@@ -979,47 +977,27 @@ int spi_read_chunked(struct flashctx *flash, uint8_t *buf, unsigned int start,
 }
 
 /*
- * Write a part of the flash chip.
- * FIXME: Use the chunk code from Michael Karcher instead.
- * Each page is written separately in chunks with a maximum size of chunksize.
+ * Write a part of the flash chip in chunks with a maximum size of chunksize.
+ * No chunk crosses a write chunk (page) boundary of the chip and chunks are
+ * aligned to chunksize within each write chunk, so a range covering whole
+ * pages needs the same number of commands regardless of where it starts.
  */
 int spi_write_chunked(struct flashctx *flash, uint8_t *buf, unsigned int start,
 		      unsigned int len, unsigned int chunksize)
 {
 	int rc = 0;
-	unsigned int i, j, starthere, lenhere, towrite;
-	/* FIXME: page_size is the wrong variable. We need max_writechunk_size
-	 * in struct flashctx to do this properly. All chips using
-	 * spi_chip_write_256 have page_size set to max_writechunk_size, so
-	 * we're OK for now.
-	 */
-	unsigned int page_size = flash->chip->page_size;
-
-	/* Warning: This loop has a very unusual condition and body.
-	 * The loop needs to go through each page with at least one affected
-	 * byte. The lowest page number is (start / page_size) since that
-	 * division rounds down. The highest page number we want is the page
-	 * where the last byte of the range lives. That last byte has the
-	 * address (start + len - 1), thus the highest page number is
-	 * (start + len - 1) / page_size. Since we want to include that last
-	 * page as well, the loop condition uses <=.
-	 */
-	for (i = start / page_size; i <= (start + len - 1) / page_size; i++) {
-		/* Byte position of the first byte in the range in this page. */
-		/* starthere is an offset to the base address of the chip. */
-		starthere = max(start, i * page_size);
-		/* Length of bytes in the range in this page. */
-		lenhere = min(start + len, (i + 1) * page_size) - starthere;
-		for (j = 0; j < lenhere; j += chunksize) {
-			towrite = min(chunksize, lenhere - j);
-			rc = spi_nbyte_program(flash, starthere + j, buf + starthere - start + j, towrite);
-			if (rc)
-				break;
-			while (spi_read_status_register(flash) & SPI_SR_WIP)
-				programmer_delay(10);
-		}
+	unsigned int i, pageoff, towrite;
+	const unsigned int writechunk = flash_writechunk_size(flash);
+
+	for (i = 0; i < len; i += towrite) {
+		pageoff = (start + i) % writechunk;
+		towrite = min(chunksize - pageoff % chunksize, writechunk - pageoff);
+		towrite = min(towrite, len - i);
+		rc = spi_nbyte_program(flash, start + i, buf + i, towrite);
 		if (rc)
 			break;
+		while (spi_read_status_register(flash) & SPI_SR_WIP)
+			programmer_delay(10);
 	}
 
 	return rc;
@@ -1049,10 +1027,68 @@ int spi_chip_write_1(struct flashctx *flash, uint8_t *buf, unsigned int start,
 	return 0;
 }
 
+/* Wait time after each AAI word if the chip provides no timing information.
+ * This is the maximum byte program time of the SST25VF0xxB family. */
+#define AAI_DEFAULT_WORD_TIME_US	10
+/* Number of AAI continuation commands queued into one multicommand. */
+#define AAI_BATCH_WORDS			64
+
+/* Wait until the last AAI command has finished. With ebsy, the chip signals
+ * ready by driving SO high while CS# is asserted. */
+static int spi_aai_wait(struct flashctx *flash, int ebsy)
+{
+	if (ebsy)
+		return flash->pgm->spi.wait_miso_ready(flash, 100 * 1000);
+	while (spi_read_status_register(flash) & SPI_SR_WIP)
+		programmer_delay(10);
+	return 0;
+}
+
+/* Queue up to AAI_BATCH_WORDS continuation commands (at least one, len >= 2)
+ * in a single multicommand, each followed by the maximum word program time
+ * instead of a status register poll. *pos is advanced by the bytes sent.
+ */
+static int spi_aai_write_batch(struct flashctx *flash, uint8_t *buf,
+			       unsigned int len, uint32_t *pos)
+{
+	unsigned char data[AAI_BATCH_WORDS][JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE];
+	struct spi_command cmds[AAI_BATCH_WORDS + 1];
+	const struct flashchip *chip = flash->chip;
+	unsigned int delay = AAI_DEFAULT_WORD_TIME_US;
+	unsigned int i, words = min(len / 2, AAI_BATCH_WORDS);
+	int result;
+
+	if (chip->timing.byte_program)
+		delay = chip->timing.byte_program * max(chip->timing.max_factor, 1);
+	for (i = 0; i < words; i++) {
+		data[i][0] = JEDEC_AAI_WORD_PROGRAM;
+		data[i][1] = buf[2 * i];
+		data[i][2] = buf[2 * i + 1];
+		cmds[i] = (struct spi_command) {
+			.writecnt	= JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE,
+			.writearr	= data[i],
+			.readcnt	= 0,
+			.readarr	= NULL,
+			.delay_us	= delay,
+		};
+	}
+	cmds[words] = (struct spi_command) {
+		.writecnt	= 0,
+		.writearr	= NULL,
+		.readcnt	= 0,
+		.readarr	= NULL,
+	};
+	result = spi_send_multicommand(flash, cmds);
+	if (!result)
+		*pos += 2 * words;
+	return result;
+}
+
 int default_spi_write_aai(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
 {
 	uint32_t pos = start;
 	int result;
+	int ebsy = 0;
 	unsigned char cmd[JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE] = {
 		JEDEC_AAI_WORD_PROGRAM,
 	};
@@ -1127,6 +1163,13 @@ int default_spi_write_aai(struct flashctx *flash, uint8_t *buf, unsigned int sta
 	}
 
 
+	/* Let the chip signal the end of each write on SO if we can see it. */
+	if ((flash->chip->feature_bits & FEATURE_AAI_EBSY) &&
+	    flash->pgm->spi.wait_miso_ready &&
+	    !spi_send_command(flash, JEDEC_EBSY_OUTSIZE, 0,
+			      (const unsigned char[]){ JEDEC_EBSY }, NULL))
+		ebsy = 1;
+
 	result = spi_send_multicommand(flash, cmds);
 	if (result) {
 		msg_cerr("%s failed during start command execution\n",
@@ -1134,28 +1177,46 @@ int default_spi_write_aai(struct flashctx *flash, uint8_t *buf, unsigned int sta
 		/* FIXME: Should we send WRDI here as well to make sure the chip
 		 * is not in AAI mode?
 		 */
-		return result;
+		goto out;
 	}
-	while (spi_read_status_register(flash) & SPI_SR_WIP)
-		programmer_delay(10);
+	result = spi_aai_wait(flash, ebsy);
+	if (result)
+		goto exit_aai;
 
 	/* We already wrote 2 bytes in the multicommand step. */
 	pos += 2;
 
 	/* Are there at least two more bytes to write? */
 	while (pos < start + len - 1) {
-		cmd[1] = buf[pos++ - start];
-		cmd[2] = buf[pos++ - start];
-		spi_send_command(flash, JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE, 0,
-				 cmd, NULL);
-		while (spi_read_status_register(flash) & SPI_SR_WIP)
-			programmer_delay(10);
+		if (ebsy) {
+			cmd[1] = buf[pos++ - start];
+			cmd[2] = buf[pos++ - start];
+			result = spi_send_command(flash,
+						  JEDEC_AAI_WORD_PROGRAM_CONT_OUTSIZE,
+						  0, cmd, NULL);
+		} else {
+			result = spi_aai_write_batch(flash, buf + pos - start,
+						     start + len - pos, &pos);
+		}
+		if (!result)
+			result = spi_aai_wait(flash, ebsy);
+		if (result) {
+			msg_cerr("%s failed at 0x%06x\n", __func__, pos);
+			break;
+		}
 	}
 
+exit_aai:
 	/* Use WRDI to exit AAI mode. This needs to be done before issuing any
 	 * other non-AAI command.
 	 */
 	spi_write_disable(flash);
+out:
+	if (ebsy)
+		spi_send_command(flash, JEDEC_DBSY_OUTSIZE, 0,
+				 (const unsigned char[]){ JEDEC_DBSY }, NULL);
+	if (result)
+		return result;
 
 	/* Write remaining byte (if any). */
 	if (pos < start + len) {
@@ -115,6 +115,7 @@ uint8_t spi_read_status_register(struct flashctx *flash)
 	unsigned char readarr[2]; /* JEDEC_RDSR_INSIZE=1 but wbsio needs 2 */
 	int ret;
 
+	perf_count_status_poll();
 	/* Read Status Register */
 	ret = spi_send_command(flash, sizeof(cmd), sizeof(readarr), cmd, readarr);
 	if (ret)
@@ -0,0 +1,698 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * SPI transaction traces: A recorder wraps every registered SPI programmer and
+ * saves what is sent to the chip, a replay feeds a trace back into a programmer
+ * (usually the dummy emulation) and two traces can be compared.
+ *
+ * File format (all numbers little endian):
+ * 8 bytes magic "FRTRACE" followed by the version (1), then records of
+ *   u8  type (enum trace_type)
+ *   u8  result (0 if the call succeeded)
+ *   u16 reserved (0)
+ *   u32 microseconds since the start of the previous record
+ *   u32 microseconds the call took
+ *   u32 address (read/write) or microseconds (delay), 0 otherwise
+ *   u32 number of commands, each of them
+ *       u32 writecnt, u32 readcnt, u32 delay_us, writecnt bytes, readcnt bytes
+ * Read and write calls are stored as one command with readcnt resp. writecnt
+ * set to their length.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "flash.h"
+#include "programmer.h"
+
+#define TRACE_MAGIC		"FRTRACE\x01"
+#define TRACE_MAGIC_LEN		8
+#define TRACE_HEADER_LEN	20
+/* Sanity limit for corrupted files. */
+#define TRACE_MAX_LEN		(64 * 1024 * 1024)
+/* Differences printed before giving up. */
+#define TRACE_MAX_REPORTED	10
+
+enum trace_type {
+	TRACE_COMMAND = 1,
+	TRACE_MULTICOMMAND,
+	TRACE_DELAY,
+	TRACE_READ,
+	TRACE_WRITE_256,
+	TRACE_WRITE_AAI,
+};
+
+static const char *const trace_type_names[] = {
+	[TRACE_COMMAND]		= "command",
+	[TRACE_MULTICOMMAND]	= "multicommand",
+	[TRACE_DELAY]		= "delay",
+	[TRACE_READ]		= "read",
+	[TRACE_WRITE_256]	= "write_256",
+	[TRACE_WRITE_AAI]	= "write_aai",
+};
+
+struct trace_record {
+	uint8_t type;
+	uint8_t result;
+	uint32_t delta_us;
+	uint32_t duration_us;
+	uint32_t addr;
+	unsigned int count;
+	struct spi_command *cmds;
+};
+
+static FILE *trace_file = NULL;
+static const char *trace_filename;
+static uint64_t trace_last;
+/* Calls made by a traced call are not recorded again. */
+static int trace_depth = 0;
+/* The original functions of the registered programmers. */
+static struct spi_programmer trace_orig[PROGRAMMERS_MAX];
+
+static void put_le32(uint8_t *buf, uint32_t val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	buf[3] = val >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *buf)
+{
+	return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+static const char *trace_type_name(uint8_t type)
+{
+	if (type < TRACE_COMMAND || type > TRACE_WRITE_AAI)
+		return "unknown";
+	return trace_type_names[type];
+}
+
+/* Stop recording after an error, the trace is useless anyway. */
+static void trace_write_failed(void)
+{
+	msg_gerr("Error: writing SPI trace \"%s\" failed: %s\n", trace_filename, strerror(errno));
+	fclose(trace_file);
+	trace_file = NULL;
+}
+
+static void trace_write_record(uint8_t type, int ret, uint64_t start, uint64_t end, uint32_t addr,
+			       const struct spi_command *cmds, unsigned int count)
+{
+	uint8_t buf[TRACE_HEADER_LEN];
+	unsigned int i;
+
+	if (!trace_file)
+		return;
+	memset(buf, 0, sizeof(buf));
+	buf[0] = type;
+	buf[1] = ret != 0;
+	put_le32(buf + 4, start - trace_last);
+	put_le32(buf + 8, end - start);
+	put_le32(buf + 12, addr);
+	put_le32(buf + 16, count);
+	trace_last = start;
+	if (fwrite(buf, TRACE_HEADER_LEN, 1, trace_file) != 1)
+		goto fail;
+	for (i = 0; i < count; i++) {
+		put_le32(buf, cmds[i].writecnt);
+		put_le32(buf + 4, cmds[i].readcnt);
+		put_le32(buf + 8, cmds[i].delay_us);
+		if (fwrite(buf, 12, 1, trace_file) != 1)
+			goto fail;
+		if (cmds[i].writecnt && fwrite(cmds[i].writearr, cmds[i].writecnt, 1, trace_file) != 1)
+			goto fail;
+		if (cmds[i].readcnt && fwrite(cmds[i].readarr, cmds[i].readcnt, 1, trace_file) != 1)
+			goto fail;
+	}
+	return;
+fail:
+	trace_write_failed();
+}
+
+static const struct spi_programmer *trace_orig_pgm(const struct flashctx *flash)
+{
+	return &trace_orig[flash->pgm - registered_programmers];
+}
+
+static int trace_command(struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+			 const unsigned char *writearr, unsigned char *readarr)
+{
+	struct spi_command cmd = {
+		.writecnt = writecnt,
+		.readcnt = readcnt,
+		.writearr = writearr,
+		.readarr = readarr,
+	};
+	uint64_t start = time_us();
+	int ret;
+
+	trace_depth++;
+	ret = trace_orig_pgm(flash)->command(flash, writecnt, readcnt, writearr, readarr);
+	if (!--trace_depth)
+		trace_write_record(TRACE_COMMAND, ret, start, time_us(), 0, &cmd, 1);
+	return ret;
+}
+
+static int trace_multicommand(struct flashctx *flash, struct spi_command *cmds)
+{
+	uint64_t start = time_us();
+	unsigned int count = 0;
+	int ret;
+
+	trace_depth++;
+	ret = trace_orig_pgm(flash)->multicommand(flash, cmds);
+	if (!--trace_depth) {
+		while (cmds[count].writecnt || cmds[count].readcnt)
+			count++;
+		trace_write_record(TRACE_MULTICOMMAND, ret, start, time_us(), 0, cmds, count);
+	}
+	return ret;
+}
+
+static int trace_rw(struct flashctx *flash, uint8_t type, uint8_t *buf, unsigned int start,
+		    unsigned int len)
+{
+	const struct spi_programmer *orig = trace_orig_pgm(flash);
+	struct spi_command cmd = { .writecnt = 0 };
+	uint64_t t = time_us();
+	int ret;
+
+	trace_depth++;
+	switch (type) {
+	case TRACE_READ:
+		ret = orig->read(flash, buf, start, len);
+		cmd.readcnt = len;
+		cmd.readarr = buf;
+		break;
+	case TRACE_WRITE_256:
+		ret = orig->write_256(flash, buf, start, len);
+		cmd.writecnt = len;
+		cmd.writearr = buf;
+		break;
+	default:
+		ret = orig->write_aai(flash, buf, start, len);
+		cmd.writecnt = len;
+		cmd.writearr = buf;
+		break;
+	}
+	if (!--trace_depth)
+		trace_write_record(type, ret, t, time_us(), start, &cmd, 1);
+	return ret;
+}
+
+static int trace_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	return trace_rw(flash, TRACE_READ, buf, start, len);
+}
+
+static int trace_write_256(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	return trace_rw(flash, TRACE_WRITE_256, buf, start, len);
+}
+
+static int trace_write_aai(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	return trace_rw(flash, TRACE_WRITE_AAI, buf, start, len);
+}
+
+/* Start recording all SPI programmers registered from now on to filename. */
+int spi_trace_open(const char *filename)
+{
+	trace_file = fopen(filename, "wb");
+	if (!trace_file) {
+		msg_gerr("Error: opening SPI trace \"%s\" failed: %s\n", filename, strerror(errno));
+		return 1;
+	}
+	trace_filename = filename;
+	if (fwrite(TRACE_MAGIC, TRACE_MAGIC_LEN, 1, trace_file) != 1) {
+		trace_write_failed();
+		return 1;
+	}
+	trace_last = time_us();
+	return 0;
+}
+
+int spi_trace_close(void)
+{
+	int ret = 0;
+
+	if (!trace_file)
+		return 0;
+	if (fclose(trace_file)) {
+		msg_gerr("Error: writing SPI trace \"%s\" failed: %s\n", trace_filename, strerror(errno));
+		ret = 1;
+	}
+	trace_file = NULL;
+	return ret;
+}
+
+/*
+ * Called by register_spi_programmer() for the programmer which will be stored
+ * at index in registered_programmers. The default implementations are built
+ * on top of the other functions and are traced through them.
+ */
+void spi_trace_wrap(struct spi_programmer *spi, int index)
+{
+	if (!trace_file || index >= PROGRAMMERS_MAX)
+		return;
+	trace_orig[index] = *spi;
+	if (spi->command != default_spi_send_command)
+		spi->command = trace_command;
+	if (spi->multicommand != default_spi_send_multicommand)
+		spi->multicommand = trace_multicommand;
+	if (spi->read != default_spi_read)
+		spi->read = trace_read;
+	if (spi->write_256 != default_spi_write_256)
+		spi->write_256 = trace_write_256;
+	if (spi->write_aai != default_spi_write_aai)
+		spi->write_aai = trace_write_aai;
+}
+
+/* Called by programmer_delay() before waiting. */
+void spi_trace_delay(int usecs)
+{
+	uint64_t now;
+
+	if (!trace_file || trace_depth)
+		return;
+	now = time_us();
+	trace_write_record(TRACE_DELAY, 0, now, now + usecs, usecs, NULL, 0);
+}
+
+static void free_record(struct trace_record *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->count; i++) {
+		free((void *)r->cmds[i].writearr);
+		free(r->cmds[i].readarr);
+	}
+	free(r->cmds);
+	r->cmds = NULL;
+	r->count = 0;
+}
+
+static int read_payload(FILE *f, uint8_t **buf, unsigned int len)
+{
+	*buf = NULL;
+	if (!len)
+		return 0;
+	*buf = malloc(len);
+	if (!*buf) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	return fread(*buf, len, 1, f) != 1;
+}
+
+/* Returns 0 for a record, 1 at the end of the file and -1 for errors. */
+static int read_record(FILE *f, const char *filename, struct trace_record *r)
+{
+	uint8_t buf[TRACE_HEADER_LEN];
+	uint8_t *writearr;
+	unsigned int i;
+	size_t n;
+
+	memset(r, 0, sizeof(*r));
+	n = fread(buf, 1, TRACE_HEADER_LEN, f);
+	if (!n && feof(f))
+		return 1;
+	if (n != TRACE_HEADER_LEN)
+		goto truncated;
+	r->type = buf[0];
+	r->result = buf[1];
+	r->delta_us = get_le32(buf + 4);
+	r->duration_us = get_le32(buf + 8);
+	r->addr = get_le32(buf + 12);
+	r->count = get_le32(buf + 16);
+	if (r->type < TRACE_COMMAND || r->type > TRACE_WRITE_AAI || r->count > TRACE_MAX_LEN / 12) {
+		msg_gerr("Error: SPI trace \"%s\" is corrupted.\n", filename);
+		r->count = 0;
+		return -1;
+	}
+	/* One more entry for the terminating empty command. */
+	r->cmds = calloc(r->count + 1, sizeof(*r->cmds));
+	if (!r->cmds) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	for (i = 0; i < r->count; i++) {
+		if (fread(buf, 12, 1, f) != 1)
+			goto truncated;
+		r->cmds[i].writecnt = get_le32(buf);
+		r->cmds[i].readcnt = get_le32(buf + 4);
+		r->cmds[i].delay_us = get_le32(buf + 8);
+		if (r->cmds[i].writecnt > TRACE_MAX_LEN || r->cmds[i].readcnt > TRACE_MAX_LEN) {
+			msg_gerr("Error: SPI trace \"%s\" is corrupted.\n", filename);
+			r->cmds[i].writecnt = r->cmds[i].readcnt = 0;
+			free_record(r);
+			return -1;
+		}
+		if (read_payload(f, &writearr, r->cmds[i].writecnt)) {
+			r->cmds[i].writearr = writearr;
+			goto truncated;
+		}
+		r->cmds[i].writearr = writearr;
+		if (read_payload(f, &r->cmds[i].readarr, r->cmds[i].readcnt))
+			goto truncated;
+	}
+	return 0;
+truncated:
+	msg_gerr("Error: SPI trace \"%s\" is truncated.\n", filename);
+	free_record(r);
+	return -1;
+}
+
+static FILE *open_trace(const char *filename)
+{
+	char magic[TRACE_MAGIC_LEN];
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		msg_gerr("Error: opening SPI trace \"%s\" failed: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	if (fread(magic, TRACE_MAGIC_LEN, 1, f) != 1 || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN)) {
+		msg_gerr("Error: \"%s\" is not an SPI trace of this flashrom version.\n", filename);
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* Compare the data read by replayed command i with the recording. */
+static int compare_read(const struct trace_record *r, unsigned int i, const uint8_t *buf)
+{
+	if (r->result || !r->cmds[i].readcnt)
+		return 0;
+	return memcmp(r->cmds[i].readarr, buf, r->cmds[i].readcnt) != 0;
+}
+
+static int replay_record(struct flashctx *flash, struct trace_record *r, unsigned int index)
+{
+	struct spi_command *cmds;
+	uint8_t *buf;
+	unsigned int i;
+	int ret, differs = 0;
+
+	if (r->type == TRACE_DELAY) {
+		programmer_delay(r->addr);
+		return 0;
+	}
+	/* Replay with fresh read buffers, the recorded data is compared below. */
+	cmds = calloc(r->count + 1, sizeof(*cmds));
+	if (!cmds) {
+		msg_gerr("Out of memory!\n");
+		exit(1);
+	}
+	for (i = 0; i < r->count; i++) {
+		cmds[i] = r->cmds[i];
+		cmds[i].readarr = r->cmds[i].readcnt ? malloc(r->cmds[i].readcnt) : NULL;
+		if (r->cmds[i].readcnt && !cmds[i].readarr) {
+			msg_gerr("Out of memory!\n");
+			exit(1);
+		}
+	}
+	buf = cmds[0].readarr ? cmds[0].readarr : (uint8_t *)cmds[0].writearr;
+	switch (r->type) {
+	case TRACE_COMMAND:
+		ret = spi_send_command(flash, cmds[0].writecnt, cmds[0].readcnt, cmds[0].writearr,
+				       cmds[0].readarr);
+		break;
+	case TRACE_MULTICOMMAND:
+		ret = spi_send_multicommand(flash, cmds);
+		break;
+	case TRACE_READ:
+		ret = flash->pgm->spi.read(flash, buf, r->addr, cmds[0].readcnt);
+		break;
+	case TRACE_WRITE_256:
+		ret = flash->pgm->spi.write_256(flash, buf, r->addr, cmds[0].writecnt);
+		break;
+	default:
+		ret = flash->pgm->spi.write_aai(flash, buf, r->addr, cmds[0].writecnt);
+		break;
+	}
+	if ((ret != 0) != r->result) {
+		msg_cdbg("Record %u (%s): %s now, %s in the trace.\n", index, trace_type_name(r->type),
+			 ret ? "failed" : "succeeded", r->result ? "failed" : "succeeded");
+		differs = 1;
+	}
+	for (i = 0; i < r->count; i++) {
+		if (!ret && compare_read(r, i, cmds[i].readarr)) {
+			msg_cdbg("Record %u (%s): command %u read different data.\n", index,
+				 trace_type_name(r->type), i);
+			differs = 1;
+		}
+		free(cmds[i].readarr);
+	}
+	free(cmds);
+	return differs;
+}
+
+/*
+ * Replay the trace in filename into the programmer of flash. The read data and
+ * results are compared with the recording, and the time the replay took with
+ * the time recorded, which shows the host side overhead.
+ */
+int spi_trace_replay(struct flashctx *flash, const char *filename)
+{
+	struct trace_record r;
+	uint64_t rec_wall = 0, rec_calls = 0, start, t, calls = 0;
+	unsigned int records = 0, differences = 0;
+	FILE *f;
+	int ret;
+
+	if (!(flash->chip->bustype & BUS_SPI)) {
+		msg_cerr("SPI traces can only be replayed to SPI chips.\n");
+		return 1;
+	}
+	f = open_trace(filename);
+	if (!f)
+		return 1;
+	msg_cinfo("Replaying SPI trace... ");
+	start = time_us();
+	while (!(ret = read_record(f, filename, &r))) {
+		rec_wall += r.delta_us;
+		if (r.type != TRACE_DELAY)
+			rec_calls += r.duration_us;
+		t = time_us();
+		differences += replay_record(flash, &r, records++);
+		if (r.type != TRACE_DELAY)
+			calls += time_us() - t;
+		free_record(&r);
+	}
+	t = time_us() - start;
+	fclose(f);
+	if (ret < 0) {
+		msg_cinfo("FAILED.\n");
+		return 1;
+	}
+	msg_cinfo("%s.\n", differences ? "DIFFERENCES" : "done");
+	msg_cinfo("Replayed %u records in %llu us (recorded: %llu us), %llu us in programmer calls "
+		  "(recorded: %llu us).\n", records, (unsigned long long)t, (unsigned long long)rec_wall,
+		  (unsigned long long)calls, (unsigned long long)rec_calls);
+	if (differences)
+		msg_cerr("%u records differ from the trace (-V shows which).\n", differences);
+	return differences != 0;
+}
+
+struct trace_summary {
+	unsigned int records;
+	unsigned long long commands;
+	unsigned long long bytes_out;
+	unsigned long long bytes_in;
+	unsigned long long delay_us;
+	unsigned long long wall_us;
+	unsigned long long call_us;
+};
+
+static void summarize_record(struct trace_summary *s, const struct trace_record *r)
+{
+	unsigned int i;
+
+	s->records++;
+	s->wall_us += r->delta_us;
+	if (r->type == TRACE_DELAY) {
+		s->delay_us += r->addr;
+		return;
+	}
+	s->call_us += r->duration_us;
+	for (i = 0; i < r->count; i++) {
+		s->commands++;
+		s->bytes_out += r->cmds[i].writecnt;
+		s->bytes_in += r->cmds[i].readcnt;
+	}
+}
+
+/* Describe the first difference between two records, or return NULL. */
+static const char *diff_record(const struct trace_record *a, const struct trace_record *b)
+{
+	unsigned int i;
+
+	if (a->type != b->type)
+		return "type";
+	if (a->result != b->result)
+		return "result";
+	if (a->addr != b->addr)
+		return (a->type == TRACE_DELAY) ? "delay" : "address";
+	if (a->count != b->count)
+		return "number of commands";
+	for (i = 0; i < a->count; i++) {
+		if (a->cmds[i].writecnt != b->cmds[i].writecnt || a->cmds[i].readcnt != b->cmds[i].readcnt)
+			return "command length";
+		if (a->cmds[i].delay_us != b->cmds[i].delay_us)
+			return "command delay";
+		if (memcmp(a->cmds[i].writearr, b->cmds[i].writearr, a->cmds[i].writecnt))
+			return "data written";
+		if (memcmp(a->cmds[i].readarr, b->cmds[i].readarr, a->cmds[i].readcnt))
+			return "data read";
+	}
+	return NULL;
+}
+
+static void print_summary(const char *filename, const struct trace_summary *s)
+{
+	msg_ginfo("%s: %u records, %llu commands, %llu bytes out, %llu bytes in, %llu us delays, "
+		  "%llu us total, %llu us in programmer calls\n", filename, s->records, s->commands,
+		  s->bytes_out, s->bytes_in, s->delay_us, s->wall_us, s->call_us);
+}
+
+/* Read a whole trace into *records. Returns the number of records or -1. */
+static int load_trace(const char *filename, struct trace_record **records)
+{
+	struct trace_record *tmp;
+	unsigned int count = 0, alloc = 0;
+	FILE *f;
+	int ret;
+
+	*records = NULL;
+	f = open_trace(filename);
+	if (!f)
+		return -1;
+	while (1) {
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(*records, alloc * sizeof(**records));
+			if (!tmp) {
+				msg_gerr("Out of memory!\n");
+				exit(1);
+			}
+			*records = tmp;
+		}
+		ret = read_record(f, filename, &(*records)[count]);
+		if (ret)
+			break;
+		count++;
+	}
+	fclose(f);
+	if (ret < 0) {
+		while (count)
+			free_record(&(*records)[--count]);
+		free(*records);
+		*records = NULL;
+		return -1;
+	}
+	return count;
+}
+
+static void free_trace(struct trace_record *records, int count)
+{
+	while (count > 0)
+		free_record(&records[--count]);
+	free(records);
+}
+
+/* Records searched ahead to get two traces back in sync after a difference. */
+#define TRACE_RESYNC_WINDOW	64
+
+/*
+ * Compare two traces, ignoring timing. Records which are only in one of the
+ * traces (e.g. the probe of a replay which was recorded again) are skipped if
+ * the traces match again afterwards. Returns 0 if the traces describe the same
+ * transactions.
+ */
+int spi_trace_diff(const char *file_a, const char *file_b)
+{
+	struct trace_summary sa = { 0 }, sb = { 0 };
+	struct trace_record *ra, *rb;
+	int na, nb, i = 0, j = 0, k, differences = 0;
+	const char *what;
+
+	na = load_trace(file_a, &ra);
+	if (na < 0)
+		return 1;
+	nb = load_trace(file_b, &rb);
+	if (nb < 0) {
+		free_trace(ra, na);
+		return 1;
+	}
+	for (k = 0; k < na; k++)
+		summarize_record(&sa, &ra[k]);
+	for (k = 0; k < nb; k++)
+		summarize_record(&sb, &rb[k]);
+
+	while (i < na && j < nb) {
+		what = diff_record(&ra[i], &rb[j]);
+		if (!what) {
+			i++;
+			j++;
+			continue;
+		}
+		differences++;
+		/* Try to skip records which are only in one trace. */
+		for (k = 1; k <= TRACE_RESYNC_WINDOW; k++) {
+			if (i + k < na && !diff_record(&ra[i + k], &rb[j])) {
+				if (differences <= TRACE_MAX_REPORTED)
+					msg_ginfo("Records %d-%d are only in %s.\n", i, i + k - 1, file_a);
+				i += k;
+				break;
+			}
+			if (j + k < nb && !diff_record(&ra[i], &rb[j + k])) {
+				if (differences <= TRACE_MAX_REPORTED)
+					msg_ginfo("Records %d-%d are only in %s.\n", j, j + k - 1, file_b);
+				j += k;
+				break;
+			}
+		}
+		if (k <= TRACE_RESYNC_WINDOW)
+			continue;
+		if (differences <= TRACE_MAX_REPORTED)
+			msg_ginfo("Record %d/%d: %s differs (%s vs. %s).\n", i, j, what,
+				  trace_type_name(ra[i].type), trace_type_name(rb[j].type));
+		i++;
+		j++;
+	}
+	if (i < na || j < nb) {
+		differences++;
+		if (differences <= TRACE_MAX_REPORTED)
+			msg_ginfo("%s has %d more records.\n", (i < na) ? file_a : file_b,
+				  (i < na) ? na - i : nb - j);
+	}
+	if (differences > TRACE_MAX_REPORTED)
+		msg_ginfo("%d more differences.\n", differences - TRACE_MAX_REPORTED);
+	print_summary(file_a, &sa);
+	print_summary(file_b, &sb);
+	msg_ginfo("The traces are %s.\n", differences ? "different" : "identical");
+	free_trace(ra, na);
+	free_trace(rb, nb);
+	return differences != 0;
+}
@@ -70,10 +70,8 @@ int erase_sector_28sf040(struct flashctx *flash, unsigned int address,
 	chip_writeb(flash, AUTO_PG_ERASE2, bios + address);
 
 	/* wait for Toggle bit ready */
-	toggle_ready_jedec(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_erase(flash, bios, sector_size);
 }
 
 /* chunksize is 1 */
@@ -96,7 +94,8 @@ int write_28sf040(struct flashctx *flash, uint8_t *src, unsigned int start,
 		chip_writeb(flash, *src++, dst++);
 
 		/* wait for Toggle bit ready */
-		toggle_ready_jedec(flash, bios);
+		if (toggle_ready_jedec(flash, bios))
+			return 1;
 	}
 
 	return 0;
@@ -110,10 +109,9 @@ static int erase_28sf040(struct flashctx *flash)
 	chip_writeb(flash, CHIP_ERASE, bios);
 
 	programmer_delay(10);
-	toggle_ready_jedec(flash, bios);
-
 	/* FIXME: Check the status register for errors. */
-	return 0;
+	return toggle_ready_jedec_erase(flash, bios,
+					flash->chip->total_size * 1024);
 }
 
 int erase_chip_28sf040(struct flashctx *flash, unsigned int addr,
@@ -191,6 +191,26 @@ void internal_delay(int usecs)
 	}
 }
 
+/* Microseconds since an arbitrary point in time, for timeouts and statistics.
+ * gettimeofday() may jump backwards (e.g. when the clock is set), but callers
+ * compute deadlines from differences, so never let the result decrease.
+ */
+uint64_t time_us(void)
+{
+	static uint64_t last = 0, offset = 0;
+	struct timeval now;
+	uint64_t t;
+
+	gettimeofday(&now, NULL);
+	t = (uint64_t)now.tv_sec * 1000000 + now.tv_usec + offset;
+	if (t < last) {
+		offset += last - t;
+		t = last;
+	}
+	last = t;
+	return t;
+}
+
 #else 
 #include <libpayload.h>
 
@@ -203,4 +223,9 @@ void internal_delay(int usecs)
 {
 	udelay(usecs);
 }
+
+uint64_t time_us(void)
+{
+	return timer_us(0);
+}
 #endif